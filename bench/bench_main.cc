@@ -0,0 +1,318 @@
+#include "generators.hh"
+
+#include "eval.hh"
+#include "expr_builder.hh"
+#include "image.hh"
+#include "native.hh"
+#include "parallel.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+using namespace glfdc;
+using namespace glfdc::bench;
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+
+// Minimal wall time of single sample, iteration count is doubled until reached
+constexpr auto MIN_SAMPLE_TIME = std::chrono::milliseconds(20);
+constexpr std::size_t NSAMPLES = 5;
+
+struct Options
+{
+  bool json = false;
+  std::string filter; // substring of "<generator>/<benchmark>"
+};
+
+struct Result
+{
+  const char* generator;
+  std::size_t size;
+  const char* benchmark;
+  std::size_t nodes;       // unique DAG nodes
+  std::size_t ops;         // units of work per iteration (create_sexpr calls, evaluations...)
+  double ns_per_op;        // best of samples
+  double ns_per_op_median;
+};
+
+// Runs fn(iterations) repeatedly, fn returns number of ops done
+template <typename Fn_>
+std::pair<double, double> measure(Fn_&& fn)
+{
+  std::size_t iterations = 1;
+
+  // Calibrate
+  for (;;)
+  {
+    const auto start = bench_clock::now();
+    fn(iterations);
+
+    if (bench_clock::now() - start >= MIN_SAMPLE_TIME)
+      break;
+
+    iterations *= 2;
+  }
+
+  std::vector<double> samples;
+
+  for (std::size_t s=0; s<NSAMPLES; ++s)
+  {
+    const auto start = bench_clock::now();
+    const std::size_t ops = fn(iterations);
+    const std::chrono::duration<double, std::nano> elapsed = bench_clock::now() - start;
+
+    samples.push_back(elapsed.count() / double(ops));
+  }
+
+  std::sort(samples.begin(), samples.end());
+  return std::make_pair(samples.front(), samples[samples.size() / 2]);
+}
+
+void print_header(const Options& opts)
+{
+  if (!opts.json)
+    std::printf("generator,size,benchmark,nodes,ops,ns_per_op,ns_per_op_median,ops_per_sec\n");
+}
+
+void print(const Options& opts, const Result& r)
+{
+  const double ops_per_sec = 1e9 / r.ns_per_op;
+
+  if (opts.json)
+  {
+    std::printf("{\"generator\": \"%s\", \"size\": %zu, \"benchmark\": \"%s\", \"nodes\": %zu, \"ops\": %zu, "
+                "\"ns_per_op\": %.3f, \"ns_per_op_median\": %.3f, \"ops_per_sec\": %.1f}\n",
+                r.generator, r.size, r.benchmark, r.nodes, r.ops, r.ns_per_op, r.ns_per_op_median, ops_per_sec);
+  }
+  else
+  {
+    std::printf("%s,%zu,%s,%zu,%zu,%.3f,%.3f,%.1f\n",
+                r.generator, r.size, r.benchmark, r.nodes, r.ops, r.ns_per_op, r.ns_per_op_median, ops_per_sec);
+  }
+
+  std::fflush(stdout);
+}
+
+void run_generator(const Options& opts, const Generator& gen)
+{
+  const auto bindings = make_bindings(NBINDINGS);
+
+  auto selected = [&](const char* benchmark) {
+    return opts.filter.empty() || (std::string(gen.name) + "/" + benchmark).find(opts.filter) != std::string::npos;
+  };
+
+  auto report = [&](const char* benchmark, std::size_t nodes, std::size_t ops, std::pair<double, double> t) {
+    print(opts, Result{gen.name, gen.size, benchmark, nodes, ops, t.first, t.second});
+  };
+
+  // Builder kept for evaluation benchmarks
+  ExpressionBuilder builder;
+  const Generated g = gen.generate(builder, gen.size, bindings);
+  const std::size_t nodes = builder.dag().node_count();
+
+  if (selected("create_sexpr"))
+  {
+    ExpressionBuilder scratch_builder;
+
+    const auto t = measure([&](std::size_t iterations) {
+      for (std::size_t i=0; i<iterations; ++i)
+      {
+        scratch_builder.reset();
+        gen.generate(scratch_builder, gen.size, bindings);
+      }
+
+      return iterations * g.ncreates;
+    });
+
+    report("create_sexpr", nodes, g.ncreates, t);
+  }
+
+  if (is_value(g.root))
+    return;
+
+  const Expr expr = builder.create_expr(g.root).value();
+
+  const auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+  const auto lazy_mapping = std::apply(ReusedExprMapping::create_lazy_mapping, builder.reuses());
+
+  if (selected("prepare_eager"))
+  {
+    const auto t = measure([&](std::size_t iterations) {
+      for (std::size_t i=0; i<iterations; ++i)
+        ExprEvaluator eval(expr);
+
+      return iterations;
+    });
+
+    report("prepare_eager", nodes, 1, t);
+  }
+
+  if (selected("prepare_lazy"))
+  {
+    const auto t = measure([&](std::size_t iterations) {
+      for (std::size_t i=0; i<iterations; ++i)
+        ExprEvaluator eval(expr, lazy_mapping);
+
+      return iterations;
+    });
+
+    report("prepare_lazy", nodes, 1, t);
+  }
+
+  // Cold start from image instead of create_sexpr + prepare_*
+  if (selected("open_image"))
+  {
+    const std::string path = (std::filesystem::temp_directory_path() / "glfdc_bench.img").string();
+
+    const ExprEvaluator eager(expr);
+    const ExprEvaluator lazy(expr, lazy_mapping);
+
+    if (write_image(path, builder.dag(), {&eager, &lazy}))
+    {
+      const auto t = measure([&](std::size_t iterations) {
+        for (std::size_t i=0; i<iterations; ++i)
+          MappedImage::open(path);
+
+        return iterations;
+      });
+
+      report("open_image", nodes, 1, t);
+    }
+
+    std::filesystem::remove(path);
+  }
+
+  std::vector<scalar_type> binding_values;
+
+  for (auto binding : builder.dag().unbound_values_)
+    binding_values.push_back(binding_value(binding));
+
+  auto bench_evaluate = [&](const char* benchmark, const ReusedExprMapping& mapping, bool clear_memo) {
+    if (!selected(benchmark))
+      return;
+
+    const ExprEvaluator eval(expr, mapping);
+    EvalState es(mapping);
+
+    volatile scalar_type sink = 0;
+
+    const auto t = measure([&](std::size_t iterations) {
+      for (std::size_t i=0; i<iterations; ++i)
+      {
+        if (clear_memo)
+          es.clear();
+
+        sink = eval.evaluate(es, binding_values.data());
+      }
+
+      return iterations;
+    });
+
+    (void)sink;
+    report(benchmark, nodes, 1, t);
+  };
+
+  bench_evaluate("evaluate_eager", eager_mapping, false);
+  bench_evaluate("evaluate_lazy", lazy_mapping, true);
+
+  // Batch of independent evaluations spread over all cores
+  if (selected("evaluate_parallel"))
+  {
+    constexpr std::size_t njobs = 1024;
+
+    const ExprEvaluator eval(expr);
+    ParallelEvaluator parallel;
+
+    const std::vector<EvalJob> jobs(njobs, EvalJob{&eval, binding_values.data()});
+    std::vector<scalar_type> results(njobs);
+
+    const auto t = measure([&](std::size_t iterations) {
+      for (std::size_t i=0; i<iterations; ++i)
+        parallel.evaluate(jobs.data(), jobs.size(), results.data());
+
+      return iterations * njobs;
+    });
+
+    report("evaluate_parallel", nodes, njobs, t);
+  }
+
+  if (selected("evaluate_native"))
+  {
+    NativeCompiler compiler((std::filesystem::temp_directory_path() / "glfdc_bench_native").string());
+    const NativeEvaluator eval = compiler.load(expr);
+
+    // Skipped without system compiler - it would measure interpreter again
+    if (!eval.is_native())
+      return;
+
+    EvalState es(eager_mapping);
+    volatile scalar_type sink = 0;
+
+    const auto t = measure([&](std::size_t iterations) {
+      for (std::size_t i=0; i<iterations; ++i)
+        sink = eval.evaluate(es, binding_values.data());
+
+      return iterations;
+    });
+
+    (void)sink;
+    report("evaluate_native", nodes, 1, t);
+  }
+}
+
+void usage(const char* argv0)
+{
+  std::printf("usage: %s [--json] [--list] [--filter <substring of generator/benchmark>]\n", argv0);
+}
+
+} // namespace anonymous
+
+int main(int argc, char** argv)
+{
+  const Generator generators[] = {
+    {"deep_chain", 1000, deep_chain},
+    {"wide_tree", 4096, wide_tree},
+    {"shared_dag", 10, shared_dag},
+    {"tensor_index", 64, tensor_index},
+  };
+
+  Options opts;
+
+  for (int i=1; i<argc; ++i)
+  {
+    if (std::strcmp(argv[i], "--json") == 0)
+    {
+      opts.json = true;
+    }
+    else if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+    {
+      opts.filter = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--list") == 0)
+    {
+      for (const auto& gen : generators)
+        std::printf("%s %zu\n", gen.name, gen.size);
+
+      return 0;
+    }
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  print_header(opts);
+
+  for (const auto& gen : generators)
+    run_generator(opts, gen);
+
+  return 0;
+}
@@ -0,0 +1,175 @@
+#include "generators.hh"
+
+#include <cassert>
+
+using namespace glfdc;
+using namespace glfdc::bench;
+
+namespace {
+
+const OperatorKind all_ops[] = {
+  OperatorKind::add, OperatorKind::mul, OperatorKind::sub, OperatorKind::mod, OperatorKind::div
+};
+
+// Counts create_sexpr() calls made by generator
+struct CountingBuilder
+{
+  ExpressionBuilder& builder_;
+  std::size_t ncreates_ = 0;
+
+  template <typename L_, typename R_>
+  Operand operator()(OperatorKind op, L_ l, R_ r)
+  {
+    ++ncreates_;
+    return builder_.create_sexpr(op, l, r);
+  }
+};
+
+} // namespace anonymous
+
+std::vector<uintptr_t> bench::make_bindings(std::size_t n)
+{
+  std::vector<uintptr_t> ret(n);
+
+  // Aligned fake addresses, like real binding cookies
+  for (std::size_t i=0; i<n; ++i)
+    ret[i] = uintptr_t(0x10000 + 64 * i);
+
+  return ret;
+}
+
+scalar_type bench::binding_value(uintptr_t binding) noexcept
+{
+  return scalar_type((binding >> 6) % 97) + 3;
+}
+
+Generated bench::deep_chain(ExpressionBuilder& builder, std::size_t size, const std::vector<uintptr_t>& bindings)
+{
+  assert(bindings.size() >= NBINDINGS);
+  CountingBuilder create{builder};
+
+  Operand acc = builder.get_binding(bindings[0]);
+
+  for (std::size_t i=1; i<=size; ++i)
+  {
+    const OperatorKind op = all_ops[i % std::size(all_ops)];
+
+    // Alternate bindings and constants, so nothing gets folded away
+    if (i % 2)
+      acc = create(op, acc, builder.get_binding(bindings[i % NBINDINGS]));
+    else
+      acc = create(op, acc, Value(scalar_type(i % 13 + 2)));
+  }
+
+  return Generated{acc, create.ncreates_};
+}
+
+Generated bench::wide_tree(ExpressionBuilder& builder, std::size_t size, const std::vector<uintptr_t>& bindings)
+{
+  assert(bindings.size() >= NBINDINGS);
+  CountingBuilder create{builder};
+
+  std::vector<Operand> level;
+  level.reserve(size);
+
+  for (std::size_t i=0; i<size; ++i)
+    level.push_back(create(OperatorKind::mul, builder.get_binding(bindings[i % NBINDINGS]), Value(scalar_type(i + 2))));
+
+  std::size_t op_idx = 0;
+
+  while (level.size() > 1)
+  {
+    std::vector<Operand> next;
+    next.reserve(level.size() / 2 + 1);
+
+    for (std::size_t i=0; i+1<level.size(); i+=2)
+      next.push_back(create(all_ops[op_idx++ % std::size(all_ops)], level[i], level[i+1]));
+
+    if (level.size() % 2)
+      next.push_back(level.back());
+
+    level = std::move(next);
+  }
+
+  return Generated{level.front(), create.ncreates_};
+}
+
+Generated bench::shared_dag(ExpressionBuilder& builder, std::size_t size, const std::vector<uintptr_t>& bindings)
+{
+  assert(bindings.size() >= NBINDINGS);
+  CountingBuilder create{builder};
+
+  constexpr std::size_t width = 8;
+
+  std::vector<Operand> layer;
+
+  for (std::size_t i=0; i<width; ++i)
+    layer.push_back(create(OperatorKind::add, builder.get_binding(bindings[i]), Value(scalar_type(i + 1))));
+
+  for (std::size_t d=0; d<size; ++d)
+  {
+    std::vector<Operand> next;
+
+    // Every node is used by two nodes of next layer
+    for (std::size_t i=0; i<width; ++i)
+      next.push_back(create(all_ops[(d + i) % 3], layer[i], layer[(i + 1) % width]));
+
+    layer = std::move(next);
+  }
+
+  Operand root = layer[0];
+
+  for (std::size_t i=1; i<width; ++i)
+    root = create(OperatorKind::add, root, layer[i]);
+
+  return Generated{root, create.ncreates_};
+}
+
+Generated bench::tensor_index(ExpressionBuilder& builder, std::size_t size, const std::vector<uintptr_t>& bindings)
+{
+  assert(bindings.size() >= NBINDINGS);
+  CountingBuilder create{builder};
+
+  constexpr std::size_t rank = 4;
+
+  // Indices of loop nest and symbolic extents of tensor
+  Value idx[rank], extent[rank];
+
+  for (std::size_t i=0; i<rank; ++i)
+  {
+    idx[i] = builder.get_binding(bindings[i]);
+    extent[i] = builder.get_binding(bindings[rank + i]);
+  }
+
+  // Row-major strides - shared by all accesses
+  Operand stride[rank];
+  stride[rank - 1] = Value(scalar_type(1));
+
+  for (std::size_t i=rank-1; i>0; --i)
+    stride[i - 1] = (i == rank - 1)? Operand(extent[i]) : create(OperatorKind::mul, stride[i], extent[i]);
+
+  Operand sum = Value(scalar_type(0));
+
+  for (std::size_t a=0; a<size; ++a)
+  {
+    // Stencil-like access tensor[idx + shift]
+    Operand offset = Value(scalar_type(0));
+
+    for (std::size_t i=0; i<rank; ++i)
+    {
+      const scalar_type shift = scalar_type((a >> i) % 3) - 1;
+      Operand shifted = (shift == 0)? Operand(idx[i]) : create(OperatorKind::add, idx[i], Value(shift));
+
+      offset = create(OperatorKind::add, offset, create(OperatorKind::mul, shifted, stride[i]));
+    }
+
+    // Delinearize flat offset back to (outer, inner) coordinate of reshaped tensor
+    const std::size_t split = 1 + a % (rank - 1);
+    Operand outer = create(OperatorKind::div, offset, stride[split - 1]);
+    Operand inner = create(OperatorKind::mod, offset, stride[split - 1]);
+
+    sum = create(OperatorKind::add, sum, create(OperatorKind::add, create(OperatorKind::mul, outer, Value(scalar_type(a + 1))), inner));
+  }
+
+  return Generated{sum, create.ncreates_};
+}
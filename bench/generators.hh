@@ -0,0 +1,50 @@
+#pragma once
+
+#include "expr_builder.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace glfdc::bench {
+
+// Result of single generator run
+struct Generated
+{
+  Operand root;
+  std::size_t ncreates; // number of create_sexpr() calls made
+};
+
+// Synthetic expression shape, size is generator specific (see each one)
+struct Generator
+{
+  const char* name;
+  std::size_t size;
+
+  Generated (*generate)(ExpressionBuilder& builder, std::size_t size, const std::vector<uintptr_t>& bindings);
+};
+
+// ((((x0 op c0) op x1) op c1) ...) - size is chain length, depth grows linearly
+Generated deep_chain(ExpressionBuilder& builder, std::size_t size, const std::vector<uintptr_t>& bindings);
+
+// Balanced binary tree over size leaves, each leaf is distinct (binding op constant)
+Generated wide_tree(ExpressionBuilder& builder, std::size_t size, const std::vector<uintptr_t>& bindings);
+
+// Layers of 8 nodes each combining two nodes of previous layer - size is number of layers.
+// DAG is O(size), expanded tree grows exponentially with it.
+Generated shared_dag(ExpressionBuilder& builder, std::size_t size, const std::vector<uintptr_t>& bindings);
+
+// Sum of size rank 4 tensor element offsets: linearization of shifted indices with symbolic
+// strides and delinearization of flat index by div/mod, as emitted for fused tensor loops
+Generated tensor_index(ExpressionBuilder& builder, std::size_t size, const std::vector<uintptr_t>& bindings);
+
+// Binding cookies used by generators - need at least this many
+constexpr std::size_t NBINDINGS = 16;
+
+std::vector<uintptr_t> make_bindings(std::size_t n);
+
+// Deterministic value of binding, never 0
+scalar_type binding_value(uintptr_t binding) noexcept;
+
+} // namespace glfdc::bench
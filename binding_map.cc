@@ -0,0 +1 @@
+#include "binding_map.hh"
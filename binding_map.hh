@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace glfdc
+{
+
+// Flat open addressing map from binding address to slot of its UnboundValue.
+//
+// Linear probing over power of two capacity, key and value are stored together so lookup touches
+// single cache line in common case. Key 0 marks empty slot of table, so it is kept aside in its own
+// slot - any uintptr_t is valid key.
+//
+// Entries are never erased one by one, only all at once by clear().
+class binding_map
+{
+  using entry_t = std::pair<uintptr_t, std::size_t>;
+
+public:
+  binding_map() = default;
+
+  explicit binding_map(std::pmr::memory_resource* mr) : entries_(mr) {}
+
+  std::optional<std::size_t> find(uintptr_t key) const noexcept // O(1)
+  {
+    if (key == EMPTY)
+      return zero_;
+
+    if (entries_.empty())
+      return std::nullopt;
+
+    for (std::size_t pos = home(key); ; pos = next(pos))
+    {
+      const entry_t& e = entries_[pos];
+
+      if (e.first == key)
+        return e.second;
+
+      if (e.first == EMPTY)
+        return std::nullopt;
+    }
+  }
+
+  bool has(uintptr_t key) const noexcept
+  {
+    return find(key).has_value();
+  }
+
+  // Hints CPU to load home slot of key - used to overlap cache misses of bulk lookups
+  void prefetch(uintptr_t key) const noexcept
+  {
+#if defined(__GNUC__)
+    if (!entries_.empty())
+      __builtin_prefetch(entries_.data() + home(key));
+#else
+    (void)key;
+#endif
+  }
+
+  // NB: Precondition is that there is no existing mapping for key (as in sparse_map)
+  void insert(uintptr_t key, std::size_t v) // O(1) amortized
+  {
+    assert(!has(key));
+
+    if (key == EMPTY)
+    {
+      zero_ = v;
+      ++size_;
+      return;
+    }
+
+    if ((size_ + 1) * MAX_LOAD_DEN > capacity() * MAX_LOAD_NUM)
+      rehash(std::max(MIN_CAPACITY, capacity() * 2));
+
+    place(key, v);
+    ++size_;
+  }
+
+  // Makes room for n entries without rehashing
+  void reserve(std::size_t n)
+  {
+    std::size_t cap = MIN_CAPACITY;
+
+    while (n * MAX_LOAD_DEN > cap * MAX_LOAD_NUM)
+      cap *= 2;
+
+    if (cap > capacity())
+      rehash(cap);
+  }
+
+  // Removes all entries but keeps capacity
+  void clear() noexcept // O(capacity)
+  {
+    std::fill(entries_.begin(), entries_.end(), entry_t(EMPTY, 0));
+    zero_.reset();
+    size_ = 0;
+  }
+
+  std::size_t size() const noexcept
+  {
+    return size_;
+  }
+
+  bool empty() const noexcept
+  {
+    return size_ == 0;
+  }
+
+  std::size_t capacity() const noexcept
+  {
+    return entries_.size();
+  }
+
+private:
+  static constexpr uintptr_t EMPTY = 0;
+  static constexpr std::size_t MIN_CAPACITY = 16;
+
+  // Max load factor 3/4 - no Robin Hood here, keep probe sequences short
+  static constexpr std::size_t MAX_LOAD_NUM = 3;
+  static constexpr std::size_t MAX_LOAD_DEN = 4;
+
+  std::size_t home(uintptr_t key) const noexcept
+  {
+    // Fibonacci hashing - addresses are aligned so low bits carry no information
+    constexpr std::uint64_t golden = 0x9e3779b97f4a7c15ull;
+    return std::size_t((std::uint64_t(key) * golden) >> shift_);
+  }
+
+  std::size_t next(std::size_t pos) const noexcept
+  {
+    return (pos + 1) & (capacity() - 1);
+  }
+
+  void place(uintptr_t key, std::size_t v) noexcept
+  {
+    std::size_t pos = home(key);
+
+    while (entries_[pos].first != EMPTY)
+      pos = next(pos);
+
+    entries_[pos] = entry_t(key, v);
+  }
+
+  void rehash(std::size_t new_capacity)
+  {
+    assert((new_capacity & (new_capacity - 1)) == 0 && "Power of two");
+    assert(new_capacity >= size_);
+
+    std::pmr::vector<entry_t> old_entries(new_capacity, entry_t(EMPTY, 0), entries_.get_allocator());
+    old_entries.swap(entries_);
+
+    shift_ = 64;
+    for (std::size_t c = new_capacity; c > 1; c /= 2)
+      --shift_;
+
+    for (const entry_t& e : old_entries)
+    {
+      if (e.first != EMPTY)
+        place(e.first, e.second);
+    }
+  }
+
+  std::pmr::vector<entry_t> entries_;
+  std::optional<std::size_t> zero_; // value of key 0, which can't be stored in table
+
+  std::size_t size_ = 0;
+  unsigned shift_ = 64;
+};
+
+} // namespace glfdc
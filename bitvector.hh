@@ -1,10 +1,11 @@
 #pragma once
 
+#include <memory_resource>
 #include <vector>
 
 namespace glfdc {
 
-using bitvector_t = std::vector<bool>;
+using bitvector_t = std::pmr::vector<bool>;
 
 } // namespace glfdc
 
@@ -0,0 +1,628 @@
+#include "bytecode.hh"
+
+#include "cfold.hh"
+#include "eval.hh"
+#include "expr.hh"
+#include "interval.hh"
+#include "kernels.hh"
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+
+using namespace glfdc;
+
+namespace {
+
+struct BytecodeEmitter
+{
+  const ExprDAG& dag_;
+  const ReusedExprMapping& mapping_;
+
+  std::pmr::vector<Instruction>& code_;
+  std::pmr::vector<uintptr_t>& bindings_;
+  std::pmr::vector<std::size_t>& binding_ids_;
+  std::pmr::vector<DivMagic>& divisors_;
+
+  const RangeAnalysis* ranges_; // may be nullptr
+
+  sparse_map binding_slots_; // UnboundValue index -> binding slot
+
+  // Unique subexpressions of expression
+  struct Node
+  {
+    std::uint32_t users_ = 0;
+    std::uint32_t register_ = NO_REGISTER;
+    std::size_t region_ = NO_REGION; // innermost memo region register was written in
+  };
+
+  static constexpr std::uint32_t NO_REGISTER = std::uint32_t(-1);
+  static constexpr std::size_t NO_REGION = std::size_t(-1);
+
+  sparse_map node_index_; // node id -> index of Node
+  std::vector<Node> nodes_;
+
+  // Code between memo_load and its subexpression instruction is a region skipped on memo hit.
+  // Regions nest, open ones are on the stack.
+  std::vector<std::size_t> open_regions_;
+  std::vector<bool> region_open_;
+
+  std::size_t depth_ = 0;
+  std::size_t max_depth_ = 0;
+  std::size_t nregisters_ = 0;
+  bool memoized_ = false;
+
+  void push_depth() noexcept
+  {
+    ++depth_;
+    max_depth_ = std::max(max_depth_, depth_);
+  }
+
+  // Subexpression or binding which may take single value only
+  std::optional<scalar_type> folded(Operand op) const noexcept
+  {
+    if (!ranges_ || is_scalar(op))
+      return std::nullopt;
+
+    return ranges_->constant(op);
+  }
+
+  Node& node(SExprRef ref) noexcept
+  {
+    return nodes_[node_index_.find(dag_.node_id(ref)).value()];
+  }
+
+  // Counts users of each unique subexpression reachable from root - O(n) in unique subexpressions
+  void count_users(SExprRef root)
+  {
+    node_index_.insert(dag_.node_id(root), nodes_.size());
+    nodes_.emplace_back();
+
+    std::vector<SExprRef> stack{root};
+
+    while (!stack.empty())
+    {
+      const SExpr e = dag_.fetch(stack.back());
+      stack.pop_back();
+
+      for (Operand op : {e.lhs_, e.rhs_})
+      {
+        // Folded subexpressions aren't emitted
+        if (!is_sexpr(op) || folded(op).has_value())
+          continue;
+
+        const SExprRef ref = std::get<SExprRef>(op);
+        const std::size_t id = dag_.node_id(ref);
+
+        if (!node_index_.has(id))
+        {
+          node_index_.insert(id, nodes_.size());
+          nodes_.emplace_back();
+          stack.push_back(ref);
+        }
+
+        ++nodes_[node_index_.find(id).value()].users_;
+      }
+    }
+  }
+
+  // Register holds value of node at current position of code - it was written outside of regions
+  // which may be skipped before it
+  bool is_available(const Node& n) const noexcept
+  {
+    return n.register_ != NO_REGISTER && (n.region_ == NO_REGION || region_open_[n.region_]);
+  }
+
+  ArgKind emit_operand(Operand op, InstrArg& arg)
+  {
+    if (const auto c = folded(op))
+    {
+      arg.imm_ = c.value();
+      return ArgKind::imm;
+    }
+
+    if (is_sexpr(op))
+    {
+      const SExprRef ref = std::get<SExprRef>(op);
+      const Node& n = node(ref);
+
+      if (is_available(n))
+      {
+        arg.slot_ = n.register_;
+        return ArgKind::reg;
+      }
+
+      // Code of subexpression is emitted by caller
+      return ArgKind::stack;
+    }
+
+    const auto val = std::get<Value>(op);
+
+    if (!is_unbound_value(op))
+    {
+      arg.imm_ = std::get<scalar_type>(val);
+      return ArgKind::imm;
+    }
+
+    arg.slot_ = detail::assign_binding_slot(dag_, std::get<UnboundValue>(val), binding_slots_,
+                                            bindings_, binding_ids_);
+    return ArgKind::binding;
+  }
+
+  // Replaces division by constant with its strength reduced form
+  void specialize_divisor(Instruction& instr)
+  {
+    const bool is_div = (instr.code_ == OpCode::div);
+
+    if ((!is_div && instr.code_ != OpCode::mod) || instr.rhs_kind_ != ArgKind::imm)
+      return;
+
+    const scalar_type d = instr.rhs_.imm_;
+
+    // Nothing to gain, -1 also keeps INT_MIN / -1 behavior of cfold
+    if (d == 0 || d == 1 || d == -1)
+      return;
+
+    if (const auto k = detail::pow2_shift(d))
+    {
+      // Shift stays immediate - scalar and batch paths read it as any other imm argument
+      instr.code_ = is_div? OpCode::div_pow2 : OpCode::mod_pow2;
+      instr.rhs_.imm_ = scalar_type(*k);
+      return;
+    }
+
+    instr.code_ = is_div? OpCode::div_magic : OpCode::mod_magic;
+    instr.rhs_.slot_ = std::uint32_t(divisors_.size());
+    divisors_.push_back(DivMagic::create(d));
+  }
+
+  // Drops zero divisor check of division whose divisor range excludes zero
+  void specialize_range(Instruction& instr, const SExpr& e)
+  {
+    const bool is_div = (instr.code_ == OpCode::div);
+
+    if (!ranges_ || (!is_div && instr.code_ != OpCode::mod))
+      return;
+
+    const Interval divisor = ranges_->range(e.rhs_);
+
+    if (divisor.contains(0))
+      return;
+
+    if (divisor.fits_bits(24) && ranges_->range(e.lhs_).fits_bits(24))
+      instr.code_ = is_div? OpCode::div_narrow : OpCode::mod_narrow;
+    else
+      instr.code_ = is_div? OpCode::div_nz : OpCode::mod_nz;
+  }
+
+  // Node whose code is being emitted
+  struct Frame
+  {
+    SExprRef ref_;
+    SExpr e_;
+    Instruction instr_;
+    std::size_t load_pc_;
+    unsigned next_operand_; // 0 - lhs, 1 - rhs, 2 - both operands emitted
+  };
+
+  std::vector<Frame> frames_ = {};
+
+  void begin(SExprRef ref)
+  {
+    const auto opt_memo = mapping_.slot(ref);
+    const std::size_t load_pc = code_.size();
+
+    if (opt_memo.has_value())
+    {
+      memoized_ = true;
+      code_.push_back(Instruction{OpCode::memo_load, ArgKind::imm, ArgKind::imm,
+                                  std::uint32_t(opt_memo.value()), {0}, {0}});
+
+      open_regions_.push_back(region_open_.size());
+      region_open_.push_back(true);
+    }
+
+    const SExpr e = dag_.fetch(ref);
+
+    Instruction instr{detail::opcode_of(e.op_), ArgKind::imm, ArgKind::imm, Instruction::NO_SLOT, {0}, {0}};
+
+    if (opt_memo.has_value())
+      instr.memo_slot_ = std::uint32_t(opt_memo.value());
+
+    frames_.push_back(Frame{ref, e, instr, load_pc, 0});
+  }
+
+  void finish(Frame& f)
+  {
+    Instruction& instr = f.instr_;
+
+    specialize_divisor(instr);
+    specialize_range(instr, f.e_);
+
+    // Operands of subexpressions were left on stack
+    depth_ -= std::size_t(instr.lhs_kind_ == ArgKind::stack) + std::size_t(instr.rhs_kind_ == ArgKind::stack);
+    push_depth();
+
+    if (instr.memo_slot_ != Instruction::NO_SLOT)
+    {
+      code_[f.load_pc_].rhs_.slot_ = std::uint32_t(code_.size() + 1);
+
+      region_open_[open_regions_.back()] = false;
+      open_regions_.pop_back();
+    }
+
+    code_.push_back(instr);
+
+    // Memo hit jumps here as well, so register is written whenever this point is reached
+    Node& n = node(f.ref_);
+
+    if (n.users_ > 1)
+    {
+      if (n.register_ == NO_REGISTER)
+        n.register_ = std::uint32_t(nregisters_++);
+
+      n.region_ = open_regions_.empty()? NO_REGION : open_regions_.back();
+
+      Instruction store{OpCode::reg_store, ArgKind::reg, ArgKind::imm, Instruction::NO_SLOT, {0}, {0}};
+      store.lhs_.slot_ = n.register_;
+
+      code_.push_back(store);
+    }
+  }
+
+  // Iterative postorder - deep chains don't exhaust native stack
+  void emit(SExprRef root)
+  {
+    begin(root);
+
+    while (!frames_.empty())
+    {
+      Frame& f = frames_.back();
+
+      if (f.next_operand_ == 2)
+      {
+        finish(f);
+        frames_.pop_back();
+        continue;
+      }
+
+      // Register of rhs may be written by lhs code - operands are resolved one by one
+      const bool is_lhs = (f.next_operand_++ == 0);
+      const Operand op = is_lhs? f.e_.lhs_ : f.e_.rhs_;
+      ArgKind& kind = is_lhs? f.instr_.lhs_kind_ : f.instr_.rhs_kind_;
+
+      kind = emit_operand(op, is_lhs? f.instr_.lhs_ : f.instr_.rhs_);
+
+      // NB: invalidates f
+      if (kind == ArgKind::stack)
+        begin(std::get<SExprRef>(op));
+    }
+  }
+};
+
+template <typename Scalar_>
+inline Scalar_ load_arg(ArgKind kind, InstrArg arg, const Scalar_* bindings, const Scalar_* stack,
+                        const Scalar_* registers, std::size_t& sp) noexcept
+{
+  switch (kind)
+  {
+  case ArgKind::imm:
+    return Scalar_(arg.imm_);
+  case ArgKind::binding:
+    return bindings[arg.slot_];
+  case ArgKind::stack:
+    return stack[--sp];
+  case ArgKind::reg:
+    return registers[arg.slot_];
+  }
+
+  assert(false && "Unreachable");
+  return 0;
+}
+
+} // namespace anonymous
+
+OpCode detail::opcode_of(OperatorKind op) noexcept
+{
+  switch(op)
+  {
+  case OperatorKind::add:
+    return OpCode::add;
+  case OperatorKind::sub:
+    return OpCode::sub;
+  case OperatorKind::mul:
+    return OpCode::mul;
+  case OperatorKind::div:
+    return OpCode::div;
+  case OperatorKind::mod:
+    return OpCode::mod;
+  }
+
+  assert(false && "Unreachable");
+  return OpCode::add;
+}
+
+std::uint32_t detail::assign_binding_slot(const ExprDAG& dag, UnboundValue unbound, sparse_map& slots,
+                                          std::pmr::vector<uintptr_t>& bindings, std::pmr::vector<std::size_t>& binding_ids)
+{
+  auto opt_slot = slots.find(unbound.index_);
+
+  if (!opt_slot.has_value())
+  {
+    opt_slot = bindings.size();
+    slots.insert(unbound.index_, opt_slot.value());
+    bindings.push_back(dag.get_binding(unbound));
+    binding_ids.push_back(unbound.index_);
+  }
+
+  return std::uint32_t(opt_slot.value());
+}
+
+Bytecode Bytecode::compile(const Expr& e, const ReusedExprMapping& mapping,
+                           std::pmr::memory_resource* mr) // O(n)
+{
+  return compile(e, mapping, nullptr, mr);
+}
+
+Bytecode Bytecode::compile(const Expr& e, const ReusedExprMapping& mapping, const RangeAnalysis* ranges,
+                           std::pmr::memory_resource* mr) // O(n)
+{
+  assert((!ranges || &ranges->dag() == &e.dag_) && "Ranges of different DAG");
+
+  Bytecode ret(mr);
+
+  BytecodeEmitter emitter{e.dag_, mapping, ret.code_, ret.bindings_, ret.binding_ids_, ret.divisors_,
+                          ranges, sparse_map(e.dag_.unbound_values_.size()), sparse_map(e.dag_.node_count()),
+                          {}, {}, {}, {}};
+
+  // Whole expression is single value - x+0 of it
+  if (const auto c = ranges? ranges->constant(Operand(e.subexpr_)) : std::nullopt)
+  {
+    ret.code_.push_back(Instruction{OpCode::add, ArgKind::imm, ArgKind::imm, Instruction::NO_SLOT, {c.value()}, {0}});
+    ret.max_depth_ = 1;
+    return ret;
+  }
+
+  emitter.count_users(e.subexpr_);
+  emitter.emit(e.subexpr_);
+
+  assert(emitter.depth_ == 1 && "Root value should be left on stack");
+
+  ret.max_depth_ = emitter.max_depth_;
+  ret.nregisters_ = emitter.nregisters_;
+  ret.memoized_ = emitter.memoized_;
+
+  return ret;
+}
+
+template <typename Scalar_>
+inline Scalar_ BytecodeView::apply(const Instruction& instr, Scalar_ l, Scalar_ r) const noexcept
+{
+  // Reciprocals are computed for 32b scalars, others divide by the constant
+  if constexpr (!std::is_same_v<Scalar_, scalar_type>)
+  {
+    if (instr.code_ == OpCode::div_magic || instr.code_ == OpCode::mod_magic)
+    {
+      const auto d = Scalar_(divisors_[instr.rhs_.slot_].divisor_);
+      return (instr.code_ == OpCode::div_magic)? Scalar_(l / d) : Scalar_(l % d);
+    }
+  }
+
+  switch (instr.code_)
+  {
+  case OpCode::div_magic:
+    return divisors_[instr.rhs_.slot_].div(l);
+  case OpCode::mod_magic:
+    return divisors_[instr.rhs_.slot_].mod(l);
+  default:
+    return detail::apply_op(instr.code_, l, r);
+  }
+}
+
+template <typename Scalar_>
+Scalar_ BytecodeView::execute(const Scalar_* binding_values, Scalar_* stack, BasicEvalState<Scalar_>& es) const noexcept
+{
+  const Instruction* code = code_;
+  const std::size_t ninstr = ncode_;
+
+  Scalar_* registers = stack + max_depth_;
+
+  std::size_t sp = 0;
+  std::size_t pc = 0;
+
+  EvalCounters counters; // unused unless eval_stats_enabled
+  counters.evaluations_ = 1;
+
+  while (pc < ninstr)
+  {
+    const Instruction& instr = code[pc];
+
+    if (instr.code_ == OpCode::memo_load)
+    {
+      const bool hit = es.has_value(instr.memo_slot_);
+
+      if constexpr (eval_stats_enabled)
+        es.count_memo(instr.memo_slot_, hit);
+
+      if (hit)
+      {
+        stack[sp++] = es.value(instr.memo_slot_);
+        pc = instr.rhs_.slot_;
+
+        if constexpr (eval_stats_enabled)
+          counters.peak_stack_depth_ = std::max<std::uint64_t>(counters.peak_stack_depth_, sp);
+      }
+      else
+      {
+        ++pc;
+      }
+
+      continue;
+    }
+
+    if (instr.code_ == OpCode::reg_store)
+    {
+      registers[instr.lhs_.slot_] = stack[sp - 1];
+      ++pc;
+      continue;
+    }
+
+    // NB: right operand is on top of the stack
+    const Scalar_ rval = load_arg(instr.rhs_kind_, instr.rhs_, binding_values, stack, registers, sp);
+    const Scalar_ lval = load_arg(instr.lhs_kind_, instr.lhs_, binding_values, stack, registers, sp);
+
+    const Scalar_ result = apply(instr, lval, rval);
+
+    if (instr.memo_slot_ != Instruction::NO_SLOT)
+      es.store(instr.memo_slot_, result);
+
+    stack[sp++] = result;
+    ++pc;
+
+    if constexpr (eval_stats_enabled)
+    {
+      ++counters.operations_;
+      counters.peak_stack_depth_ = std::max<std::uint64_t>(counters.peak_stack_depth_, sp);
+    }
+  }
+
+  if constexpr (eval_stats_enabled)
+    es.count(counters);
+
+  assert(sp == 1);
+  return stack[0];
+}
+
+template <typename Scalar_>
+void BytecodeView::execute_batch(const Scalar_* const* binding_columns, std::size_t nlanes,
+                                 Scalar_* results, Scalar_* scratch) const noexcept
+{
+  constexpr std::size_t block = BATCH_LANES;
+
+  // Scratch layout: [lhs immediate][rhs immediate][stack of max_depth_ blocks][nregisters_ blocks]
+  Scalar_* lhs_imm = scratch;
+  Scalar_* rhs_imm = scratch + block;
+  Scalar_* stack = scratch + 2 * block;
+  Scalar_* registers = stack + max_depth_ * block;
+
+  for (std::size_t base = 0; base < nlanes; base += block)
+  {
+    const std::size_t nblock = std::min(block, nlanes - base);
+    std::size_t sp = 0;
+
+    auto arg_lanes = [&](ArgKind kind, InstrArg arg, Scalar_* imm_block) -> const Scalar_* {
+      switch (kind)
+      {
+      case ArgKind::imm:
+        std::fill_n(imm_block, nblock, Scalar_(arg.imm_));
+        return imm_block;
+      case ArgKind::binding:
+        return binding_columns[binding_ids_[arg.slot_]] + base;
+      case ArgKind::stack:
+        return stack + (--sp) * block;
+      case ArgKind::reg:
+        return registers + arg.slot_ * block;
+      }
+
+      assert(false && "Unreachable");
+      return imm_block;
+    };
+
+    for (std::size_t pc = 0; pc < ncode_; ++pc)
+    {
+      const Instruction& instr = code_[pc];
+
+      // Lanes may differ in what was evaluated - evaluate everything
+      if (instr.code_ == OpCode::memo_load)
+        continue;
+
+      if (instr.code_ == OpCode::reg_store)
+      {
+        std::copy_n(stack + (sp - 1) * block, nblock, registers + instr.lhs_.slot_ * block);
+        continue;
+      }
+
+      const Scalar_* rlanes = arg_lanes(instr.rhs_kind_, instr.rhs_, rhs_imm);
+      const Scalar_* llanes = arg_lanes(instr.lhs_kind_, instr.lhs_, lhs_imm);
+
+      Scalar_* out = stack + (sp++) * block;
+
+      if constexpr (std::is_same_v<Scalar_, scalar_type>)
+      {
+        if (instr.code_ == OpCode::div_magic || instr.code_ == OpCode::mod_magic)
+          detail::batch_apply_magic(instr.code_, divisors_[instr.rhs_.slot_], llanes, out, nblock);
+        else
+          detail::batch_apply(instr.code_, llanes, rlanes, out, nblock);
+      }
+      else
+      {
+        for (std::size_t i = 0; i < nblock; ++i)
+          out[i] = apply(instr, llanes[i], rlanes[i]);
+      }
+    }
+
+    assert(sp == 1);
+    std::copy_n(stack, nblock, results + base);
+  }
+}
+
+template <typename Scalar_>
+bool BytecodeView::fits() const noexcept
+{
+  using limits = std::numeric_limits<Scalar_>;
+
+  auto fits_arg = [](ArgKind kind, InstrArg arg) {
+    return kind != ArgKind::imm || (arg.imm_ >= limits::min() && arg.imm_ <= limits::max());
+  };
+
+  // Immediates of add, sub and mul are truncated on load - the result is the same modulo 2^n.
+  // Quotient and remainder are not, so operands of division and constant divisors must fit.
+  for (std::size_t pc = 0; pc < ncode_; ++pc)
+  {
+    const Instruction& instr = code_[pc];
+
+    switch (instr.code_)
+    {
+    case OpCode::div:
+    case OpCode::mod:
+    case OpCode::div_nz:
+    case OpCode::mod_nz:
+    case OpCode::div_narrow:
+    case OpCode::mod_narrow:
+      if (!fits_arg(instr.lhs_kind_, instr.lhs_) || !fits_arg(instr.rhs_kind_, instr.rhs_))
+        return false;
+      break;
+    case OpCode::div_pow2:
+    case OpCode::mod_pow2:
+      // Divisor 2^k
+      if (!fits_arg(instr.lhs_kind_, instr.lhs_) || instr.rhs_.imm_ >= limits::digits)
+        return false;
+      break;
+    case OpCode::div_magic:
+    case OpCode::mod_magic:
+    {
+      const scalar_type d = divisors_[instr.rhs_.slot_].divisor_;
+
+      if (!fits_arg(instr.lhs_kind_, instr.lhs_) || d < limits::min() || d > limits::max())
+        return false;
+      break;
+    }
+    default:
+      break;
+    }
+  }
+
+  return true;
+}
+
+// Evaluation scalar types
+#define GLFDC_INSTANTIATE_BYTECODE(scalar_) \
+  template scalar_ BytecodeView::execute(const scalar_*, scalar_*, BasicEvalState<scalar_>&) const noexcept; \
+  template void BytecodeView::execute_batch(const scalar_* const*, std::size_t, scalar_*, scalar_*) const noexcept; \
+  template bool BytecodeView::fits<scalar_>() const noexcept;
+
+GLFDC_INSTANTIATE_BYTECODE(std::int16_t)
+GLFDC_INSTANTIATE_BYTECODE(std::int32_t)
+GLFDC_INSTANTIATE_BYTECODE(std::int64_t)
+
+#undef GLFDC_INSTANTIATE_BYTECODE
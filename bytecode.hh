@@ -0,0 +1,331 @@
+#pragma once
+
+#include "cfold.hh"
+#include "divisor.hh"
+#include "sexpr.hh"
+
+#include <cstdint>
+#include <memory_resource>
+#include <type_traits>
+#include <vector>
+
+namespace glfdc {
+
+class sparse_map;
+class RangeAnalysis;
+
+struct Expr;
+struct ExprDAG;
+struct ReusedExprMapping;
+
+template <typename Scalar_>
+struct BasicEvalState;
+
+using EvalState = BasicEvalState<scalar_type>;
+
+enum class OpCode : std::uint8_t
+{
+  add,
+  sub,
+  mul,
+  div,
+  mod,
+  // Divisor range excludes zero (see RangeAnalysis) - no zero divisor check
+  div_nz,
+  mod_nz,
+  // As div_nz/mod_nz, but both operands also fit 24 bits - batch lanes divide in single precision
+  div_narrow,
+  mod_narrow,
+  // Division by constant, rhs is not a value but:
+  div_pow2,  // immediate shift k of divisor 2^k
+  mod_pow2,  // immediate shift k of divisor 2^k
+  div_magic, // index of DivMagic in Bytecode::divisors()
+  mod_magic, // index of DivMagic in Bytecode::divisors()
+  // Pushes memoized value and jumps over subexpression code if it was already evaluated
+  memo_load,
+  // Copies value on top of the stack into register lhs_ - stack is unchanged
+  reg_store,
+};
+
+enum class ArgKind : std::uint8_t
+{
+  imm,     // scalar immediate stored inline
+  binding, // index of binding slot resolved once before evaluation
+  stack,   // result of preceding subexpression code - popped from stack
+  reg,     // result of earlier instruction of ExprProgram, register written by reg_store in Bytecode
+};
+
+// Binding function - any callable resolving binding cookie into its value
+template <typename BindFn_, typename Scalar_ = scalar_type>
+using enable_if_binding_fn_t = std::enable_if_t<std::is_invocable_r_v<Scalar_, BindFn_&, uintptr_t>, int>;
+
+union InstrArg
+{
+  scalar_type imm_;
+  std::uint32_t slot_;
+};
+
+// Single self-contained instruction - no need to look back into ExprDAG during evaluation
+struct Instruction
+{
+  OpCode code_;
+  ArgKind lhs_kind_;
+  ArgKind rhs_kind_;
+
+  // Memo slot to store result into (or to load from for memo_load) or NO_SLOT if not reused
+  std::uint32_t memo_slot_;
+
+  InstrArg lhs_;
+  InstrArg rhs_; // for memo_load: index of first instruction past subexpression code
+
+  static constexpr std::uint32_t NO_SLOT = std::uint32_t(-1);
+};
+
+static_assert(sizeof(Instruction) <= 16, "Instruction should stay compact");
+
+// Non-owning view of compiled code - of Bytecode itself or of code stored in mapped image (see image.hh).
+// Evaluation runs directly off the viewed arrays.
+struct BytecodeView
+{
+  const Instruction* code_;
+  std::size_t ncode_;
+
+  const uintptr_t* bindings_;      // binding cookie of each binding slot
+  const std::size_t* binding_ids_; // UnboundValue index of each binding slot
+  std::size_t nbindings_;
+
+  const DivMagic* divisors_;
+
+  std::size_t max_depth_;
+  std::size_t nregisters_;
+  bool memoized_;
+
+  // Number of lanes evaluated at once by execute_batch()
+  static constexpr std::size_t BATCH_LANES = 64;
+
+  // See Bytecode::execute()
+  template <typename Scalar_>
+  Scalar_ execute(const Scalar_* binding_values, Scalar_* stack, BasicEvalState<Scalar_>& es) const noexcept;
+
+  // See Bytecode::execute_batch()
+  template <typename Scalar_>
+  void execute_batch(const Scalar_* const* binding_columns, std::size_t nlanes,
+                     Scalar_* results, Scalar_* scratch) const noexcept;
+
+  // See Bytecode::fits()
+  template <typename Scalar_>
+  bool fits() const noexcept;
+
+  // See Bytecode::frame_size()
+  std::size_t frame_size() const noexcept
+  {
+    return max_depth_ + nregisters_;
+  }
+
+  std::size_t batch_scratch_size() const noexcept
+  {
+    return (frame_size() + 2) * BATCH_LANES;
+  }
+
+private:
+  template <typename Scalar_>
+  Scalar_ apply(const Instruction& instr, Scalar_ l, Scalar_ r) const noexcept;
+};
+
+// Flat postorder instruction stream of expression DAG evaluated by stack machine.
+//
+// Layout of code emitted for single subexpression node:
+//
+// [memo_load]  - only if node is reused in mapping
+// [lhs code]   - only if lhs is subexpression not held in register
+// [rhs code]   - only if rhs is subexpression not held in register
+// [op]
+// [reg_store]  - only if node has more than one user within expression
+//
+// Code of node with many users is emitted once and later users read its register, so code size is
+// linear in number of unique subexpressions. Only if register was written within code skipped by memo
+// hit of another subexpression, node code is emitted again for users past skipped code.
+//
+// Division and modulo by constant are strength reduced to shifts (powers of two) or multiplication
+// by precomputed reciprocal (other divisors), see divisor.hh.
+//
+// Compiled with RangeAnalysis, subexpressions whose range is single value are emitted as immediates
+// and division or modulo by divisor excluding zero skips zero check (div_nz and others).
+//
+// Code is compiled once and may be executed in any scalar type instantiated in bytecode.cc
+// (std::int16_t, std::int32_t, std::int64_t) - immediates are widened or narrowed on load, see fits().
+// Vector kernels of execute_batch() are used for 32b scalars, other types are evaluated lane by lane.
+//
+// NB: memo slots are indices of ReusedExprMapping code was compiled with.
+class Bytecode
+{
+public:
+  Bytecode() = default;
+
+  explicit Bytecode(std::pmr::memory_resource* mr) : code_(mr), bindings_(mr), binding_ids_(mr), divisors_(mr) {}
+
+  // Code and binding tables are allocated from mr
+  static Bytecode compile(const Expr& e, const ReusedExprMapping& mapping,
+                          std::pmr::memory_resource* mr = std::pmr::get_default_resource());
+
+  // Specializes code for ranges of the same DAG, ranges may be nullptr.
+  // NB: Results are unspecified for binding values out of ranges, or if code specialized for ranges
+  // is executed in other scalar than scalar_type.
+  static Bytecode compile(const Expr& e, const ReusedExprMapping& mapping, const RangeAnalysis* ranges,
+                          std::pmr::memory_resource* mr = std::pmr::get_default_resource());
+
+  // Precondition: binding_values holds bindings().size() values,
+  // stack has room for frame_size() values.
+  template <typename Scalar_>
+  Scalar_ execute(const Scalar_* binding_values, Scalar_* stack, BasicEvalState<Scalar_>& es) const noexcept
+  {
+    return view().execute(binding_values, stack, es);
+  }
+
+  // Every operand of division and constant divisor of code is representable in Scalar_ - O(n).
+  // Other immediates are truncated on load, which keeps add, sub and mul exact modulo 2^n.
+  template <typename Scalar_>
+  bool fits() const noexcept
+  {
+    return view().fits<Scalar_>();
+  }
+
+  // Number of lanes evaluated at once by execute_batch()
+  static constexpr std::size_t BATCH_LANES = BytecodeView::BATCH_LANES;
+
+  std::size_t batch_scratch_size() const noexcept
+  {
+    return view().batch_scratch_size();
+  }
+
+  // Evaluates code for nlanes binding sets stored as structure of arrays:
+  // binding_columns[UnboundValue::index_][lane].
+  // Memoization is not used - every lane is evaluated in full.
+  //
+  // Precondition: scratch has room for batch_scratch_size() values.
+  template <typename Scalar_>
+  void execute_batch(const Scalar_* const* binding_columns, std::size_t nlanes,
+                     Scalar_* results, Scalar_* scratch) const noexcept
+  {
+    view().execute_batch(binding_columns, nlanes, results, scratch);
+  }
+
+  BytecodeView view() const noexcept
+  {
+    return BytecodeView{code_.data(), code_.size(), bindings_.data(), binding_ids_.data(), bindings_.size(),
+                        divisors_.data(), max_depth_, nregisters_, memoized_};
+  }
+
+  const std::pmr::vector<Instruction>& code() const noexcept
+  {
+    return code_;
+  }
+
+  // Binding cookie of each binding slot
+  const std::pmr::vector<uintptr_t>& bindings() const noexcept
+  {
+    return bindings_;
+  }
+
+  // UnboundValue index of each binding slot
+  const std::pmr::vector<std::size_t>& binding_ids() const noexcept
+  {
+    return binding_ids_;
+  }
+
+  // Constant divisors referenced by div_magic and mod_magic instructions
+  const std::pmr::vector<DivMagic>& divisors() const noexcept
+  {
+    return divisors_;
+  }
+
+  std::size_t max_depth() const noexcept
+  {
+    return max_depth_;
+  }
+
+  std::size_t register_count() const noexcept
+  {
+    return nregisters_;
+  }
+
+  // Values of evaluation stack followed by registers needed by execute()
+  std::size_t frame_size() const noexcept
+  {
+    return max_depth_ + nregisters_;
+  }
+
+  bool is_memoized() const noexcept
+  {
+    return memoized_;
+  }
+
+private:
+  std::pmr::vector<Instruction> code_;
+  std::pmr::vector<uintptr_t> bindings_;
+  std::pmr::vector<std::size_t> binding_ids_;
+  std::pmr::vector<DivMagic> divisors_;
+
+  std::size_t max_depth_ = 0;
+  std::size_t nregisters_ = 0;
+  bool memoized_ = false;
+};
+
+namespace detail {
+
+// Result of instruction with code, except of div_magic and mod_magic which need their DivMagic.
+// Divisor of div_pow2 and mod_pow2 is 2^r.
+template <typename Scalar_>
+inline Scalar_ apply_op(OpCode code, Scalar_ l, Scalar_ r) noexcept
+{
+  // Shifts of narrow scalars are done in int
+  using shift_type = std::common_type_t<Scalar_, int>;
+
+  switch (code)
+  {
+  case OpCode::add:
+    return Scalar_(l + r);
+  case OpCode::sub:
+    return Scalar_(l - r);
+  case OpCode::mul:
+    return Scalar_(l * r);
+  case OpCode::div:
+    return cfold(OperatorKind::div, l, r);
+  case OpCode::mod:
+    return cfold(OperatorKind::mod, l, r);
+  case OpCode::div_nz:
+  case OpCode::div_narrow:
+    return Scalar_(l / r);
+  case OpCode::mod_nz:
+  case OpCode::mod_narrow:
+    return Scalar_(l % r);
+  case OpCode::div_pow2:
+    if constexpr (std::is_same_v<Scalar_, scalar_type>)
+      return div_pow2(l, unsigned(r));
+    else
+      return Scalar_(shift_type(l) / (shift_type(1) << r));
+  case OpCode::mod_pow2:
+    if constexpr (std::is_same_v<Scalar_, scalar_type>)
+      return mod_pow2(l, unsigned(r));
+    else
+      return Scalar_(shift_type(l) % (shift_type(1) << r));
+  case OpCode::div_magic:
+  case OpCode::mod_magic:
+  case OpCode::memo_load:
+  case OpCode::reg_store:
+    break;
+  }
+
+  assert(false && "Unreachable");
+  return 0;
+}
+
+OpCode opcode_of(OperatorKind op) noexcept;
+
+// Returns binding slot of unbound - assigns next one on first use
+std::uint32_t assign_binding_slot(const ExprDAG& dag, UnboundValue unbound, sparse_map& slots,
+                                  std::pmr::vector<uintptr_t>& bindings, std::pmr::vector<std::size_t>& binding_ids);
+
+} // namespace detail
+
+} // namespace glfdc
@@ -4,32 +4,39 @@
 
 #include <cassert>
 #include <optional>
+#include <type_traits>
 
 namespace glfdc {
 
-inline scalar_type cfold(OperatorKind op, scalar_type l, scalar_type r) noexcept
+// Value of l op r, division and modulo by zero give 0. Scalar_ is any evaluation scalar type, operands of
+// types narrower than int are computed in int and truncated back.
+template <typename Scalar_>
+constexpr Scalar_ cfold(OperatorKind op, Scalar_ l, Scalar_ r) noexcept
 {
+  static_assert(std::is_integral_v<Scalar_> && std::is_signed_v<Scalar_>, "Signed integer scalar");
+
   switch(op)
   {
   case OperatorKind::add:
-    return l + r; 
+    return Scalar_(l + r);
   case OperatorKind::sub:
-    return l - r;
+    return Scalar_(l - r);
   case OperatorKind::mul:
-    return l * r;
+    return Scalar_(l * r);
   case OperatorKind::div:
   {
     if (r == 0) return 0;
-    return l / r;
+    return Scalar_(l / r);
   }
   case OperatorKind::mod:
   {
     if (r == 0) return 0;
-    return l % r;
+    return Scalar_(l % r);
   }
   }
 
   assert(false && "Unreachable");
+  return 0;
 }
 
 inline std::optional<scalar_type> cfold(OperatorKind op, Operand v1, Operand v2)
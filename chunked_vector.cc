@@ -0,0 +1 @@
+#include "chunked_vector.hh"
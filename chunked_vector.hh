@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+
+namespace glfdc
+{
+
+// Append-only array safe for concurrent push_back().
+//
+// Elements live in fixed size chunks which are never moved, so references stay valid while other
+// threads append. Chunk table is allocated upfront, chunks are allocated on first use and installed
+// by CAS.
+//
+// NB: operator[] doesn't synchronize with push_back() - reader has to learn index from writer through
+// some synchronization (e.g. lock protecting hash-consing table), or after writers were joined.
+template <typename Ty_, std::size_t ChunkBits_ = 14>
+class chunked_vector
+{
+public:
+  static constexpr std::size_t CHUNK_SIZE = std::size_t(1) << ChunkBits_;
+  static constexpr std::size_t MAX_CHUNKS = std::size_t(1) << 14;
+
+  chunked_vector() : chunks_(new std::atomic<Ty_*>[MAX_CHUNKS])
+  {
+    for (std::size_t i=0; i<MAX_CHUNKS; ++i)
+      chunks_[i].store(nullptr, std::memory_order_relaxed);
+  }
+
+  chunked_vector(const chunked_vector&) = delete;
+  chunked_vector& operator=(const chunked_vector&) = delete;
+
+  ~chunked_vector()
+  {
+    for (std::size_t i=0; i<MAX_CHUNKS; ++i)
+      delete[] chunks_[i].load(std::memory_order_relaxed);
+  }
+
+  // Returns index of appended element. Thread-safe, lock-free unless new chunk has to be allocated.
+  std::size_t push_back(const Ty_& v)
+  {
+    const std::size_t i = size_.fetch_add(1, std::memory_order_relaxed);
+    assert((i >> ChunkBits_) < MAX_CHUNKS && "chunked_vector is full");
+
+    chunk(i >> ChunkBits_)[i & (CHUNK_SIZE - 1)] = v;
+    return i;
+  }
+
+  const Ty_& operator[](std::size_t i) const noexcept // O(1)
+  {
+    assert(i < size());
+    return chunks_[i >> ChunkBits_].load(std::memory_order_acquire)[i & (CHUNK_SIZE - 1)];
+  }
+
+  // Number of appended elements, including ones still being written by concurrent push_back()
+  std::size_t size() const noexcept
+  {
+    return size_.load(std::memory_order_acquire);
+  }
+
+  bool empty() const noexcept
+  {
+    return size() == 0;
+  }
+
+  // Calls fn with each contiguous run of elements. Not thread-safe.
+  template <typename Fn_>
+  void for_each_chunk(Fn_&& fn) const
+  {
+    const std::size_t n = size();
+
+    for (std::size_t base=0; base<n; base+=CHUNK_SIZE)
+    {
+      const Ty_* data = chunks_[base >> ChunkBits_].load(std::memory_order_acquire);
+      fn(data, std::min(CHUNK_SIZE, n - base));
+    }
+  }
+
+private:
+  Ty_* chunk(std::size_t c)
+  {
+    Ty_* ptr = chunks_[c].load(std::memory_order_acquire);
+
+    if (ptr)
+      return ptr;
+
+    // Loser of allocation race frees its chunk
+    Ty_* fresh = new Ty_[CHUNK_SIZE];
+
+    if (chunks_[c].compare_exchange_strong(ptr, fresh, std::memory_order_acq_rel))
+      return fresh;
+
+    delete[] fresh;
+    return ptr;
+  }
+
+  std::unique_ptr<std::atomic<Ty_*>[]> chunks_;
+  std::atomic<std::size_t> size_{0};
+};
+
+} // namespace glfdc
@@ -0,0 +1,141 @@
+#include "concurrent_builder.hh"
+
+#include "cfold.hh"
+#include "sexpr_cmp.hh"
+
+#include <tuple>
+
+using namespace glfdc;
+
+namespace {
+
+constexpr std::uint64_t FIBONACCI_MULTIPLIER = 0x9E3779B97F4A7C15ull;
+
+// Node storage of chunked_vector copied into DAG vector
+void append_chunks(const chunked_vector<PackedSExpr>& from, std::pmr::vector<PackedSExpr>& to)
+{
+  to.reserve(from.size());
+  from.for_each_chunk([&](const PackedSExpr* data, std::size_t n) { to.insert(to.end(), data, data + n); });
+}
+
+} // namespace anonymous
+
+ConcurrentExpressionBuilder::ConcurrentExpressionBuilder(std::size_t nshards)
+{
+  while ((std::size_t(1) << shard_bits_) < nshards)
+    ++shard_bits_;
+
+  for (std::size_t i=0; i<(std::size_t(1) << shard_bits_); ++i)
+  {
+    shards_.push_back(std::make_unique<ExprShard>());
+    binding_shards_.push_back(std::make_unique<BindingShard>());
+  }
+}
+
+std::size_t ConcurrentExpressionBuilder::shard_of(std::size_t hash) const noexcept
+{
+  if (shard_bits_ == 0)
+    return 0;
+
+  // Top bits - tables of shards index by low bits
+  return std::size_t((std::uint64_t(hash) * FIBONACCI_MULTIPLIER) >> (64 - shard_bits_));
+}
+
+void ConcurrentExpressionBuilder::reserve(std::size_t nexprs)
+{
+  for (auto& shard : shards_)
+    shard->table_.reserve(nexprs / shards_.size() + 1);
+}
+
+Value ConcurrentExpressionBuilder::get_binding(uintptr_t unbound)
+{
+  BindingShard& shard = *binding_shards_[shard_of(std::size_t(unbound))];
+  std::lock_guard<std::mutex> lock(shard.mutex_);
+
+  if (const auto slot = shard.lookup_.find(unbound))
+    return UnboundValue{slot.value()};
+
+  const std::size_t slot = unbound_values_.push_back(unbound);
+  shard.lookup_.insert(unbound, slot);
+
+  return UnboundValue{slot};
+}
+
+Operand ConcurrentExpressionBuilder::create_sexpr(OperatorKind op, Operand l, Operand r)
+{
+  const bool is_commutative = (op == OperatorKind::add) || (op == OperatorKind::mul);
+
+  if (is_commutative && detail::svalue(l) > detail::svalue(r))
+    std::swap(l, r);
+
+  if (const auto folded = cfold(op, l, r))
+    return Value(folded.value());
+
+  const auto e = PackedSExpr::pack(SExpr{l, r, op});
+  const std::size_t hash = sexpr_table::hash(e);
+
+  ExprShard& shard = *shards_[shard_of(hash)];
+  std::lock_guard<std::mutex> lock(shard.mutex_);
+
+  if (const auto seen = shard.table_.find(e, hash))
+  {
+    shard.hits_.push_back(*seen);
+    return *seen;
+  }
+
+  // Node is written before it is published in table - threads finding it see its content
+  const SExprRef ref = e.is_unbound()? SExprRef(LExprRef{unbound_exprs_.push_back(e)})
+                                     : SExprRef(IExprRef{internal_exprs_.push_back(e)});
+
+  shard.table_.insert(e, ref, hash);
+
+  return ref;
+}
+
+const ExprDAG& ConcurrentExpressionBuilder::finish()
+{
+  dag_.clear();
+
+  append_chunks(unbound_exprs_, dag_.unbound_exprs_);
+  append_chunks(internal_exprs_, dag_.internal_exprs_);
+
+  dag_.unbound_values_.reserve(unbound_values_.size());
+  dag_.unbound_lookup_.reserve(unbound_values_.size());
+
+  for (std::size_t i=0; i<unbound_values_.size(); ++i)
+  {
+    dag_.unbound_values_.push_back(unbound_values_[i]);
+    dag_.unbound_lookup_.insert(unbound_values_[i], i);
+  }
+
+  // Same as ExpressionBuilder::mark_reuse() - operands of every node and nodes found in table are
+  // reused, descendants of both are operands as well
+  reused_unbound_.assign(dag_.unbound_exprs_.size(), false);
+  reused_internal_.assign(dag_.internal_exprs_.size(), false);
+
+  auto mark = [this](SExprRef ref) {
+    (is_lref(ref)? reused_unbound_ : reused_internal_)[ref_index(ref)] = true;
+  };
+
+  for (const auto* nodes : {&dag_.unbound_exprs_, &dag_.internal_exprs_})
+  {
+    for (const PackedSExpr& packed : *nodes)
+    {
+      const SExpr e = packed.unpack();
+
+      if (is_sexpr(e.lhs_))
+        mark(std::get<SExprRef>(e.lhs_));
+
+      if (is_sexpr(e.rhs_))
+        mark(std::get<SExprRef>(e.rhs_));
+    }
+  }
+
+  for (const auto& shard : shards_)
+  {
+    for (SExprRef ref : shard->hits_)
+      mark(ref);
+  }
+
+  return dag_;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "binding_map.hh"
+#include "bitvector.hh"
+#include "chunked_vector.hh"
+#include "expr.hh"
+#include "sexpr_table.hh"
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace glfdc {
+
+// ExpressionBuilder variant for building one DAG from many threads at once.
+//
+// create_sexpr() and get_binding() may be called concurrently. Hash-consing table and binding lookup
+// are split into shards selected by hash, each guarded by its own mutex, so threads contend only when
+// they hit the same shard. Nodes and bindings are appended into chunked_vectors, which never move
+// already created nodes. Identical subexpressions still dedupe to single SExprRef, no matter which
+// thread created them first.
+//
+// Once all building threads are done, finish() publishes everything built so far into regular
+// ExprDAG used for evaluation.
+//
+// Scalar operands are folded and commutative operands reordered like in ExpressionBuilder,
+// algebraic simplification is not done - DAG is the same as of ExpressionBuilder with
+// set_simplify(false), up to order of nodes.
+class ConcurrentExpressionBuilder
+{
+public:
+  // nshards is rounded up to power of two
+  explicit ConcurrentExpressionBuilder(std::size_t nshards = 64);
+
+  ConcurrentExpressionBuilder(const ConcurrentExpressionBuilder&) = delete;
+  ConcurrentExpressionBuilder& operator=(const ConcurrentExpressionBuilder&) = delete;
+
+  Value get_binding(uintptr_t unbound); // O(1), thread-safe
+
+  Operand create_sexpr(OperatorKind op, Operand l, Operand r); // O(1), thread-safe
+  Operand create_sexpr(OperatorKind op, Operand l, Value v) { return create_sexpr(op, l, Operand(v)); }
+  Operand create_sexpr(OperatorKind op, Value v, Operand r) { return create_sexpr(op, Operand(v), r); }
+  Operand create_sexpr(OperatorKind op, Value v1, Value v2) { return create_sexpr(op, Operand(v1), Operand(v2)); }
+
+  // Makes room for nexprs distinct subexpressions in hash-consing table. Not thread-safe.
+  void reserve(std::size_t nexprs);
+
+  // Number of distinct subexpressions created so far
+  std::size_t node_count() const noexcept
+  {
+    return unbound_exprs_.size() + internal_exprs_.size();
+  }
+
+  // Copies nodes and bindings created so far into dag() and computes reuses() - O(n).
+  // NB: Not thread-safe - no thread may create subexpressions meanwhile.
+  const ExprDAG& finish();
+
+  // Valid after finish(). Same rule as ExpressionBuilder::create_expr() - builder doesn't simplify,
+  // so scalar or binding root gives nullopt.
+  std::optional<Expr> create_expr(Operand op) const noexcept
+  {
+    if (is_value(op))
+      return std::nullopt;
+
+    return Expr{dag_, std::get<SExprRef>(op)};
+  }
+
+  const ExprDAG& dag() const noexcept
+  {
+    return dag_;
+  }
+
+  // Same meaning as ExpressionBuilder::reuses(), valid after finish()
+  auto reuses() const
+  {
+    return std::pair<const bitvector_t&, const bitvector_t>(reused_unbound_, reused_internal_);
+  }
+
+  std::size_t shard_count() const noexcept
+  {
+    return shards_.size();
+  }
+
+private:
+  struct alignas(64) ExprShard
+  {
+    std::mutex mutex_;
+    sexpr_table table_;
+    std::vector<SExprRef> hits_; // subexpressions found in table - used more than once
+  };
+
+  struct alignas(64) BindingShard
+  {
+    std::mutex mutex_;
+    binding_map lookup_;
+  };
+
+  std::size_t shard_of(std::size_t hash) const noexcept;
+
+  std::vector<std::unique_ptr<ExprShard>> shards_;
+  std::vector<std::unique_ptr<BindingShard>> binding_shards_;
+  unsigned shard_bits_ = 0;
+
+  chunked_vector<PackedSExpr> unbound_exprs_;
+  chunked_vector<PackedSExpr> internal_exprs_;
+  chunked_vector<uintptr_t> unbound_values_;
+
+  ExprDAG dag_;
+  bitvector_t reused_unbound_;
+  bitvector_t reused_internal_;
+};
+
+} // namespace glfdc
@@ -0,0 +1,58 @@
+#include "divisor.hh"
+
+using namespace glfdc;
+
+DivMagic DivMagic::create(scalar_type d) noexcept
+{
+  using namespace detail;
+
+  assert(d != 0 && d != 1 && d != -1 && "Trivial divisor");
+
+  // Hacker's Delight, figure 10-1 for scalar_bits wide word
+  constexpr unsigned N = scalar_bits;
+  const uscalar_type two_n1 = uscalar_type(uscalar_type(1) << (N - 1));
+
+  const uscalar_type ad = (d < 0)? uscalar_type(uscalar_type(0) - uscalar_type(d)) : uscalar_type(d);
+  const uscalar_type t = uscalar_type(two_n1 + (uscalar_type(d) >> (N - 1)));
+  const uscalar_type anc = uscalar_type(t - 1 - t % ad); // |nc|
+
+  unsigned p = N - 1;
+
+  uscalar_type q1 = uscalar_type(two_n1 / anc);
+  uscalar_type r1 = uscalar_type(two_n1 - q1 * anc);
+  uscalar_type q2 = uscalar_type(two_n1 / ad);
+  uscalar_type r2 = uscalar_type(two_n1 - q2 * ad);
+  uscalar_type delta;
+
+  do
+  {
+    ++p;
+
+    q1 = uscalar_type(2 * q1);
+    r1 = uscalar_type(2 * r1);
+
+    if (r1 >= anc)
+    {
+      ++q1;
+      r1 = uscalar_type(r1 - anc);
+    }
+
+    q2 = uscalar_type(2 * q2);
+    r2 = uscalar_type(2 * r2);
+
+    if (r2 >= ad)
+    {
+      ++q2;
+      r2 = uscalar_type(r2 - ad);
+    }
+
+    delta = uscalar_type(ad - r2);
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+
+  uscalar_type m = uscalar_type(q2 + 1);
+
+  if (d < 0)
+    m = uscalar_type(uscalar_type(0) - m);
+
+  return DivMagic{d, scalar_type(m), p - N};
+}
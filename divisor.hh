@@ -0,0 +1,104 @@
+#pragma once
+
+#include "sexpr.hh"
+
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <type_traits>
+
+namespace glfdc {
+
+namespace detail {
+
+using uscalar_type = std::make_unsigned_t<scalar_type>;
+
+// Integer at least twice as wide as scalar_type - holds full product of two scalars
+using wide_scalar_type = std::conditional_t<(sizeof(scalar_type) <= 4), std::int64_t, __int128>;
+
+constexpr unsigned scalar_bits = std::numeric_limits<uscalar_type>::digits;
+
+// Arithmetic shift right, NB: implementation defined in C++17 but arithmetic on all supported compilers
+inline scalar_type sar(scalar_type x, unsigned k) noexcept
+{
+  return scalar_type(x >> k);
+}
+
+// Returns k if d == 2^k
+inline std::optional<unsigned> pow2_shift(scalar_type d) noexcept
+{
+  if (d <= 0 || (uscalar_type(d) & (uscalar_type(d) - 1)) != 0)
+    return std::nullopt;
+
+  unsigned k = 0;
+
+  while ((uscalar_type(1) << k) != uscalar_type(d))
+    ++k;
+
+  return k;
+}
+
+// n / 2^k rounded toward zero, same as cfold(div, n, 2^k)
+inline scalar_type div_pow2(scalar_type n, unsigned k) noexcept
+{
+  assert(k < scalar_bits - 1);
+
+  // Negative dividend is biased by 2^k-1, so that shift rounds toward zero
+  const uscalar_type mask = uscalar_type((uscalar_type(1) << k) - 1);
+  const uscalar_type bias = uscalar_type(uscalar_type(sar(n, scalar_bits - 1)) & mask);
+
+  return sar(scalar_type(uscalar_type(uscalar_type(n) + bias)), k);
+}
+
+// n % 2^k with sign of dividend, same as cfold(mod, n, 2^k)
+inline scalar_type mod_pow2(scalar_type n, unsigned k) noexcept
+{
+  const scalar_type q = div_pow2(n, k);
+  return scalar_type(uscalar_type(uscalar_type(n) - uscalar_type(uscalar_type(q) << k)));
+}
+
+} // namespace detail
+
+// Signed division by constant replaced by multiplication with its fixed point reciprocal
+// and shift (Hacker's Delight, 10-4). Results match cfold() for every dividend.
+struct DivMagic
+{
+  scalar_type divisor_;
+  scalar_type multiplier_;
+  unsigned shift_;
+
+  // Precondition: |d| >= 2 - smaller divisors are trivial (see simplify())
+  static DivMagic create(scalar_type d) noexcept;
+
+  scalar_type div(scalar_type n) const noexcept
+  {
+    using namespace detail;
+
+    const auto product = wide_scalar_type(multiplier_) * wide_scalar_type(n);
+    uscalar_type q = uscalar_type(product >> scalar_bits);
+
+    // Multiplier didn't fit into scalar_type and was wrapped around
+    if (divisor_ > 0 && multiplier_ < 0)
+      q += uscalar_type(n);
+    else if (divisor_ < 0 && multiplier_ > 0)
+      q -= uscalar_type(n);
+
+    q = uscalar_type(sar(scalar_type(q), shift_));
+
+    // Round toward zero
+    q += uscalar_type(q >> (scalar_bits - 1));
+
+    return scalar_type(q);
+  }
+
+  scalar_type mod(scalar_type n) const noexcept
+  {
+    using namespace detail;
+
+    const scalar_type q = div(n);
+    return scalar_type(uscalar_type(uscalar_type(n) - uscalar_type(uscalar_type(q) * uscalar_type(divisor_))));
+  }
+};
+
+} // namespace glfdc
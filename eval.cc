@@ -3,298 +3,294 @@
 #include "cfold.hh"
 #include "expr.hh"
 
+#include <algorithm>
+
 using namespace glfdc;
 
 namespace {
 
-using skiptree_t = std::vector<std::pair<SExprRef, std::size_t>>;
+// Tags operation index among operands until frame index of its result is known
+constexpr std::uint32_t RESULT_TAG = std::uint32_t(1) << 31;
 
-// Recursive preorder binary tree traversal.
-// Its also counting nodes and values of each subtree;
-template <typename Tree_, typename LeftChildFn_, typename RightChildFn_>
-size_t preorder_dfs_fn(Tree_ t, skiptree_t& list, LeftChildFn_ left_fn, RightChildFn_ right_fn)
-{
-  list.emplace_back(t, 0);
-  size_t index = list.size() - 1;
+const ReusedExprMapping eager_mapping = ReusedExprMapping::create_eager_mapping();
 
-  auto left = left_fn(t);
-  size_t lchild_count = 0, rchild_count = 0;
+} // namespace anonymous
 
-  if (left.has_value())
-    lchild_count = preorder_dfs_fn(left.value(), list, left_fn, right_fn);
+template <typename Scalar_>
+const ExprDAG& BasicExprEvaluator<Scalar_>::dag() const
+{
+  return expr_.dag_;
+}
 
-  auto right = right_fn(t);
+template <typename Scalar_>
+const Expr& BasicExprEvaluator<Scalar_>::expr() const
+{
+  return expr_;
+}
 
-  if (right.has_value())
-    rchild_count = preorder_dfs_fn(right.value(), list, left_fn, right_fn);
+template <typename Scalar_>
+Scalar_ BasicExprEvaluator<Scalar_>::scalar_operand_value(Operand op) noexcept
+{
+  assert(is_value(op));
 
-  list[index].second = lchild_count + rchild_count;
+  if (is_unbound_value(op))
+    // Dummy value to hold a place in frame
+    return EvalStack<Scalar_>::GAP_VALUE;
 
-  return 1 + lchild_count + rchild_count;
+  const auto val = std::get<Value>(op);
+  return Scalar_(std::get<scalar_type>(val));
 }
 
-template <typename Tree_, typename Fn_, typename LeftChildFn_, typename RightChildFn_>
-auto make_preorder_dfs_traversal(Fn_ visit, LeftChildFn_ left_fn, RightChildFn_ right_fn)
+template <typename Scalar_>
+std::uint32_t BasicExprEvaluator<Scalar_>::prepare_eval_operand(Operand op, const sparse_map& results,
+                                                                sparse_map& binding_values)
 {
-  return [visit, left_fn, right_fn] (Tree_ t) -> void {
+  if (is_sexpr(op))
+  {
+    const auto result = results.find(dag().node_id(std::get<SExprRef>(op)));
+    assert(result.has_value() && "Operand should precede its user");
 
-    // XXX: This is already our operation list constructed
-    // we're still missing stack operands information
-    // TODO: rewrite as an iterative traversal or simply return this list?
-    skiptree_t pre_list;
+    return RESULT_TAG | std::uint32_t(result.value());
+  }
 
-    preorder_dfs_fn(t, pre_list, left_fn, right_fn);
+  // Each distinct binding is resolved once
+  if (is_unbound_value(op))
+  {
+    const auto unbound = std::get<UnboundValue>(std::get<Value>(op));
 
-    for (auto p : pre_list)
-      std::apply(visit, p);
-  };
-}
+    if (const auto index = binding_values.find(unbound.index_))
+      return std::uint32_t(index.value());
 
-auto make_sexpr_child_getters(const ExprDAG& dag) noexcept {
+    binding_values.insert(unbound.index_, initial_frame_.size());
+    binding_gaps_.emplace_back(initial_frame_.size(), dag().get_binding(unbound));
+  }
 
-  auto left_child_f =
-    [&d = dag](SExprRef ref) -> std::optional<SExprRef> {
-    SExpr e = d.fetch(ref);
+  initial_frame_.push_back(scalar_operand_value(op));
 
-    if (is_value(e.lhs_))
-      return std::nullopt;
+  return std::uint32_t(initial_frame_.size() - 1);
+}
 
-    return std::get<SExprRef>(e.lhs_);
+template <typename Scalar_>
+void BasicExprEvaluator<Scalar_>::prepare_eval() // O(n)
+{
+  // Each unique subexpression becomes single operation - postorder DFS over DAG visiting each node
+  // once, so operands always precede their users and expression shared by many users isn't expanded.
+  sparse_map results(dag().node_count()); // node id -> operation index
+  sparse_map binding_values(dag().unbound_values_.size()); // UnboundValue index -> frame index
+
+  auto is_pending = [this, &results](Operand op) {
+    return is_sexpr(op) && !results.has(dag().node_id(std::get<SExprRef>(op)));
   };
 
-  auto right_child_f =
-    [&d = dag](SExprRef ref) -> std::optional<SExprRef> {
-    SExpr e = d.fetch(ref);
+  // Path from root - DAG is acyclic, so node is never pushed while it's already on stack
+  std::vector<SExprRef> stack{expr_.subexpr_};
 
-    if (is_value(e.rhs_))
-      return std::nullopt;
+  while (!stack.empty())
+  {
+    const SExprRef ref = stack.back();
+    const SExpr e = dag().fetch(ref);
 
-    return std::get<SExprRef>(e.rhs_);
-  };
+    if (is_pending(e.lhs_))
+    {
+      stack.push_back(std::get<SExprRef>(e.lhs_));
+      continue;
+    }
 
-  return std::make_pair(left_child_f, right_child_f);
-}
+    if (is_pending(e.rhs_))
+    {
+      stack.push_back(std::get<SExprRef>(e.rhs_));
+      continue;
+    }
 
-inline scalar_type cfold(OperatorKind op, scalar_type l, scalar_type r) noexcept
-{
-  switch(op)
-  {
-  case OperatorKind::add:
-    return l + r; 
-  case OperatorKind::sub:
-    return l - r;
-  case OperatorKind::mul:
-    return l * r;
-  case OperatorKind::div:
-    return l / r;
-  case OperatorKind::mod:
-    return l % r;
+    const std::uint32_t lhs = prepare_eval_operand(e.lhs_, results, binding_values);
+    const std::uint32_t rhs = prepare_eval_operand(e.rhs_, results, binding_values);
+
+    // Slot is looked up once here, evaluation indexes memo directly
+    const auto memo_slot = mapping_.slot(ref);
+
+    results.insert(dag().node_id(ref), operations_.size());
+    operations_.push_back(Operation{ref, lhs, rhs,
+                                    memo_slot.has_value()? std::uint32_t(*memo_slot) : Operation::NO_SLOT});
+
+    stack.pop_back();
   }
 
-  assert(false && "Unreachable");
-}
+  assert(operations_.size() + initial_frame_.size() < RESULT_TAG && "Too many operations");
 
-} // namespace anonymous
+  // Results follow values in frame
+  const auto nvalues = std::uint32_t(initial_frame_.size());
 
-const ExprDAG& ExprEvaluator::dag() const
+  for (Operation& op : operations_)
+  {
+    for (std::uint32_t* arg : {&op.lhs, &op.rhs})
+    {
+      if (*arg & RESULT_TAG)
+        *arg = nvalues + (*arg & ~RESULT_TAG);
+    }
+  }
+}
+
+template <typename Scalar_>
+Scalar_* BasicExprEvaluator<Scalar_>::prepare_scratch(EvalState& es) const
 {
-  return expr_.dag_;
+  assert((!bytecode_.is_memoized() || &es.mapping() == &mapping_) && "EvalState of different mapping");
+  return es.scratch(scratch_size());
 }
 
-scalar_type ExprEvaluator::scalar_operand_value(Operand op) noexcept
+template <typename Scalar_>
+Scalar_ BasicExprEvaluator<Scalar_>::evaluate(EvalState& es, const Scalar_* binding_values) const
 {
-  assert(is_value(op));
+  const auto& binding_ids = bytecode_.binding_ids();
+  Scalar_* slot_values = prepare_scratch(es);
 
-  if (is_unbound_value(op))
-    // Dummy value to hold a place on stack
-    return stack_t::GAP_VALUE;
+  for (std::size_t i=0; i<binding_ids.size(); ++i)
+    slot_values[i] = binding_values[binding_ids[i]];
 
-  const auto val = std::get<Value>(op);
-  return std::get<scalar_type>(val);
-}
+  const Scalar_ result = bytecode_.execute(slot_values, slot_values + binding_ids.size(), es);
+  commit_stats(es);
 
-void ExprEvaluator::prepare_eval_operand(Operand op)
-{
-   if (is_value(op))
-   {
-     initial_stack_.push(scalar_operand_value(op));
-
-     if (is_unbound_value(op))
-     {
-       auto &unbound = std::get<UnboundValue>(std::get<Value>(op));
-       // Memoize we need to update stack value
-       binding_gaps_.emplace_back(initial_stack_.size() - 1, dag().get_binding(unbound));
-     }
-   }
-   // Not a value - child operations will handle everything
+  return result;
 }
 
-void ExprEvaluator::calculate_subops_operands() // O(n) - n is number of operations
+template <typename Scalar_>
+void BasicExprEvaluator<Scalar_>::evaluate_batch(EvalState& es, const Scalar_* const* binding_columns,
+                                                 std::size_t nlanes, Scalar_* results) const
 {
-  assert(!operations_.empty());
-  auto& first_op = operations_.front();
-
-  // First operation should proceed all following operations
-  assert(first_op.nsubops == operations_.size() - 1);
-
-  // NB: This does DFS on preorder binary tree node list - we're able to recover tree structure since:
-  // - iff there is left subtree following node is its root node
-  // - we memoize how many nodes subtree has in its root
-  //
-  // To explain this tree layout:
-  //
-  //                                            root node child count
-  //                                            right subtree root child count
-  //                                                |
-  //                left subtree root child count   |
-  //                           |                    |
-  //                           |                    |
-  //                           V                    V
-  // [root][left subtree nodes][right subtree nodes]
-  //
-  // We also use such traversal during lazy evaluation.
-  calculate_operands_range(0, operations_.size());
+  Scalar_* scratch = es.scratch(bytecode_.batch_scratch_size());
+  bytecode_.execute_batch(binding_columns, nlanes, results, scratch);
+
+  if constexpr (eval_stats_enabled)
+  {
+    // Every lane runs all instructions except memo loads and register stores
+    const auto& code = bytecode_.code();
+    const auto nops = std::count_if(code.begin(), code.end(), [](const Instruction& instr) {
+      return instr.code_ != OpCode::memo_load && instr.code_ != OpCode::reg_store;
+    });
+
+    EvalCounters counters;
+    counters.evaluations_ = nlanes;
+    counters.operations_ = std::uint64_t(nops) * nlanes;
+    counters.peak_stack_depth_ = bytecode_.max_depth();
+    es.count(counters);
+
+    commit_stats(es);
+  }
 }
 
-size_t ExprEvaluator::calculate_operands_range(size_t start, size_t end)
+template <typename Scalar_>
+Scalar_ BasicExprEvaluator<Scalar_>::evaluate_reference(EvalState& es, std::function<Scalar_ (uintptr_t)> binding_fn) const
 {
-  assert(start < end && "Visiting empty subtree");
-  assert(end <= operations_.size());
+  // Memo slots of operations index memo of evaluator mapping
+  const bool memoized = &es.mapping() == &mapping_;
+  assert((memoized || es.mapping().empty()) && "EvalState of different mapping");
 
-  assert(operations_[start].noperands == Operation::INVALID_POP && "Already calculated");
+  const std::size_t nvalues = initial_frame_.size();
+  const std::size_t nops = operations_.size();
 
-  auto e = dag().fetch(operations_[start].ref);
-  unsigned operand_count = 0;
+  // Scratch: [constant and binding operands][results of operations][state of operations]
+  Scalar_* frame = es.scratch(nvalues + 2 * nops);
+  Scalar_* state = frame + nvalues + nops;
 
-  // next operation is one to perform to evaluate left subtree if there is any,
-  size_t lroot_idx = start + 1;
-  // otherwise right subtree root index (if any) 
-  size_t rroot_idx = start + 1;
-  // otherwise start+1 is equal to end
+  std::copy(initial_frame_.begin(), initial_frame_.end(), frame);
 
-  if (is_value(e.lhs_))
+  for (auto [idx, bind] : binding_gaps_)
   {
-     operand_count += 1;
+    assert(frame[idx] == EvalStack<Scalar_>::GAP_VALUE);
+    frame[idx] = binding_fn(bind);
   }
-  else
-  {
-    assert(lroot_idx < end);
 
-    auto l_subop = operations_[lroot_idx];
+  EvalCounters counters; // unused unless eval_stats_enabled
+  counters.evaluations_ = 1;
+  counters.binding_calls_ = binding_gaps_.size();
 
-    // Coerce right subtree root index
-    rroot_idx = lroot_idx + 1 + l_subop.nsubops;
+  // Lazy evaluation - only operations reachable from root through subexpressions which aren't memoized
+  // yet are evaluated. Users precede operands in reverse order, so single backward pass marks them all.
+  enum : std::uint8_t { SKIPPED, NEEDED, LOADED };
 
-    operand_count += calculate_operands_range(lroot_idx, rroot_idx);
-  }
+  std::fill_n(state, nops, Scalar_(SKIPPED));
+  state[nops - 1] = NEEDED;
 
-  if (is_value(e.rhs_))
+  for (std::size_t i = nops; i-- > 0;)
   {
-    assert(rroot_idx == end && "Right subtree should be empty");
-    operand_count += 1;
+    if (state[i] == SKIPPED)
+      continue;
+
+    const Operation& op = operations_[i];
+
+    if (memoized && op.memo_slot != Operation::NO_SLOT)
+    {
+      const bool hit = es.has_value(op.memo_slot);
+
+      if constexpr (eval_stats_enabled)
+        es.count_memo(op.memo_slot, hit);
+
+      if (hit)
+      {
+        frame[nvalues + i] = es.value(op.memo_slot);
+        state[i] = LOADED;
+        continue;
+      }
+    }
+
+    for (std::uint32_t arg : {op.lhs, op.rhs})
+    {
+      if (arg >= nvalues)
+        state[arg - nvalues] = NEEDED;
+    }
   }
-  else
+
+  for (std::size_t i = 0; i < nops; ++i)
   {
-    assert(rroot_idx < end && "Right subtree shouldn't be empty");
+    if (state[i] != NEEDED)
+      continue;
 
-    auto r_subop = operations_[rroot_idx];
+    const Operation& op = operations_[i];
+    const Scalar_ result = cfold(dag().fetch(op.ref).op_, frame[op.lhs], frame[op.rhs]);
 
-    assert(rroot_idx + 1 + r_subop.nsubops == end);
+    frame[nvalues + i] = result;
 
-    operand_count += calculate_operands_range(rroot_idx, end);
+    // Memoize if reused
+    if (memoized && op.memo_slot != Operation::NO_SLOT)
+      es.store(op.memo_slot, result);
+
+    ++counters.operations_;
   }
 
-  operations_[start].noperands = operand_count;
+  if constexpr (eval_stats_enabled)
+    es.count(counters);
+
+  commit_stats(es);
 
-  return operand_count;
+  return frame[nvalues + nops - 1];
 }
 
-void ExprEvaluator::prepare_eval() // O(n)
+template <typename Scalar_>
+BasicExprEvaluator<Scalar_>::BasicExprEvaluator(const Expr &e, std::pmr::memory_resource* mr)
+  : BasicExprEvaluator(e, eager_mapping, mr)
 {
-  // Create list of operations to perform
-  // Normaly we'd like to evaluate them postorder (of mirrored tree ie. right child first),
-  // however for lazy evaluation those need to be checked preorder.
-
-  auto visit = [this](SExprRef ref, std::size_t child_count) -> void {
-     const SExpr expr = dag().fetch(ref);
-
-     prepare_eval_operand(expr.lhs_);
-     prepare_eval_operand(expr.rhs_);
-
-     assert(child_count < std::numeric_limits<unsigned>::max());
-
-     operations_.push_back(Operation{ref, unsigned(child_count), Operation::INVALID_POP});
-  };
-
-  auto [lchld, rchld] = make_sexpr_child_getters(dag());
-  auto traversal = make_preorder_dfs_traversal<SExprRef>(visit, lchld, rchld);
-
-  traversal(expr_.subexpr_);
-
-  calculate_subops_operands();
 }
 
-// TODO: iterative version
-void ExprEvaluator::evaluate_subexpr(size_t op_index, stack_t& eval_stack, EvalState& es) const
+template <typename Scalar_>
+BasicExprEvaluator<Scalar_>::BasicExprEvaluator(const Expr &e, const ReusedExprMapping& mapping,
+                                                std::pmr::memory_resource* mr)
+  : BasicExprEvaluator(e, mapping, nullptr, mr)
 {
-  assert(op_index < operations_.size());
-
-  const Operation &op = operations_[op_index];
-  SExprRef ref = op.ref;
-
-  auto* slot = es.load(ref);
-  const bool is_reused_subexpr = (slot != nullptr);
-
-  // If already evaluated
-  if (is_reused_subexpr && *slot != std::nullopt)
-  {
-    eval_stack.drop(op.noperands);
-    eval_stack.push(slot->value());
-    return;
-  }
-
-  // Evaluate expr
-  SExpr root_expr = dag().fetch(ref);
-  std::size_t lhs_op = op_index + 1;
-  std::size_t rhs_op = !is_value(root_expr.lhs_)? lhs_op + 1 + operations_[lhs_op].nsubops : lhs_op;
-
-  // NB: we evaluate right subexpr first, because of order of operands on stack
-  // This is still DFS but of mirrored tree (or right child first)
-  //
-  // Right needs evaluation?
-  if (!is_value(root_expr.rhs_))
-    evaluate_subexpr(rhs_op, eval_stack, es);
-
-  // Result or value of right subtree on the top
-  scalar_type rval = eval_stack.pop_top();
-  
-  // Left needs evaluation?
-  if (!is_value(root_expr.lhs_))
-    evaluate_subexpr(lhs_op, eval_stack, es);
-  
-  scalar_type lval = eval_stack.pop_top();
-
-  scalar_type result = cfold(root_expr.op_, lval, rval);
-  eval_stack.push(result);
-
-  // Memoize if reused
-  if (is_reused_subexpr)
-    *slot = result;
 }
 
-scalar_type ExprEvaluator::evaluate(EvalState& es, std::function<scalar_type (uintptr_t)> binding_fn) const
+template <typename Scalar_>
+BasicExprEvaluator<Scalar_>::BasicExprEvaluator(const Expr &e, const ReusedExprMapping& mapping,
+                                                const RangeAnalysis* ranges, std::pmr::memory_resource* mr)
+  : operations_(mr), initial_frame_(mr), binding_gaps_(mr),
+    expr_(e), mapping_(mapping), bytecode_(mr)
 {
-  constexpr std::size_t root_idx = 0;
-
-  stack_t eval_stack = initial_stack_;
-  eval_stack.fill_gaps(binding_gaps_, std::move(binding_fn));
+  assert((!ranges || std::is_same_v<Scalar_, scalar_type>) && "Ranges of different scalar type");
 
-  evaluate_subexpr(root_idx, eval_stack, es);
+  prepare_eval(); // O(n)
+  bytecode_ = Bytecode::compile(expr_, mapping_, ranges, mr); // O(n)
 
-  return eval_stack.top();
+  assert(bytecode_.fits<Scalar_>() && "Constant division operand not representable in scalar type");
 }
 
-ExprEvaluator::ExprEvaluator(const Expr &e) : expr_(e)
-{
-  prepare_eval(); // O(n)
-}
+template struct glfdc::BasicExprEvaluator<std::int16_t>;
+template struct glfdc::BasicExprEvaluator<std::int32_t>;
+template struct glfdc::BasicExprEvaluator<std::int64_t>;
@@ -1,31 +1,43 @@
 #pragma once
 
 #include "bitvector.hh"
+#include "bytecode.hh"
+#include "eval_stats.hh"
+#include "result_cache.hh"
 #include "sexpr.hh"
 #include "stack.hh"
 #include "sparse_map.hh"
 
 #include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <memory_resource>
 #include <optional>
+#include <type_traits>
 
 #include <iostream>
 namespace glfdc {
 
-class Expr;
-class ExprDAG;
+struct Expr;
+struct ExprDAG;
 
-struct EvalState;
+class RangeAnalysis;
 
-struct Operation 
+// Unique subexpression of expression evaluated by ExprEvaluator::evaluate_reference()
+struct Operation
 {
   const SExprRef ref;
 
-  // TODO: bitfields/ushort? 12b/16b should be plenty and we could pack it more
-  unsigned nsubops; // number of following operations to skip if lazy evaluated
-  unsigned noperands; // total number of operands on stack to calculate subexpression value
+  // Frame index of each operand - constant and binding operands of expression come first,
+  // followed by results of operations (see BasicExprEvaluator::evaluate_reference())
+  std::uint32_t lhs;
+  std::uint32_t rhs;
 
-  static constexpr unsigned INVALID_POP = unsigned(-1);
+  // Memo slot of evaluator mapping resolved once by prepare_eval() or NO_SLOT if not reused
+  std::uint32_t memo_slot;
+
+  static constexpr std::uint32_t NO_SLOT = std::uint32_t(-1);
 };
 
 using opt_index_t = std::optional<std::size_t>;
@@ -88,77 +100,354 @@ struct ReusedExprMapping
   }
 };
 
-struct EvalState
+// Memo of reused subexpressions and scratch buffers of evaluation in Scalar_, see EvalState
+//
+// Memo values are stored densely, each slot is stamped with generation it was stored in. Slot holds
+// value only if its stamp is current generation, so clear() is single increment.
+template <typename Scalar_>
+struct BasicEvalState
 {
-  using LazyScalar = std::optional<scalar_type>;
-  using LazyScalarSlot = LazyScalar*;
+  using scalar_t = Scalar_;
+  using generation_t = std::uint32_t;
+
+  // Memo is allocated from mr once - states of the same mapping may be packed into single arena,
+  // see memo_size(). Scratch grows during evaluation and is allocated from default resource.
+  explicit BasicEvalState(const ReusedExprMapping& mapping,
+                          std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+    : values_(mapping.size(), Scalar_(0), mr), stamps_(mapping.size(), generation_t(0), mr), mapping_(mapping)
+  {
+  }
+
+  BasicEvalState(const BasicEvalState&) = default;
+
+  // Upper bound of bytes allocated from memory resource by constructor
+  static std::size_t memo_size(const ReusedExprMapping& mapping) noexcept
+  {
+    return mapping.size() * (sizeof(Scalar_) + sizeof(generation_t)) + 2 * alignof(std::max_align_t);
+  }
 
-  explicit EvalState(const ReusedExprMapping& mapping): memo_(mapping.size()), mapping_(mapping)
+  // Memo slot of subexpression, nullopt if it isn't reused in mapping
+  opt_index_t slot(SExprRef sexpr) const noexcept
   {
+    return mapping_.slot(sexpr); // O(1)
   }
 
-  EvalState(const EvalState&) = default;
+  bool has_value(std::size_t slot) const noexcept
+  {
+    assert(slot < stamps_.size());
+    return stamps_[slot] == generation_;
+  }
 
-  LazyScalarSlot load(SExprRef sexpr)
+  Scalar_ value(std::size_t slot) const noexcept
   {
-    auto opt_map = mapping_.slot(sexpr); // O(1)
+    assert(has_value(slot));
+    return values_[slot];
+  }
 
-    if (!opt_map.has_value())
-      return nullptr;
+  void store(std::size_t slot, Scalar_ val) noexcept
+  {
+    assert(!has_value(slot) && "Already evaluated");
 
-    return memo_.data() + opt_map.value();
+    values_[slot] = val;
+    stamps_[slot] = generation_;
   }
 
-  void store(LazyScalar& slot, scalar_type val)
+  // Forgets all memoized values - O(1), stamps are reset only once generation wraps around
+  void clear() noexcept
   {
-    assert(!slot.has_value() && "Already evaluated");
-    assert(uintptr_t(&slot) >= uintptr_t(memo_.data()) && "Invalid slot pointer");
-    assert(uintptr_t(&slot) < uintptr_t(memo_.data() + memo_.size()) && "Invalid slot pointer");
+    if (++generation_ == 0)
+    {
+      std::fill(stamps_.begin(), stamps_.end(), generation_t(0));
+      generation_ = 1;
+    }
+  }
+
+  // Reusable buffer for binding values and evaluation stack - grows only
+  Scalar_* scratch(std::size_t n)
+  {
+    if (scratch_.size() < n)
+      scratch_.resize(n);
 
-    slot = val;
+    return scratch_.data();
   }
 
-  void clear()
+  const ReusedExprMapping& mapping() const noexcept
   {
-     std::fill(memo_.begin(), memo_.end(), std::nullopt);
+    return mapping_;
+  }
+
+  // Counting of evaluation in progress - no-ops unless eval_stats_enabled
+  void count_memo(std::size_t slot, bool hit) noexcept
+  {
+#if GLFDC_EVAL_STATS
+    assert(slot < slot_stats_.size());
+    ++(hit? slot_stats_[slot].hits_ : slot_stats_[slot].misses_);
+    ++(hit? pending_.memo_hits_ : pending_.memo_misses_);
+#else
+    (void)slot; (void)hit;
+#endif
+  }
+
+  void count(const EvalCounters& c) noexcept
+  {
+#if GLFDC_EVAL_STATS
+    pending_ += c;
+#else
+    (void)c;
+#endif
+  }
+
+  // Ends evaluation - its counters are added to stats() and eval_stats_total() and returned
+  EvalCounters commit_stats() noexcept
+  {
+#if GLFDC_EVAL_STATS
+    const EvalCounters ret = pending_;
+
+    stats_ += pending_;
+    detail::eval_stats_total_counters().add(pending_);
+    pending_ = EvalCounters{};
+
+    return ret;
+#else
+    return EvalCounters{};
+#endif
+  }
+
+  // Counters of all evaluations done with this state
+  EvalCounters stats() const noexcept
+  {
+#if GLFDC_EVAL_STATS
+    return stats_;
+#else
+    return EvalCounters{};
+#endif
+  }
+
+  // Memo hits and misses of each slot of mapping(), empty unless eval_stats_enabled
+  std::vector<MemoSlotCounters> slot_stats() const
+  {
+#if GLFDC_EVAL_STATS
+    return slot_stats_;
+#else
+    return {};
+#endif
+  }
+
+  void reset_stats() noexcept
+  {
+#if GLFDC_EVAL_STATS
+    stats_ = pending_ = EvalCounters{};
+    std::fill(slot_stats_.begin(), slot_stats_.end(), MemoSlotCounters{});
+#endif
   }
 
 private:
-  std::vector<LazyScalar> memo_;
+  std::pmr::vector<Scalar_> values_;
+  std::pmr::vector<generation_t> stamps_; // never equal to generation_ initially
+  generation_t generation_ = 1;
+
+  std::vector<Scalar_> scratch_;
   const ReusedExprMapping &mapping_;
+
+#if GLFDC_EVAL_STATS
+  EvalCounters pending_;
+  EvalCounters stats_;
+  std::vector<MemoSlotCounters> slot_stats_ = std::vector<MemoSlotCounters>(stamps_.size());
+#endif
 };
 
-struct ExprEvaluator
+// Evaluator of expression in Scalar_ - bindings, intermediate values and result are Scalar_, constants
+// of DAG are converted to it. Instantiated in eval.cc for std::int16_t, std::int32_t (ExprEvaluator)
+// and std::int64_t.
+//
+// NB: Constant operands of division have to be representable in Scalar_, other constants wrap around
+// as Scalar_ arithmetic does (see Bytecode::fits()).
+template <typename Scalar_>
+struct BasicExprEvaluator
 {
-  // stores where to update on stack runtime value
-  // TODO: should we also handle stack updates lazily?
-  using stack_t = EvalStack<scalar_type>;
-  
-  explicit ExprEvaluator(const Expr& e);
+  using scalar_t = Scalar_;
+  using EvalState = BasicEvalState<Scalar_>;
+  using ResultCache = BasicResultCache<Scalar_>;
+
+  // Evaluator without memoization of reused subexpressions
+  explicit BasicExprEvaluator(const Expr& e, std::pmr::memory_resource* mr = std::pmr::get_default_resource());
+  // NB: EvalState passed to evaluate() must use the same mapping
+  // All storage of evaluator is allocated from mr
+  BasicExprEvaluator(const Expr& e, const ReusedExprMapping& mapping,
+                     std::pmr::memory_resource* mr = std::pmr::get_default_resource());
+  // Bytecode specialized for ranges of DAG (see Bytecode::compile()), bindings have to stay
+  // within their ranges. Ranges are computed in scalar_type arithmetic, which other scalars wrap
+  // differently - only evaluator in scalar_type accepts them.
+  template <typename S_ = Scalar_, std::enable_if_t<std::is_same_v<S_, scalar_type>, int> = 0>
+  BasicExprEvaluator(const Expr& e, const ReusedExprMapping& mapping, const RangeAnalysis& ranges,
+                     std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+    : BasicExprEvaluator(e, mapping, &ranges, mr)
+  {
+  }
+
+  // Runs compiled bytecode, binding_fn is called once per distinct binding.
+  // No allocation once EvalState scratch has grown to scratch_size().
+  template <typename BindFn_, enable_if_binding_fn_t<BindFn_, Scalar_> = 0>
+  Scalar_ evaluate(EvalState& es, BindFn_&& binding_fn) const
+  {
+    Scalar_* binding_values = resolve_bindings(es, binding_fn);
+
+    const Scalar_ result = execute(binding_values, es);
+    commit_stats(es);
+
+    return result;
+  }
 
-  scalar_type evaluate(EvalState& e, std::function<scalar_type (uintptr_t)> binding_fn) const;
+  // As evaluate(), but result is looked up in cache by values of all bindings first and operations
+  // aren't evaluated at all on hit. Result is stored in cache on miss.
+  // NB: Cache has to be created by create_result_cache() of the same evaluator.
+  template <typename BindFn_, enable_if_binding_fn_t<BindFn_, Scalar_> = 0>
+  Scalar_ evaluate(EvalState& es, ResultCache& cache, BindFn_&& binding_fn) const
+  {
+    assert(cache.key_size() == bytecode_.bindings().size() && cache.result_size() == 1
+           && "ResultCache of different evaluator");
+
+    Scalar_* binding_values = resolve_bindings(es, binding_fn);
+    const std::uint32_t h = ResultCache::hash(binding_values, cache.key_size());
+
+    if (const Scalar_* cached = cache.find(binding_values, h))
+    {
+      commit_stats(es);
+      return *cached;
+    }
+
+    const Scalar_ result = execute(binding_values, es);
+    cache.insert(binding_values, h, &result);
+    commit_stats(es);
+
+    return result;
+  }
+
+  // Cache of results of evaluate() keyed by values of bindings, holding as many results as fit max_bytes
+  ResultCache create_result_cache(std::size_t max_bytes,
+                                  std::pmr::memory_resource* mr = std::pmr::get_default_resource()) const
+  {
+    return ResultCache(bytecode_.bindings().size(), 1, max_bytes, mr);
+  }
+
+  // binding_values are indexed by UnboundValue::index_
+  Scalar_ evaluate(EvalState& es, const Scalar_* binding_values) const;
+
+  // Size of EvalState scratch needed by evaluate()
+  std::size_t scratch_size() const noexcept
+  {
+    return bytecode_.bindings().size() + bytecode_.frame_size();
+  }
+  // Evaluates nlanes binding sets at once, binding_columns are indexed by UnboundValue::index_
+  // and each column holds value of that binding for every lane.
+  void evaluate_batch(EvalState& e, const Scalar_* const* binding_columns, std::size_t nlanes,
+                      Scalar_* results) const;
+  // Reference evaluation - walks operations() in order without bytecode, so evaluate() can be checked
+  // against it. binding_fn is called once per distinct binding, uses EvalState scratch only.
+  // Memoizes only into state of evaluator mapping, state of empty mapping evaluates everything.
+  Scalar_ evaluate_reference(EvalState& e, std::function<Scalar_ (uintptr_t)> binding_fn) const;
 
   const ExprDAG& dag() const;
   const Expr& expr() const;
 
+  // Each unique subexpression of expression once, operands precede their users - root is last
+  const std::pmr::vector<Operation>& operations() const noexcept
+  {
+    return operations_;
+  }
+
+  const Bytecode& bytecode() const noexcept
+  {
+    return bytecode_;
+  }
+
+  const ReusedExprMapping& mapping() const noexcept
+  {
+    return mapping_;
+  }
+
+  // Counters of all evaluations by this evaluator, from any thread (see EvalState::stats() for memo
+  // counters of each slot). All zero unless eval_stats_enabled.
+  EvalCounters stats() const noexcept
+  {
+#if GLFDC_EVAL_STATS
+    return stats_.snapshot();
+#else
+    return EvalCounters{};
+#endif
+  }
+
+  void reset_stats() noexcept
+  {
+#if GLFDC_EVAL_STATS
+    stats_.reset();
+#endif
+  }
+
 private:
-  static scalar_type scalar_operand_value(Operand op) noexcept;
+  void commit_stats(EvalState& es) const noexcept
+  {
+#if GLFDC_EVAL_STATS
+    stats_.add(es.commit_stats());
+#else
+    (void)es;
+#endif
+  }
+
+  BasicExprEvaluator(const Expr& e, const ReusedExprMapping& mapping, const RangeAnalysis* ranges,
+                     std::pmr::memory_resource* mr);
+
+  Scalar_* prepare_scratch(EvalState& es) const;
 
-  void calculate_subops_operands(); // O(n) - n is number of operations
-  size_t calculate_operands_range(size_t start, size_t end);
+  // Values of bytecode binding slots followed by room for execute()
+  template <typename BindFn_>
+  Scalar_* resolve_bindings(EvalState& es, BindFn_& binding_fn) const
+  {
+    const auto& bindings = bytecode_.bindings();
+    Scalar_* binding_values = prepare_scratch(es);
+
+    // Resolve each distinct binding once
+    for (std::size_t i=0; i<bindings.size(); ++i)
+      binding_values[i] = binding_fn(bindings[i]);
+
+    EvalCounters binding_calls;
+    binding_calls.binding_calls_ = bindings.size();
+    es.count(binding_calls);
 
-  void prepare_eval();
-  void prepare_eval_operand(Operand op);
+    return binding_values;
+  }
 
-  void evaluate_subexpr(size_t op_index, stack_t& eval_stack, EvalState& es) const;
+  // Precondition: binding_values were returned by resolve_bindings()
+  Scalar_ execute(Scalar_* binding_values, EvalState& es) const noexcept
+  {
+    // Stack and registers follow binding values in scratch
+    return bytecode_.execute(binding_values, binding_values + bytecode_.bindings().size(), es);
+  }
 
+  static Scalar_ scalar_operand_value(Operand op) noexcept;
+
+  void prepare_eval(); // O(n) - n is number of unique subexpressions
+  std::uint32_t prepare_eval_operand(Operand op, const sparse_map& results, sparse_map& binding_values);
 
 private:
-  std::vector<Operation> operations_; // Inorder Depth First list of operations
-  stack_t initial_stack_;
-  std::vector<binding_gap_t> binding_gaps_;
+  std::pmr::vector<Operation> operations_; // Postorder list of unique subexpressions
+  std::pmr::vector<Scalar_> initial_frame_; // Constant operands and gaps for bindings
+  std::pmr::vector<binding_gap_t> binding_gaps_; // One per distinct binding
 
   const Expr& expr_;
+  const ReusedExprMapping& mapping_;
+
+  Bytecode bytecode_;
+
+#if GLFDC_EVAL_STATS
+  mutable AtomicEvalCounters stats_;
+#endif
 };
 
+using ExprEvaluator = BasicExprEvaluator<scalar_type>;
+
+extern template struct BasicExprEvaluator<std::int16_t>;
+extern template struct BasicExprEvaluator<std::int32_t>;
+extern template struct BasicExprEvaluator<std::int64_t>;
+
 } // namespace glfdc
@@ -0,0 +1,56 @@
+#include "eval_stats.hh"
+
+#include <initializer_list>
+
+using namespace glfdc;
+
+void AtomicEvalCounters::add(const EvalCounters& c) noexcept
+{
+  evaluations_.fetch_add(c.evaluations_, std::memory_order_relaxed);
+  operations_.fetch_add(c.operations_, std::memory_order_relaxed);
+  memo_hits_.fetch_add(c.memo_hits_, std::memory_order_relaxed);
+  memo_misses_.fetch_add(c.memo_misses_, std::memory_order_relaxed);
+  binding_calls_.fetch_add(c.binding_calls_, std::memory_order_relaxed);
+
+  std::uint64_t peak = peak_stack_depth_.load(std::memory_order_relaxed);
+
+  while (peak < c.peak_stack_depth_ &&
+         !peak_stack_depth_.compare_exchange_weak(peak, c.peak_stack_depth_, std::memory_order_relaxed))
+    ;
+}
+
+EvalCounters AtomicEvalCounters::snapshot() const noexcept
+{
+  EvalCounters ret;
+
+  ret.evaluations_ = evaluations_.load(std::memory_order_relaxed);
+  ret.operations_ = operations_.load(std::memory_order_relaxed);
+  ret.memo_hits_ = memo_hits_.load(std::memory_order_relaxed);
+  ret.memo_misses_ = memo_misses_.load(std::memory_order_relaxed);
+  ret.binding_calls_ = binding_calls_.load(std::memory_order_relaxed);
+  ret.peak_stack_depth_ = peak_stack_depth_.load(std::memory_order_relaxed);
+
+  return ret;
+}
+
+void AtomicEvalCounters::reset() noexcept
+{
+  for (auto* counter : {&evaluations_, &operations_, &memo_hits_, &memo_misses_, &binding_calls_, &peak_stack_depth_})
+    counter->store(0, std::memory_order_relaxed);
+}
+
+AtomicEvalCounters& detail::eval_stats_total_counters() noexcept
+{
+  static AtomicEvalCounters total;
+  return total;
+}
+
+EvalCounters glfdc::eval_stats_total() noexcept
+{
+  return detail::eval_stats_total_counters().snapshot();
+}
+
+void glfdc::reset_eval_stats_total() noexcept
+{
+  detail::eval_stats_total_counters().reset();
+}
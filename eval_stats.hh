@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Evaluation counters are compiled in only if GLFDC_EVAL_STATS is nonzero (meson option eval_stats).
+// NB: It changes layout of EvalState and ExprEvaluator - users of library have to be compiled with
+// the same value.
+#ifndef GLFDC_EVAL_STATS
+#  define GLFDC_EVAL_STATS 0
+#endif
+
+namespace glfdc {
+
+constexpr bool eval_stats_enabled = (GLFDC_EVAL_STATS != 0);
+
+// Snapshot of evaluation counters, all zero if eval_stats_enabled is false
+struct EvalCounters
+{
+  std::uint64_t evaluations_ = 0;      // evaluate() calls, lanes of evaluate_batch()
+  std::uint64_t operations_ = 0;       // subexpression operations executed
+  std::uint64_t memo_hits_ = 0;        // reused subexpressions found memoized
+  std::uint64_t memo_misses_ = 0;      // reused subexpressions evaluated and memoized
+  std::uint64_t binding_calls_ = 0;    // invocations of binding callback
+  std::uint64_t peak_stack_depth_ = 0; // maximum, not sum
+
+  EvalCounters& operator+=(const EvalCounters& other) noexcept
+  {
+    evaluations_ += other.evaluations_;
+    operations_ += other.operations_;
+    memo_hits_ += other.memo_hits_;
+    memo_misses_ += other.memo_misses_;
+    binding_calls_ += other.binding_calls_;
+
+    if (other.peak_stack_depth_ > peak_stack_depth_)
+      peak_stack_depth_ = other.peak_stack_depth_;
+
+    return *this;
+  }
+};
+
+// Memo counters of single slot of ReusedExprMapping
+struct MemoSlotCounters
+{
+  std::uint64_t hits_ = 0;
+  std::uint64_t misses_ = 0;
+};
+
+// EvalCounters updated from many threads at once - relaxed atomics, snapshot isn't taken atomically
+// as whole
+class AtomicEvalCounters
+{
+public:
+  AtomicEvalCounters() = default;
+
+  // Copy starts from snapshot of other
+  AtomicEvalCounters(const AtomicEvalCounters& other) noexcept
+  {
+    add(other.snapshot());
+  }
+
+  AtomicEvalCounters& operator=(const AtomicEvalCounters&) = delete;
+
+  void add(const EvalCounters& c) noexcept;
+
+  EvalCounters snapshot() const noexcept;
+
+  void reset() noexcept;
+
+private:
+  std::atomic<std::uint64_t> evaluations_{0};
+  std::atomic<std::uint64_t> operations_{0};
+  std::atomic<std::uint64_t> memo_hits_{0};
+  std::atomic<std::uint64_t> memo_misses_{0};
+  std::atomic<std::uint64_t> binding_calls_{0};
+  std::atomic<std::uint64_t> peak_stack_depth_{0};
+};
+
+// Counters aggregated over all evaluators and EvalStates of process
+EvalCounters eval_stats_total() noexcept;
+void reset_eval_stats_total() noexcept;
+
+namespace detail {
+
+AtomicEvalCounters& eval_stats_total_counters() noexcept;
+
+} // namespace detail
+
+} // namespace glfdc
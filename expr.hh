@@ -1,9 +1,11 @@
 #pragma once
 
+#include "binding_map.hh"
+#include "packed_sexpr.hh"
 #include "sexpr.hh"
 
 #include <cassert>
-#include <map>
+#include <memory_resource>
 #include <vector>
 
 namespace glfdc {
@@ -21,14 +23,40 @@ struct Expr
 
 struct ExprDAG
 {
-  std::map<uintptr_t, std::size_t> unbound_lookup_; // XXX: any mapping - rb-tree for now
-  std::vector<uintptr_t> unbound_values_;
+  binding_map unbound_lookup_;
+  std::pmr::vector<uintptr_t> unbound_values_;
 
-  std::vector<SExpr> unbound_exprs_;
-  std::vector<SExpr> internal_exprs_;
+  // Nodes are stored packed - see PackedSExpr
+  std::pmr::vector<PackedSExpr> unbound_exprs_;
+  std::pmr::vector<PackedSExpr> internal_exprs_;
 
 public:
+  ExprDAG() = default;
+
+  // All storage of DAG is allocated from mr
+  explicit ExprDAG(std::pmr::memory_resource* mr)
+    : unbound_lookup_(mr), unbound_values_(mr), unbound_exprs_(mr), internal_exprs_(mr)
+  {
+  }
+
+  ExprDAG(const ExprDAG&) = delete;
+  ExprDAG& operator=(const ExprDAG&) = delete;
+
+  // Removes all bindings and subexpressions but keeps capacity
+  void clear() noexcept
+  {
+    unbound_lookup_.clear();
+    unbound_values_.clear();
+    unbound_exprs_.clear();
+    internal_exprs_.clear();
+  }
+
   SExprRef add_subexpr(SExpr expr)
+  {
+    return add_subexpr(PackedSExpr::pack(expr));
+  }
+
+  SExprRef add_subexpr(PackedSExpr expr)
   {
     auto &nodes = expr.is_unbound()? unbound_exprs_ : internal_exprs_;
     size_t new_idx = nodes.size();
@@ -40,22 +68,48 @@ public:
 
   SExpr fetch(SExprRef e) const noexcept // O(1)
   {
-    return (e.index() == 0)?
-      fetch(std::get<LExprRef>(e)) : fetch(std::get<IExprRef>(e));
+    return fetch_packed(e).unpack();
   }
 
   SExpr fetch(LExprRef e) const noexcept
+  {
+    return fetch_packed(e).unpack();
+  }
+
+  SExpr fetch(IExprRef e) const noexcept
+  {
+    return fetch_packed(e).unpack();
+  }
+
+  PackedSExpr fetch_packed(SExprRef e) const noexcept // O(1)
+  {
+    return (e.index() == 0)?
+      fetch_packed(std::get<LExprRef>(e)) : fetch_packed(std::get<IExprRef>(e));
+  }
+
+  PackedSExpr fetch_packed(LExprRef e) const noexcept
   {
     assert(e.index_ < unbound_exprs_.size());
     return unbound_exprs_[e.index_];
   }
 
-  SExpr fetch(IExprRef e) const noexcept
+  PackedSExpr fetch_packed(IExprRef e) const noexcept
   {
     assert(e.index_ < internal_exprs_.size());
     return internal_exprs_[e.index_];
   }
 
+  std::size_t node_count() const noexcept
+  {
+    return unbound_exprs_.size() + internal_exprs_.size();
+  }
+
+  // Index of subexpression unique across both node vectors - in [0, node_count())
+  std::size_t node_id(SExprRef e) const noexcept
+  {
+    return is_lref(e)? ref_index(e) : ref_index(e) + unbound_exprs_.size();
+  }
+
   uintptr_t get_binding(UnboundValue ubv) const noexcept // O(1)
   {
     assert(ubv.index_ < unbound_values_.size());
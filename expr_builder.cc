@@ -1,7 +1,9 @@
 #include "expr_builder.hh"
 
 #include "cfold.hh"
+#include "simplify.hh"
 
+#include <algorithm>
 #include <cstring>
 #include <tuple>
 #include <type_traits>
@@ -20,46 +22,118 @@ std::pair<Operand, Operand> reorder_commutative(Operand l, Operand r)
 
 } // namespace anonymous
 
-ExpressionBuilder::ExpressionBuilder(): dag_(new ExprDAG) {}
+ExpressionBuilder::ExpressionBuilder(): ExpressionBuilder(std::pmr::get_default_resource()) {}
+
+ExpressionBuilder::ExpressionBuilder(std::pmr::memory_resource* mr)
+  : seen_exprs_(mr), reused_unbound_(mr), reused_internal_(mr), mark_stack_(mr),
+    dag_(new (mr->allocate(sizeof(ExprDAG), alignof(ExprDAG))) ExprDAG(mr), DAGDeleter{mr})
+{
+}
+
+void ExpressionBuilder::DAGDeleter::operator()(ExprDAG* dag) const noexcept
+{
+  dag->~ExprDAG();
+  mr_->deallocate(dag, sizeof(ExprDAG), alignof(ExprDAG));
+}
+
+void ExpressionBuilder::reset() noexcept // O(capacity)
+{
+  assert(dag_ != nullptr);
+
+  dag_->clear();
+  seen_exprs_.clear();
+
+  reused_unbound_.clear();
+  reused_internal_.clear();
+
+  rewrites_ = 0;
+}
 
 Value ExpressionBuilder::get_binding(uintptr_t unbound)
 {
   assert(dag_ != nullptr);
-  auto it = dag_->unbound_lookup_.find(unbound);
+  auto slot = dag_->unbound_lookup_.find(unbound);
 
-  if (it != dag_->unbound_lookup_.end())
+  if (slot.has_value())
   {
-    assert(it->second < dag_->unbound_values_.size());
-    return UnboundValue{it->second};
+    assert(slot.value() < dag_->unbound_values_.size());
+    return UnboundValue{slot.value()};
   }
 
   return create_new_binding(unbound);
 }
 
+void ExpressionBuilder::get_bindings(const uintptr_t* unbounds, std::size_t n, Value* out)
+{
+  assert(dag_ != nullptr);
+
+  // How many lookups ahead to start loading home slot
+  constexpr std::size_t prefetch_distance = 8;
+
+  for (std::size_t i = 0; i < std::min(n, prefetch_distance); ++i)
+    dag_->unbound_lookup_.prefetch(unbounds[i]);
+
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    if (i + prefetch_distance < n)
+      dag_->unbound_lookup_.prefetch(unbounds[i + prefetch_distance]);
+
+    out[i] = get_binding(unbounds[i]);
+  }
+}
+
 Value ExpressionBuilder::add_binding_equivalence(uintptr_t from, uintptr_t to)
 {
   assert(dag_ != nullptr);
-  assert(dag_->unbound_lookup_.find(from) != dag_->unbound_lookup_.end() && "exists");
-  assert(dag_->unbound_lookup_.find(to) == dag_->unbound_lookup_.end() && "doesn't exist");
+  assert(dag_->unbound_lookup_.has(from) && "exists");
+  assert(!dag_->unbound_lookup_.has(to) && "doesn't exist");
+
+  auto slot = dag_->unbound_lookup_.find(from).value();
+  dag_->unbound_lookup_.insert(to, slot);
 
-  auto it = dag_->unbound_lookup_.find(from);
-  dag_->unbound_lookup_.insert(std::make_pair(to, it->second));
-  
-  return UnboundValue{it->second};
+  return UnboundValue{slot};
 }
 
 Value ExpressionBuilder::create_new_binding(uintptr_t unbound)
 {
   assert(dag_ != nullptr);
-  assert(dag_->unbound_lookup_.find(unbound) == dag_->unbound_lookup_.end());
+  assert(!dag_->unbound_lookup_.has(unbound));
 
   const size_t slot = dag_->unbound_values_.size();
-  dag_->unbound_lookup_.insert(std::make_pair(unbound, slot));
+  dag_->unbound_lookup_.insert(unbound, slot);
   dag_->unbound_values_.push_back(unbound);
 
   return UnboundValue{slot};
 }
 
+std::optional<Expr> ExpressionBuilder::create_expr(Operand op)
+{
+  assert(dag_ != nullptr);
+
+  if (is_sexpr(op))
+    return Expr{*dag_, std::get<SExprRef>(op)};
+
+  if (!simplify_)
+    return std::nullopt;
+
+  // Node op+0 is added as is - simplification would reduce it back to op
+  const auto e = PackedSExpr::pack(SExpr{op, Value(scalar_type(0)), OperatorKind::add});
+  const std::size_t hash = sexpr_table::hash(e);
+
+  if (const auto seen = seen_exprs_.find(e, hash))
+    return Expr{*dag_, *seen};
+
+  auto &reuses = e.is_unbound()? reused_unbound_ : reused_internal_;
+  auto ref = dag_->add_subexpr(e);
+
+  assert(reuses.size() == ref_index(ref));
+  reuses.push_back(false);
+
+  seen_exprs_.insert(e, ref, hash);
+
+  return Expr{*dag_, ref};
+}
+
 #include <iostream>
 
 Operand ExpressionBuilder::create_sexpr_(OperatorKind op, Operand l, Operand r)
@@ -76,13 +150,29 @@ Operand ExpressionBuilder::create_sexpr_(OperatorKind op, Operand l, Operand r)
   if (opt_cfold.has_value())
     return opt_cfold.value();
 
-  SExpr e = {l, r, op};
-  auto it = seen_exprs_.find(e);
+  if (const auto simplified = simplify_? simplify(*dag_, op, l, r) : std::nullopt)
+  {
+    ++rewrites_;
+
+    if (!simplified->operand_.has_value())
+      return create_sexpr_(simplified->op_, simplified->lhs_, simplified->rhs_);
+
+    // Result is used once more - same as hash-consing hit
+    const Operand result = simplified->operand_.value();
+
+    if (is_sexpr(result))
+      mark_reuse(std::get<SExprRef>(result));
+
+    return result;
+  }
+
+  const auto e = PackedSExpr::pack(SExpr{l, r, op});
+  const std::size_t hash = sexpr_table::hash(e);
 
-  if (it != seen_exprs_.end())
+  if (const auto seen = seen_exprs_.find(e, hash))
   {
-    mark_reuse(it->second);
-    return it->second;
+    mark_reuse(*seen);
+    return *seen;
   }
 
   // Expr unseen - allocate new
@@ -98,25 +188,41 @@ Operand ExpressionBuilder::create_sexpr_(OperatorKind op, Operand l, Operand r)
 
   reuses.push_back(false);
 
-  seen_exprs_.insert(std::make_pair(e, ref));
+  seen_exprs_.insert(e, ref, hash);
 
   return ref;
 }
 
-void ExpressionBuilder::mark_reuse(SExprRef ref)
+void ExpressionBuilder::mark_reuse(SExprRef root)
 {
   assert(dag_ != nullptr);
+  assert(mark_stack_.empty());
 
-  auto &reuses = is_lref(ref)? reused_unbound_ : reused_internal_;
+  // Explicit stack - subexpression may be deep chain
+  mark_stack_.push_back(root);
 
-  assert(ref_index(ref) < reuses.size());
-  reuses[ref_index(ref)] = true;
+  while (!mark_stack_.empty())
+  {
+    const SExprRef ref = mark_stack_.back();
+    mark_stack_.pop_back();
+
+    auto &reuses = is_lref(ref)? reused_unbound_ : reused_internal_;
+
+    assert(ref_index(ref) < reuses.size());
 
-  auto e = dag_->fetch(ref);
+    // Whole subexpression is marked at once - descendants of reused one are marked already.
+    // Keeps marking linear in DAG size, shared subexpressions would be visited once per path otherwise.
+    if (reuses[ref_index(ref)])
+      continue;
 
-  if (!is_value(e.lhs_))
-    mark_reuse(std::get<SExprRef>(e.lhs_));
+    reuses[ref_index(ref)] = true;
 
-  if (!is_value(e.rhs_))
-    mark_reuse(std::get<SExprRef>(e.rhs_));
+    auto e = dag_->fetch(ref);
+
+    if (!is_value(e.lhs_))
+      mark_stack_.push_back(std::get<SExprRef>(e.lhs_));
+
+    if (!is_value(e.rhs_))
+      mark_stack_.push_back(std::get<SExprRef>(e.rhs_));
+  }
 }
@@ -1,31 +1,42 @@
+#pragma once
+
 #include "bitvector.hh"
 #include "expr.hh"
-#include "sexpr_cmp.hh"
+#include "sexpr_table.hh"
 
 #include <memory>
-#include <unordered_map>
+#include <memory_resource>
+#include <optional>
 
 namespace glfdc {
 
 struct ExpressionBuilder
 {
   ExpressionBuilder();
+  // DAG, hash-consing table and all other storage of builder is allocated from mr.
+  // NB: mr must outlive builder
+  explicit ExpressionBuilder(std::pmr::memory_resource* mr);
+
+  // Drops all bindings and subexpressions, but keeps capacity of all tables - building
+  // next DAG of similar size doesn't allocate.
+  // NB: Invalidates all Operands, Exprs and evaluators created from this builder
+  void reset() noexcept;
 
-  Value get_binding(uintptr_t unbound); // O(log2(n))
-  Value add_binding_equivalence(uintptr_t unbound, uintptr_t equivalent); // O(log2(n))
+  Value get_binding(uintptr_t unbound); // O(1)
+  Value add_binding_equivalence(uintptr_t unbound, uintptr_t equivalent); // O(1)
+
+  // Same as calling get_binding() for each of n unbounds, lookups are overlapped
+  void get_bindings(const uintptr_t* unbounds, std::size_t n, Value* out);
 
   Operand create_sexpr(OperatorKind op, Operand l, Operand r) { return create_sexpr_(op, l, r); }
   Operand create_sexpr(OperatorKind op, Operand l, Value v) { return create_sexpr_(op, l, Operand(v)); }
   Operand create_sexpr(OperatorKind op, Value v, Operand r){ return create_sexpr_(op, Operand(v), r); }
   Operand create_sexpr(OperatorKind op, Value v1, Value v2) { return create_sexpr_(op, Operand(v1), Operand(v2)); }
 
-  std::optional<Expr> create_expr(Operand op) const noexcept
-  {
-    if (is_value(op))
-      return std::nullopt;
-
-    return Expr{*dag_, std::get<SExprRef>(op)};
-  }
+  // Expression rooted at op, nullopt if op is scalar or binding. Only if builder simplifies, such root -
+  // e.g. x*0 or x+0 reduced by simplification - is kept as single node op+0 instead, so every operand
+  // created can be evaluated. Without simplification DAG is never changed.
+  std::optional<Expr> create_expr(Operand op);
 
   const ExprDAG& dag() const noexcept {
     return *dag_;
@@ -36,23 +47,72 @@ struct ExpressionBuilder
     return std::pair<const bitvector_t&, const bitvector_t>(reused_unbound_, reused_internal_);
   }
 
+  // Makes room for nexprs distinct subexpressions in hash-consing table
+  void reserve(std::size_t nexprs)
+  {
+    seen_exprs_.reserve(nexprs);
+  }
+
+  // Makes room for nbindings distinct binding addresses
+  void reserve_bindings(std::size_t nbindings)
+  {
+    dag_->unbound_lookup_.reserve(nbindings);
+    dag_->unbound_values_.reserve(nbindings);
+  }
+
+  // Algebraic simplification of created subexpressions (see simplify()) - enabled by default.
+  // Without it only scalar operands are folded and DAG mirrors exactly what was created.
+  // NB: With it create_sexpr() may return scalar or binding (e.g. for x*0 or x+0), see create_expr().
+  void set_simplify(bool enable) noexcept
+  {
+    simplify_ = enable;
+  }
+
+  bool simplifies() const noexcept
+  {
+    return simplify_;
+  }
+
+  // Number of rewrites done by algebraic simplification. It is not number of nodes saved - single
+  // create_sexpr() may take several rewrites, and e.g. (x+1)+2 rewritten to x+3 keeps x+1 in DAG.
+  std::size_t rewrite_count() const noexcept
+  {
+    return rewrites_;
+  }
+
+  // Load factor and probe length statistics of hash-consing table
+  sexpr_table::Stats lookup_stats() const noexcept
+  {
+    return seen_exprs_.stats();
+  }
+
 private:
   Value create_new_binding(uintptr_t);
   Operand create_sexpr_(OperatorKind op, Operand l, Operand r);
 
-  void mark_reuse(SExprRef ref);
+  void mark_reuse(SExprRef root);
 
 private:
-  using sexpr_lookup_t = std::unordered_map<SExpr, SExprRef, sexpr_hash, sexpr_eq>;
+  // Destroys DAG allocated from memory resource of builder
+  struct DAGDeleter
+  {
+    std::pmr::memory_resource* mr_;
 
-  // TODO: something faster here:
-  sexpr_lookup_t seen_exprs_;
+    void operator()(ExprDAG* dag) const noexcept;
+  };
+
+  sexpr_table seen_exprs_;
 
   // only needed for lazy_eval construction
   bitvector_t reused_unbound_;
   bitvector_t reused_internal_;
 
-  std::unique_ptr<ExprDAG> dag_;
+  std::pmr::vector<SExprRef> mark_stack_; // scratch of mark_reuse(), keeps capacity
+
+  std::unique_ptr<ExprDAG, DAGDeleter> dag_;
+
+  bool simplify_ = true;
+  std::size_t rewrites_ = 0;
 };
 
 } // namespace glfdc
@@ -0,0 +1,522 @@
+#include "image.hh"
+
+#include "expr.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+#include <utility>
+
+using namespace glfdc;
+using namespace glfdc::image;
+
+namespace {
+
+static_assert(std::is_trivially_copyable_v<PackedSExpr>, "Stored in image as is");
+static_assert(std::is_trivially_copyable_v<Instruction>, "Stored in image as is");
+static_assert(std::is_trivially_copyable_v<DivMagic>, "Stored in image as is");
+static_assert(sizeof(Header) % ALIGN == 0, "");
+
+struct ImageWriter
+{
+  std::vector<char> buffer_;
+
+  void align()
+  {
+    buffer_.resize((buffer_.size() + ALIGN - 1) / ALIGN * ALIGN, 0);
+  }
+
+  template <typename T_>
+  Section append(const T_* data, std::size_t count)
+  {
+    align();
+
+    const Section ret{buffer_.size(), count};
+    const char* bytes = reinterpret_cast<const char*>(data);
+
+    buffer_.insert(buffer_.end(), bytes, bytes + count * sizeof(T_));
+    return ret;
+  }
+
+  template <typename T_>
+  T_& at(std::uint64_t offset)
+  {
+    return *reinterpret_cast<T_*>(buffer_.data() + offset);
+  }
+};
+
+Header make_header()
+{
+  Header h;
+  std::memset(&h, 0, sizeof(h));
+
+  std::memcpy(h.magic_, MAGIC, sizeof(MAGIC));
+  h.version_ = VERSION;
+  h.byte_order_ = BYTE_ORDER_MARK;
+
+  h.scalar_size_ = sizeof(scalar_type);
+  h.size_size_ = sizeof(std::size_t);
+  h.uintptr_size_ = sizeof(uintptr_t);
+  h.packed_sexpr_size_ = sizeof(PackedSExpr);
+  h.instruction_size_ = sizeof(Instruction);
+  h.div_magic_size_ = sizeof(DivMagic);
+
+  return h;
+}
+
+std::uint64_t encode_root(SExprRef ref) noexcept
+{
+  return is_lref(ref)? std::uint64_t(std::get<LExprRef>(ref).index_)
+                     : std::uint64_t(std::get<IExprRef>(ref).index_) | ROOT_INTERNAL;
+}
+
+SExprRef decode_root(std::uint64_t root) noexcept
+{
+  if (root & ROOT_INTERNAL)
+    return IExprRef{std::size_t(root & ~ROOT_INTERNAL)};
+
+  return LExprRef{std::size_t(root)};
+}
+
+// Section of count T_ lies within file and is aligned
+template <typename T_>
+bool is_valid(const Section& s, std::size_t file_size) noexcept
+{
+  if (s.offset_ % alignof(T_) != 0 || s.offset_ > file_size)
+    return false;
+
+  return s.count_ <= (file_size - s.offset_) / sizeof(T_);
+}
+
+template <typename T_>
+const T_* section_data(const void* data, const Section& s) noexcept
+{
+  return reinterpret_cast<const T_*>(static_cast<const char*>(data) + s.offset_);
+}
+
+bool is_compatible(const Header& h, std::size_t file_size) noexcept
+{
+  if (std::memcmp(h.magic_, MAGIC, sizeof(MAGIC)) != 0 || h.version_ != VERSION || h.byte_order_ != BYTE_ORDER_MARK)
+    return false;
+
+  if (h.scalar_size_ != sizeof(scalar_type) || h.size_size_ != sizeof(std::size_t) ||
+      h.uintptr_size_ != sizeof(uintptr_t) || h.packed_sexpr_size_ != sizeof(PackedSExpr) ||
+      h.instruction_size_ != sizeof(Instruction) || h.div_magic_size_ != sizeof(DivMagic))
+    return false;
+
+  return h.file_size_ == file_size &&
+         is_valid<PackedSExpr>(h.unbound_exprs_, file_size) &&
+         is_valid<PackedSExpr>(h.internal_exprs_, file_size) &&
+         is_valid<uintptr_t>(h.unbound_values_, file_size) &&
+         is_valid<Mapping>(h.mappings_, file_size) &&
+         is_valid<Evaluator>(h.evaluators_, file_size);
+}
+
+// Mapping is stored over whole DAG of header - slot keys are node indices, unbound nodes first
+bool is_compatible(const Mapping& m, const Header& h, std::size_t file_size) noexcept
+{
+  return m.universe_ == h.unbound_exprs_.count_ + h.internal_exprs_.count_ &&
+         m.unbound_count_ == h.unbound_exprs_.count_ &&
+         m.entries_.count_ <= m.universe_ &&
+         is_valid<std::uint64_t>(Section{m.entries_.offset_, 2 * m.entries_.count_}, file_size);
+}
+
+// Every index of code lies within arrays and counts of its record and stack never under- or overflows
+// - O(n) single pass over code. Code after memo_load has to leave exactly one value on the stack
+// at jump target, so taken jumps see the same stack depth as code evaluated in full.
+bool is_valid_code(const void* data, const Evaluator& e, std::uint64_t nslots, std::uint64_t nunbound_values)
+{
+  using detail::scalar_bits;
+
+  const Instruction* code = section_data<Instruction>(data, e.code_);
+  const std::size_t ncode = std::size_t(e.code_.count_);
+
+  // Every register is written by its own reg_store, stack isn't deeper than number of instructions
+  if (ncode == 0 || e.max_depth_ > ncode || e.nregisters_ > ncode)
+    return false;
+
+  const std::size_t* binding_ids = section_data<std::size_t>(data, e.binding_ids_);
+
+  for (std::size_t i=0; i<e.binding_ids_.count_; ++i)
+  {
+    if (binding_ids[i] >= nunbound_values)
+      return false;
+  }
+
+  const DivMagic* divisors = section_data<DivMagic>(data, e.divisors_);
+
+  for (std::size_t i=0; i<e.divisors_.count_; ++i)
+  {
+    const scalar_type d = divisors[i].divisor_;
+
+    if ((d >= -1 && d <= 1) || divisors[i].shift_ >= scalar_bits)
+      return false;
+  }
+
+  auto is_valid_arg = [&e](ArgKind kind, InstrArg arg, std::size_t& sp) {
+    switch (kind)
+    {
+    case ArgKind::imm:
+      return true;
+    case ArgKind::binding:
+      return arg.slot_ < e.bindings_.count_;
+    case ArgKind::stack:
+      if (sp == 0)
+        return false;
+
+      --sp;
+      return true;
+    case ArgKind::reg:
+      return arg.slot_ < e.nregisters_;
+    }
+
+    return false;
+  };
+
+  constexpr std::size_t NO_TARGET = std::size_t(-1);
+
+  // Stack depth expected at each jump target
+  std::vector<std::size_t> target_depth(ncode + 1, NO_TARGET);
+  std::size_t sp = 0;
+
+  for (std::size_t pc = 0; pc <= ncode; ++pc)
+  {
+    if (target_depth[pc] != NO_TARGET && target_depth[pc] != sp)
+      return false;
+
+    if (pc == ncode)
+      break;
+
+    const Instruction& instr = code[pc];
+
+    if (instr.memo_slot_ != Instruction::NO_SLOT && (instr.memo_slot_ >= nslots || !e.memoized_))
+      return false;
+
+    switch (instr.code_)
+    {
+    case OpCode::memo_load:
+    {
+      const std::size_t target = instr.rhs_.slot_;
+
+      if (instr.memo_slot_ == Instruction::NO_SLOT || target <= pc || target > ncode ||
+          (target_depth[target] != NO_TARGET && target_depth[target] != sp + 1))
+        return false;
+
+      target_depth[target] = sp + 1;
+      continue;
+    }
+    case OpCode::reg_store:
+      if (sp == 0 || instr.lhs_.slot_ >= e.nregisters_)
+        return false;
+      continue;
+    case OpCode::div_pow2:
+    case OpCode::mod_pow2:
+      if (instr.rhs_kind_ != ArgKind::imm || instr.rhs_.imm_ < 0 || unsigned(instr.rhs_.imm_) >= scalar_bits - 1)
+        return false;
+      break;
+    case OpCode::div_magic:
+    case OpCode::mod_magic:
+      if (instr.rhs_kind_ != ArgKind::imm || instr.rhs_.slot_ >= e.divisors_.count_)
+        return false;
+      break;
+    case OpCode::add:
+    case OpCode::sub:
+    case OpCode::mul:
+    case OpCode::div:
+    case OpCode::mod:
+    case OpCode::div_nz:
+    case OpCode::mod_nz:
+    case OpCode::div_narrow:
+    case OpCode::mod_narrow:
+      break;
+    default:
+      return false;
+    }
+
+    // Right operand is popped first
+    if (!is_valid_arg(instr.rhs_kind_, instr.rhs_, sp) || !is_valid_arg(instr.lhs_kind_, instr.lhs_, sp))
+      return false;
+
+    if (++sp > e.max_depth_)
+      return false;
+  }
+
+  return sp == 1;
+}
+
+bool is_compatible(const void* data, const Evaluator& e, const Header& h, const Mapping* mappings,
+                   std::size_t file_size)
+{
+  if (!is_valid<Instruction>(e.code_, file_size) ||
+      !is_valid<uintptr_t>(e.bindings_, file_size) ||
+      !is_valid<std::size_t>(e.binding_ids_, file_size) ||
+      e.bindings_.count_ != e.binding_ids_.count_ ||
+      !is_valid<DivMagic>(e.divisors_, file_size) ||
+      e.mapping_ >= h.mappings_.count_)
+    return false;
+
+  return is_valid_code(data, e, mappings[e.mapping_].entries_.count_, h.unbound_values_.count_);
+}
+
+std::optional<ReusedExprMapping> restore_mapping(const void* data, const Mapping& m)
+{
+  sparse_map slots(m.universe_);
+  const std::uint64_t* entries = section_data<std::uint64_t>(data, m.entries_);
+
+  for (std::size_t j=0; j<m.entries_.count_; ++j)
+  {
+    const std::uint64_t key = entries[2 * j];
+    const std::uint64_t slot = entries[2 * j + 1];
+
+    if (key >= m.universe_ || slot >= m.entries_.count_ || slots.has(key))
+      return std::nullopt;
+
+    slots.insert(key, slot);
+  }
+
+  return ReusedExprMapping{std::move(slots), std::size_t(m.unbound_count_)};
+}
+
+} // namespace anonymous
+
+bool glfdc::write_image(const std::string& path, const ExprDAG& dag, const std::vector<const ExprEvaluator*>& evaluators)
+{
+  ImageWriter w;
+
+  Header header = make_header();
+  w.append(&header, 1);
+
+  header.unbound_exprs_ = w.append(dag.unbound_exprs_.data(), dag.unbound_exprs_.size());
+  header.internal_exprs_ = w.append(dag.internal_exprs_.data(), dag.internal_exprs_.size());
+  header.unbound_values_ = w.append(dag.unbound_values_.data(), dag.unbound_values_.size());
+
+  // Distinct mappings in order of first use
+  std::vector<const ReusedExprMapping*> mappings;
+  std::vector<std::uint64_t> mapping_of(evaluators.size());
+
+  for (std::size_t i=0; i<evaluators.size(); ++i)
+  {
+    assert(&evaluators[i]->dag() == &dag && "Evaluator of different DAG");
+
+    const auto it = std::find(mappings.begin(), mappings.end(), &evaluators[i]->mapping());
+    mapping_of[i] = std::uint64_t(it - mappings.begin());
+
+    if (it == mappings.end())
+      mappings.push_back(&evaluators[i]->mapping());
+  }
+
+  // Records are filled once their arrays are placed
+  std::vector<Mapping> mapping_records(mappings.size());
+  std::vector<Evaluator> records(evaluators.size());
+
+  header.mappings_ = w.append(mapping_records.data(), mapping_records.size());
+  header.evaluators_ = w.append(records.data(), records.size());
+
+  for (std::size_t i=0; i<mappings.size(); ++i)
+  {
+    // Mapping may predate later nodes of DAG - keys are stored over whole DAG
+    const std::uint64_t nunbound = dag.unbound_exprs_.size();
+    const std::uint64_t addend = mappings[i]->unbound_count;
+
+    std::vector<std::uint64_t> entries;
+
+    for (const auto& [key, slot] : mappings[i]->slot_mapping)
+    {
+      entries.push_back((key < addend)? key : key - addend + nunbound);
+      entries.push_back(slot);
+    }
+
+    Mapping m;
+    std::memset(&m, 0, sizeof(m));
+
+    m.entries_ = w.append(entries.data(), entries.size());
+    m.entries_.count_ /= 2;
+    m.universe_ = nunbound + dag.internal_exprs_.size();
+    m.unbound_count_ = nunbound;
+
+    w.at<Mapping>(header.mappings_.offset_ + i * sizeof(Mapping)) = m;
+  }
+
+  for (std::size_t i=0; i<evaluators.size(); ++i)
+  {
+    const Bytecode& code = evaluators[i]->bytecode();
+
+    Evaluator r;
+    std::memset(&r, 0, sizeof(r));
+
+    r.root_ = encode_root(evaluators[i]->expr().subexpr_);
+    r.code_ = w.append(code.code().data(), code.code().size());
+    r.bindings_ = w.append(code.bindings().data(), code.bindings().size());
+    r.binding_ids_ = w.append(code.binding_ids().data(), code.binding_ids().size());
+    r.divisors_ = w.append(code.divisors().data(), code.divisors().size());
+    r.mapping_ = mapping_of[i];
+
+    r.max_depth_ = code.max_depth();
+    r.nregisters_ = code.register_count();
+    r.memoized_ = code.is_memoized();
+
+    w.at<Evaluator>(header.evaluators_.offset_ + i * sizeof(Evaluator)) = r;
+  }
+
+  w.align();
+  header.file_size_ = w.buffer_.size();
+  w.at<Header>(0) = header;
+
+  // Readers never see partially written image
+  const std::string tmp = path + "." + std::to_string(getpid());
+
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out.write(w.buffer_.data(), std::streamsize(w.buffer_.size()));
+
+    if (!out)
+    {
+      std::remove(tmp.c_str());
+      return false;
+    }
+  }
+
+  return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+scalar_type* MappedEvaluator::prepare_scratch(EvalState& es) const
+{
+  assert((!code_.memoized_ || &es.mapping() == mapping_) && "EvalState of different mapping");
+  return es.scratch(code_.nbindings_ + code_.frame_size());
+}
+
+scalar_type MappedEvaluator::evaluate(EvalState& es, const scalar_type* binding_values) const
+{
+  scalar_type* slot_values = prepare_scratch(es);
+
+  for (std::size_t i=0; i<code_.nbindings_; ++i)
+    slot_values[i] = binding_values[code_.binding_ids_[i]];
+
+  const scalar_type result = code_.execute(slot_values, slot_values + code_.nbindings_, es);
+  es.commit_stats();
+
+  return result;
+}
+
+void MappedEvaluator::evaluate_batch(EvalState& es, const scalar_type* const* binding_columns, std::size_t nlanes,
+                                     scalar_type* results) const
+{
+  scalar_type* scratch = es.scratch(code_.batch_scratch_size());
+  code_.execute_batch(binding_columns, nlanes, results, scratch);
+}
+
+std::optional<MappedImage> MappedImage::open(const std::string& path)
+{
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0)
+    return std::nullopt;
+
+  struct stat st;
+
+  if (fstat(fd, &st) != 0 || std::size_t(st.st_size) < sizeof(Header))
+  {
+    close(fd);
+    return std::nullopt;
+  }
+
+  const std::size_t size = std::size_t(st.st_size);
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (data == MAP_FAILED)
+    return std::nullopt;
+
+  MappedImage ret;
+  ret.data_ = data;
+  ret.size_ = size;
+
+  const Header& h = *static_cast<const Header*>(data);
+
+  if (!is_compatible(h, size))
+    return std::nullopt;
+
+  ret.dag_ = ExprDAGView{
+    section_data<PackedSExpr>(data, h.unbound_exprs_), std::size_t(h.unbound_exprs_.count_),
+    section_data<PackedSExpr>(data, h.internal_exprs_), std::size_t(h.internal_exprs_.count_),
+    section_data<uintptr_t>(data, h.unbound_values_), std::size_t(h.unbound_values_.count_)
+  };
+
+  const Mapping* mapping_records = section_data<Mapping>(data, h.mappings_);
+  const Evaluator* records = section_data<Evaluator>(data, h.evaluators_);
+
+  // Stable addresses - evaluators point to their mappings
+  ret.mappings_.reserve(h.mappings_.count_);
+  ret.evaluators_.reserve(h.evaluators_.count_);
+
+  for (std::size_t i=0; i<h.mappings_.count_; ++i)
+  {
+    if (!is_compatible(mapping_records[i], h, size))
+      return std::nullopt;
+
+    auto mapping = restore_mapping(data, mapping_records[i]);
+
+    if (!mapping.has_value())
+      return std::nullopt;
+
+    ret.mappings_.push_back(std::move(mapping.value()));
+  }
+
+  for (std::size_t i=0; i<h.evaluators_.count_; ++i)
+  {
+    const Evaluator& r = records[i];
+
+    if (!is_compatible(data, r, h, mapping_records, size))
+      return std::nullopt;
+
+    const SExprRef root = decode_root(r.root_);
+
+    if (is_lref(root)? std::get<LExprRef>(root).index_ >= ret.dag_.nunbound_exprs_
+                     : std::get<IExprRef>(root).index_ >= ret.dag_.ninternal_exprs_)
+      return std::nullopt;
+
+    const BytecodeView code{
+      section_data<Instruction>(data, r.code_), std::size_t(r.code_.count_),
+      section_data<uintptr_t>(data, r.bindings_), section_data<std::size_t>(data, r.binding_ids_),
+      std::size_t(r.bindings_.count_),
+      section_data<DivMagic>(data, r.divisors_),
+      std::size_t(r.max_depth_), std::size_t(r.nregisters_), r.memoized_ != 0
+    };
+
+    ret.evaluators_.push_back(MappedEvaluator(root, code, &ret.mappings_[r.mapping_]));
+  }
+
+  return ret;
+}
+
+MappedImage::MappedImage(MappedImage&& other) noexcept
+  : data_(other.data_), size_(other.size_), dag_(other.dag_),
+    mappings_(std::move(other.mappings_)), evaluators_(std::move(other.evaluators_))
+{
+  other.data_ = nullptr;
+  other.size_ = 0;
+}
+
+MappedImage& MappedImage::operator=(MappedImage&& other) noexcept
+{
+  std::swap(data_, other.data_);
+  std::swap(size_, other.size_);
+  std::swap(dag_, other.dag_);
+  std::swap(mappings_, other.mappings_);
+  std::swap(evaluators_, other.evaluators_);
+
+  return *this;
+}
+
+MappedImage::~MappedImage()
+{
+  if (data_)
+    munmap(const_cast<void*>(data_), size_);
+}
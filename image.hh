@@ -0,0 +1,250 @@
+#pragma once
+
+#include "bytecode.hh"
+#include "eval.hh"
+#include "packed_sexpr.hh"
+#include "sexpr.hh"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace glfdc {
+
+struct ExprDAG;
+
+// Binary image of ExprDAG and evaluators compiled over it.
+//
+// Image is position independent - sections are referred to by file offsets - and arrays are stored
+// in their in-memory layout, so loading is single mmap with no per-node parsing and evaluation
+// runs directly off the mapped pages.
+//
+// Layout:
+//
+// [image::Header]
+// [unbound_exprs_]   PackedSExpr[]
+// [internal_exprs_]  PackedSExpr[]
+// [unbound_values_]  uintptr_t[]
+// [mappings]         image::Mapping[]
+// [evaluators]       image::Evaluator[]
+// [(key, slot) entries of each mapping]
+// [code, bindings, binding ids and divisors of each evaluator]
+//
+// Every section is aligned to image::ALIGN bytes.
+//
+// NB: Image is only readable by build with the same version, byte order and sizes of stored types -
+// those are checked by MappedImage::open(), as are bounds of all sections and every index and stack
+// depth of stored code, so corrupt image is rejected. Binding cookies are stored verbatim.
+namespace image {
+
+constexpr char MAGIC[8] = {'G', 'L', 'F', 'D', 'C', 'I', 'M', 'G'};
+constexpr std::uint32_t VERSION = 4;
+constexpr std::uint32_t BYTE_ORDER_MARK = 0x01020304u;
+constexpr std::size_t ALIGN = 16;
+constexpr std::uint64_t ROOT_INTERNAL = std::uint64_t(1) << 63;
+
+struct Section
+{
+  std::uint64_t offset_;
+  std::uint64_t count_;
+};
+
+struct Header
+{
+  char magic_[8];
+  std::uint32_t version_;
+  std::uint32_t byte_order_;
+
+  // Sizes of stored types
+  std::uint8_t scalar_size_;
+  std::uint8_t size_size_;
+  std::uint8_t uintptr_size_;
+  std::uint8_t packed_sexpr_size_;
+  std::uint8_t instruction_size_;
+  std::uint8_t div_magic_size_;
+  std::uint8_t reserved_[2];
+
+  std::uint64_t file_size_;
+
+  Section unbound_exprs_;
+  Section internal_exprs_;
+  Section unbound_values_;
+  Section mappings_;
+  Section evaluators_;
+};
+
+// ReusedExprMapping shared by evaluators
+struct Mapping
+{
+  Section entries_; // (key, slot) pairs of std::uint64_t
+  std::uint64_t universe_;      // number of DAG nodes
+  std::uint64_t unbound_count_; // number of unbound DAG nodes - keys of internal ones start past them
+};
+
+struct Evaluator
+{
+  std::uint64_t root_; // LExprRef index, IExprRef index has ROOT_INTERNAL bit set
+
+  Section code_;
+  Section bindings_;
+  Section binding_ids_;
+  Section divisors_;
+
+  std::uint64_t mapping_; // index of Mapping code was compiled with
+  std::uint64_t max_depth_;
+  std::uint64_t nregisters_;
+  std::uint64_t memoized_;
+};
+
+} // namespace image
+
+// Writes dag and evaluators into image file, all evaluators have to be compiled over dag.
+// Evaluators sharing ReusedExprMapping share it in image as well. Returns false on I/O error.
+bool write_image(const std::string& path, const ExprDAG& dag, const std::vector<const ExprEvaluator*>& evaluators);
+
+// Read-only ExprDAG stored in image
+struct ExprDAGView
+{
+  const PackedSExpr* unbound_exprs_;
+  std::size_t nunbound_exprs_;
+
+  const PackedSExpr* internal_exprs_;
+  std::size_t ninternal_exprs_;
+
+  const uintptr_t* unbound_values_;
+  std::size_t nunbound_values_;
+
+  SExpr fetch(SExprRef e) const noexcept // O(1)
+  {
+    return fetch_packed(e).unpack();
+  }
+
+  PackedSExpr fetch_packed(SExprRef e) const noexcept // O(1)
+  {
+    if (is_lref(e))
+    {
+      assert(std::get<LExprRef>(e).index_ < nunbound_exprs_);
+      return unbound_exprs_[std::get<LExprRef>(e).index_];
+    }
+
+    assert(std::get<IExprRef>(e).index_ < ninternal_exprs_);
+    return internal_exprs_[std::get<IExprRef>(e).index_];
+  }
+
+  std::size_t node_count() const noexcept
+  {
+    return nunbound_exprs_ + ninternal_exprs_;
+  }
+
+  uintptr_t get_binding(UnboundValue ubv) const noexcept // O(1)
+  {
+    assert(ubv.index_ < nunbound_values_);
+    return unbound_values_[ubv.index_];
+  }
+};
+
+// Evaluator stored in image - same evaluation interface as ExprEvaluator.
+//
+// NB: EvalState passed to evaluate() must use mapping()
+class MappedEvaluator
+{
+public:
+  template <typename BindFn_, enable_if_binding_fn_t<BindFn_> = 0>
+  scalar_type evaluate(EvalState& es, BindFn_&& binding_fn) const
+  {
+    scalar_type* binding_values = prepare_scratch(es);
+
+    for (std::size_t i=0; i<code_.nbindings_; ++i)
+      binding_values[i] = binding_fn(code_.bindings_[i]);
+
+    EvalCounters binding_calls;
+    binding_calls.binding_calls_ = code_.nbindings_;
+    es.count(binding_calls);
+
+    const scalar_type result = code_.execute(binding_values, binding_values + code_.nbindings_, es);
+    es.commit_stats(); // counted into EvalState and eval_stats_total() only
+
+    return result;
+  }
+
+  // binding_values are indexed by UnboundValue::index_
+  scalar_type evaluate(EvalState& es, const scalar_type* binding_values) const;
+
+  void evaluate_batch(EvalState& es, const scalar_type* const* binding_columns, std::size_t nlanes,
+                      scalar_type* results) const;
+
+  SExprRef root() const noexcept
+  {
+    return root_;
+  }
+
+  const BytecodeView& bytecode() const noexcept
+  {
+    return code_;
+  }
+
+  // Mapping code was compiled with, restored from image
+  const ReusedExprMapping& mapping() const noexcept
+  {
+    return *mapping_;
+  }
+
+private:
+  friend class MappedImage;
+
+  MappedEvaluator(SExprRef root, BytecodeView code, const ReusedExprMapping* mapping) noexcept
+    : root_(root), code_(code), mapping_(mapping)
+  {
+  }
+
+  scalar_type* prepare_scratch(EvalState& es) const;
+
+  SExprRef root_;
+  BytecodeView code_;
+  const ReusedExprMapping* mapping_;
+};
+
+// Image file mapped into memory, DAG and evaluators are valid as long as image is
+class MappedImage
+{
+public:
+  // Returns nullopt if file can't be mapped or is not compatible image
+  static std::optional<MappedImage> open(const std::string& path);
+
+  MappedImage(MappedImage&& other) noexcept;
+  MappedImage& operator=(MappedImage&& other) noexcept;
+
+  MappedImage(const MappedImage&) = delete;
+  MappedImage& operator=(const MappedImage&) = delete;
+
+  ~MappedImage();
+
+  const ExprDAGView& dag() const noexcept
+  {
+    return dag_;
+  }
+
+  const std::vector<MappedEvaluator>& evaluators() const noexcept
+  {
+    return evaluators_;
+  }
+
+  // Mappings restored from image - O(DAG nodes) work on open()
+  const std::vector<ReusedExprMapping>& mappings() const noexcept
+  {
+    return mappings_;
+  }
+
+private:
+  MappedImage() = default;
+
+  const void* data_ = nullptr;
+  std::size_t size_ = 0;
+
+  ExprDAGView dag_{};
+  std::vector<ReusedExprMapping> mappings_;
+  std::vector<MappedEvaluator> evaluators_;
+};
+
+} // namespace glfdc
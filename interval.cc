@@ -0,0 +1,170 @@
+#include "interval.hh"
+
+#include "cfold.hh"
+#include "divisor.hh"
+
+#include <algorithm>
+
+using namespace glfdc;
+
+namespace {
+
+using detail::wide_scalar_type;
+
+constexpr auto SCALAR_MIN = wide_scalar_type(std::numeric_limits<scalar_type>::min());
+constexpr auto SCALAR_MAX = wide_scalar_type(std::numeric_limits<scalar_type>::max());
+
+// Interval of wide bounds, full() if it doesn't fit scalar_type
+Interval narrow(wide_scalar_type lo, wide_scalar_type hi) noexcept
+{
+  if (lo < SCALAR_MIN || hi > SCALAR_MAX)
+    return Interval::full();
+
+  return {scalar_type(lo), scalar_type(hi)};
+}
+
+// Corners of lhs x rhs combined by fn - extremes of function monotone in both operands
+template <typename Fn_>
+Interval corners(Interval lhs, Interval rhs, Fn_ fn) noexcept
+{
+  const wide_scalar_type v[] = {
+    fn(lhs.lo_, rhs.lo_), fn(lhs.lo_, rhs.hi_), fn(lhs.hi_, rhs.lo_), fn(lhs.hi_, rhs.hi_)
+  };
+
+  return narrow(*std::min_element(std::begin(v), std::end(v)), *std::max_element(std::begin(v), std::end(v)));
+}
+
+// Truncated quotient is monotone in both operands while divisor keeps its sign
+Interval div_interval(Interval lhs, Interval rhs) noexcept
+{
+  auto quot = [](scalar_type l, scalar_type r) { return wide_scalar_type(l) / wide_scalar_type(r); };
+
+  std::optional<Interval> ret;
+
+  auto add = [&ret](Interval i) { ret = ret.has_value()? hull(ret.value(), i) : i; };
+
+  if (rhs.lo_ < 0)
+    add(corners(lhs, Interval{rhs.lo_, std::min<scalar_type>(rhs.hi_, -1)}, quot));
+
+  if (rhs.hi_ > 0)
+    add(corners(lhs, Interval{std::max<scalar_type>(rhs.lo_, 1), rhs.hi_}, quot));
+
+  // x/0 == 0
+  if (rhs.contains(0))
+    add(Interval::point(0));
+
+  return ret.value();
+}
+
+// Remainder has sign of dividend, is smaller than divisor in magnitude and not larger than dividend
+Interval mod_interval(Interval lhs, Interval rhs) noexcept
+{
+  if (lhs.is_point() && rhs.is_point() && (lhs.lo_ != std::numeric_limits<scalar_type>::min() || rhs.lo_ != -1))
+    return Interval::point(cfold(OperatorKind::mod, lhs.lo_, rhs.lo_));
+
+  // x%0 == 0 is within any range below
+  const wide_scalar_type max_divisor = std::max(-wide_scalar_type(rhs.lo_), wide_scalar_type(rhs.hi_));
+
+  if (!rhs.contains(0))
+  {
+    const wide_scalar_type min_divisor = (rhs.lo_ > 0)? wide_scalar_type(rhs.lo_) : -wide_scalar_type(rhs.hi_);
+
+    // Dividend smaller than any divisor - x%d == x
+    if (-wide_scalar_type(lhs.lo_) < min_divisor && wide_scalar_type(lhs.hi_) < min_divisor)
+      return lhs;
+  }
+
+  const wide_scalar_type lo = std::max(std::min(wide_scalar_type(lhs.lo_), wide_scalar_type(0)), 1 - max_divisor);
+  const wide_scalar_type hi = std::min(std::max(wide_scalar_type(lhs.hi_), wide_scalar_type(0)), max_divisor - 1);
+
+  return narrow(std::min(lo, wide_scalar_type(0)), std::max(hi, wide_scalar_type(0)));
+}
+
+} // namespace anonymous
+
+Interval glfdc::interval_of(OperatorKind op, Interval lhs, Interval rhs) noexcept
+{
+  switch (op)
+  {
+  case OperatorKind::add:
+    return narrow(wide_scalar_type(lhs.lo_) + rhs.lo_, wide_scalar_type(lhs.hi_) + rhs.hi_);
+  case OperatorKind::sub:
+    return narrow(wide_scalar_type(lhs.lo_) - rhs.hi_, wide_scalar_type(lhs.hi_) - rhs.lo_);
+  case OperatorKind::mul:
+    return corners(lhs, rhs, [](scalar_type l, scalar_type r) { return wide_scalar_type(l) * r; });
+  case OperatorKind::div:
+    return div_interval(lhs, rhs);
+  case OperatorKind::mod:
+    return mod_interval(lhs, rhs);
+  }
+
+  assert(false && "Unreachable");
+  return Interval::full();
+}
+
+RangeAnalysis::RangeAnalysis(const ExprDAG& dag, const Interval* binding_ranges)
+  : dag_(dag), binding_ranges_(binding_ranges, binding_ranges + dag.unbound_values_.size()),
+    unbound_ranges_(dag.unbound_exprs_.size(), Interval::full()),
+    internal_ranges_(dag.internal_exprs_.size(), Interval::full())
+{
+  // Node vectors aren't ordered topologically with respect to each other - iterative postorder DFS
+  std::vector<bool> unbound_done(unbound_ranges_.size(), false);
+  std::vector<bool> internal_done(internal_ranges_.size(), false);
+
+  auto done = [&](SExprRef ref) {
+    return (is_lref(ref)? unbound_done : internal_done)[ref_index(ref)];
+  };
+
+  std::vector<SExprRef> stack;
+
+  auto visit = [&](SExprRef root) {
+    if (done(root))
+      return;
+
+    stack.push_back(root);
+
+    while (!stack.empty())
+    {
+      const SExprRef ref = stack.back();
+      const SExpr e = dag_.fetch(ref);
+
+      if (is_sexpr(e.lhs_) && !done(std::get<SExprRef>(e.lhs_)))
+      {
+        stack.push_back(std::get<SExprRef>(e.lhs_));
+        continue;
+      }
+
+      if (is_sexpr(e.rhs_) && !done(std::get<SExprRef>(e.rhs_)))
+      {
+        stack.push_back(std::get<SExprRef>(e.rhs_));
+        continue;
+      }
+
+      (is_lref(ref)? unbound_ranges_ : internal_ranges_)[ref_index(ref)] = interval_of(e.op_, range(e.lhs_), range(e.rhs_));
+      (is_lref(ref)? unbound_done : internal_done)[ref_index(ref)] = true;
+
+      stack.pop_back();
+    }
+  };
+
+  for (std::size_t i=0; i<unbound_ranges_.size(); ++i)
+    visit(LExprRef{i});
+
+  for (std::size_t i=0; i<internal_ranges_.size(); ++i)
+    visit(IExprRef{i});
+}
+
+Interval RangeAnalysis::range(Operand op) const noexcept
+{
+  if (is_sexpr(op))
+    return range(std::get<SExprRef>(op));
+
+  assert(is_value(op));
+
+  const auto val = std::get<Value>(op);
+
+  if (is_unbound_value(op))
+    return binding_ranges_[std::get<UnboundValue>(val).index_];
+
+  return Interval::point(std::get<scalar_type>(val));
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "expr.hh"
+#include "sexpr.hh"
+
+#include <cassert>
+#include <limits>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+namespace glfdc {
+
+// Closed range [lo_, hi_] of values scalar may take
+struct Interval
+{
+  scalar_type lo_;
+  scalar_type hi_;
+
+  static constexpr Interval full() noexcept
+  {
+    return {std::numeric_limits<scalar_type>::min(), std::numeric_limits<scalar_type>::max()};
+  }
+
+  static constexpr Interval point(scalar_type v) noexcept
+  {
+    return {v, v};
+  }
+
+  constexpr bool contains(scalar_type v) const noexcept
+  {
+    return lo_ <= v && v <= hi_;
+  }
+
+  constexpr bool is_point() const noexcept
+  {
+    return lo_ == hi_;
+  }
+
+  constexpr bool is_full() const noexcept
+  {
+    return *this == full();
+  }
+
+  // Every value fits into signed integer of given width
+  constexpr bool fits_bits(unsigned bits) const noexcept
+  {
+    const auto bound = (long long)(1) << (bits - 1);
+    return lo_ >= -bound && hi_ < bound;
+  }
+
+  constexpr bool operator==(Interval other) const noexcept
+  {
+    return lo_ == other.lo_ && hi_ == other.hi_;
+  }
+
+  constexpr bool operator!=(Interval other) const noexcept
+  {
+    return !(*this == other);
+  }
+};
+
+// Smallest interval containing both
+constexpr Interval hull(Interval a, Interval b) noexcept
+{
+  return {a.lo_ < b.lo_? a.lo_ : b.lo_, a.hi_ > b.hi_? a.hi_ : b.hi_};
+}
+
+// Range of l op r for every l in lhs and r in rhs, same semantics as cfold() including x/0 == x%0 == 0.
+// Result which may overflow scalar_type is full().
+Interval interval_of(OperatorKind op, Interval lhs, Interval rhs) noexcept;
+
+// Forward range analysis of ExprDAG - propagates ranges of bindings through all subexpressions.
+//
+// Range of every node is stored aside of DAG, indexed the same way as ExprDAG node vectors.
+// Nodes added to DAG after analysis have no range - analysis has to be redone.
+//
+// Evaluators compiled with ranges (see Bytecode::compile()) rely on them - evaluating with binding
+// values out of their ranges gives unspecified results.
+class RangeAnalysis
+{
+public:
+  // binding_ranges are indexed by UnboundValue::index_ - O(n)
+  RangeAnalysis(const ExprDAG& dag, const Interval* binding_ranges);
+
+  // binding_range_fn is called once per binding cookie
+  template <typename RangeFn_,
+            std::enable_if_t<std::is_invocable_r_v<Interval, RangeFn_&, uintptr_t>, int> = 0>
+  RangeAnalysis(const ExprDAG& dag, RangeFn_&& binding_range_fn)
+    : RangeAnalysis(dag, resolve_bindings(dag, binding_range_fn).data())
+  {
+  }
+
+  Interval range(SExprRef ref) const noexcept // O(1)
+  {
+    const auto& ranges = is_lref(ref)? unbound_ranges_ : internal_ranges_;
+
+    assert(ref_index(ref) < ranges.size() && "Node added after analysis");
+    return ranges[ref_index(ref)];
+  }
+
+  Interval range(Operand op) const noexcept;
+
+  // Value of operand if its range collapsed to single value
+  std::optional<scalar_type> constant(Operand op) const noexcept
+  {
+    const Interval r = range(op);
+
+    if (!r.is_point())
+      return std::nullopt;
+
+    return r.lo_;
+  }
+
+  const ExprDAG& dag() const noexcept
+  {
+    return dag_;
+  }
+
+private:
+  template <typename RangeFn_>
+  static std::vector<Interval> resolve_bindings(const ExprDAG& dag, RangeFn_& binding_range_fn)
+  {
+    std::vector<Interval> ranges;
+    ranges.reserve(dag.unbound_values_.size());
+
+    for (uintptr_t cookie : dag.unbound_values_)
+      ranges.push_back(binding_range_fn(cookie));
+
+    return ranges;
+  }
+
+  const ExprDAG& dag_;
+
+  std::vector<Interval> binding_ranges_;
+  std::vector<Interval> unbound_ranges_;
+  std::vector<Interval> internal_ranges_;
+};
+
+} // namespace glfdc
@@ -0,0 +1,344 @@
+#include "kernels.hh"
+
+#include "cfold.hh"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#  define GLFDC_X86_KERNELS 1
+#  include <immintrin.h>
+#endif
+
+using namespace glfdc;
+
+namespace {
+
+using kernel_fn = void (*)(const scalar_type*, const scalar_type*, scalar_type*, std::size_t);
+
+struct KernelTable
+{
+  kernel_fn add;
+  kernel_fn sub;
+  kernel_fn mul;
+  kernel_fn div;
+  kernel_fn mod;
+  kernel_fn div_nz;
+  kernel_fn mod_nz;
+  kernel_fn div_narrow;
+  kernel_fn mod_narrow;
+
+  const char* isa;
+};
+
+template <typename Fn_>
+void unary_kernel(const scalar_type* l, const scalar_type* r, scalar_type* out, std::size_t n, Fn_ fn)
+{
+  // Right operand is the same immediate in every lane
+  const unsigned k = unsigned(r[0]);
+
+  for (std::size_t i = 0; i < n; ++i)
+    out[i] = fn(l[i], k);
+}
+
+template <OperatorKind Op_>
+void scalar_kernel(const scalar_type* l, const scalar_type* r, scalar_type* out, std::size_t n)
+{
+  for (std::size_t i = 0; i < n; ++i)
+    out[i] = cfold(Op_, l[i], r[i]);
+}
+
+// Division with divisor known to be nonzero
+template <OpCode Code_>
+void scalar_nz_kernel(const scalar_type* l, const scalar_type* r, scalar_type* out, std::size_t n)
+{
+  for (std::size_t i = 0; i < n; ++i)
+    out[i] = detail::apply_op(Code_, l[i], r[i]);
+}
+
+constexpr KernelTable scalar_kernels = {
+  scalar_kernel<OperatorKind::add>,
+  scalar_kernel<OperatorKind::sub>,
+  scalar_kernel<OperatorKind::mul>,
+  scalar_kernel<OperatorKind::div>,
+  scalar_kernel<OperatorKind::mod>,
+  scalar_nz_kernel<OpCode::div_nz>,
+  scalar_nz_kernel<OpCode::mod_nz>,
+  scalar_nz_kernel<OpCode::div_nz>,
+  scalar_nz_kernel<OpCode::mod_nz>,
+  "scalar"
+};
+
+#ifdef GLFDC_X86_KERNELS
+
+static_assert(sizeof(scalar_type) == sizeof(std::int32_t), "Vector kernels assume 32b lanes");
+
+// NB: Integer division is done in double precision, which is exact for 32b operands,
+// lanes with zero divisor are masked to 0 afterwards.
+
+#define GLFDC_AVX2 __attribute__((target("avx2")))
+#define GLFDC_SSE41 __attribute__((target("sse4.1")))
+
+#define GLFDC_DEFINE_AVX2_KERNEL(name_, intrin_, op_) \
+GLFDC_AVX2 void name_(const scalar_type* l, const scalar_type* r, scalar_type* out, std::size_t n) \
+{ \
+  std::size_t i = 0; \
+  for (; i + 8 <= n; i += 8) \
+  { \
+    const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(l + i)); \
+    const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r + i)); \
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), intrin_(a, b)); \
+  } \
+  scalar_kernel<op_>(l + i, r + i, out + i, n - i); \
+}
+
+#define GLFDC_DEFINE_SSE41_KERNEL(name_, intrin_, op_) \
+GLFDC_SSE41 void name_(const scalar_type* l, const scalar_type* r, scalar_type* out, std::size_t n) \
+{ \
+  std::size_t i = 0; \
+  for (; i + 4 <= n; i += 4) \
+  { \
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(l + i)); \
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + i)); \
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), intrin_(a, b)); \
+  } \
+  scalar_kernel<op_>(l + i, r + i, out + i, n - i); \
+}
+
+GLFDC_DEFINE_AVX2_KERNEL(add_avx2, _mm256_add_epi32, OperatorKind::add)
+GLFDC_DEFINE_AVX2_KERNEL(sub_avx2, _mm256_sub_epi32, OperatorKind::sub)
+GLFDC_DEFINE_AVX2_KERNEL(mul_avx2, _mm256_mullo_epi32, OperatorKind::mul)
+
+GLFDC_DEFINE_SSE41_KERNEL(add_sse41, _mm_add_epi32, OperatorKind::add)
+GLFDC_DEFINE_SSE41_KERNEL(sub_sse41, _mm_sub_epi32, OperatorKind::sub)
+GLFDC_DEFINE_SSE41_KERNEL(mul_sse41, _mm_mullo_epi32, OperatorKind::mul)
+
+#undef GLFDC_DEFINE_AVX2_KERNEL
+#undef GLFDC_DEFINE_SSE41_KERNEL
+
+// Truncated quotient of 4 lanes of nonzero divisors
+GLFDC_AVX2 inline __m128i quot_nz_avx2(__m128i a, __m128i b)
+{
+  return _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(a), _mm256_cvtepi32_pd(b)));
+}
+
+// Truncated quotient of 4 lanes, 0 for zero divisor
+GLFDC_AVX2 inline __m128i quot_avx2(__m128i a, __m128i b)
+{
+  const __m128i zero_divisor = _mm_cmpeq_epi32(b, _mm_setzero_si128());
+  return _mm_andnot_si128(zero_divisor, quot_nz_avx2(a, b));
+}
+
+GLFDC_SSE41 inline __m128i quot_nz_sse41(__m128i a, __m128i b)
+{
+  const __m128i a_hi = _mm_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 3, 2));
+  const __m128i b_hi = _mm_shuffle_epi32(b, _MM_SHUFFLE(1, 0, 3, 2));
+
+  const __m128i q_lo = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(a), _mm_cvtepi32_pd(b)));
+  const __m128i q_hi = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(a_hi), _mm_cvtepi32_pd(b_hi)));
+
+  return _mm_unpacklo_epi64(q_lo, q_hi);
+}
+
+GLFDC_SSE41 inline __m128i quot_sse41(__m128i a, __m128i b)
+{
+  const __m128i zero_divisor = _mm_cmpeq_epi32(b, _mm_setzero_si128());
+  return _mm_andnot_si128(zero_divisor, quot_nz_sse41(a, b));
+}
+
+// Operands of at most 24 bits are exact in single precision and so is truncated quotient
+// (error of rounding is below distance to nearest integer), twice as many lanes as in double.
+GLFDC_AVX2 inline __m256i quot_narrow_avx2(__m256i a, __m256i b)
+{
+  return _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(a), _mm256_cvtepi32_ps(b)));
+}
+
+GLFDC_SSE41 inline __m128i quot_narrow_sse41(__m128i a, __m128i b)
+{
+  return _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(a), _mm_cvtepi32_ps(b)));
+}
+
+// Remainder from truncated quotient: a - (a/b)*b, 0 for zero divisor
+GLFDC_SSE41 inline __m128i rem_sse41(__m128i a, __m128i b, __m128i q)
+{
+  const __m128i zero_divisor = _mm_cmpeq_epi32(b, _mm_setzero_si128());
+  return _mm_andnot_si128(zero_divisor, _mm_sub_epi32(a, _mm_mullo_epi32(q, b)));
+}
+
+GLFDC_AVX2 void div_avx2(const scalar_type* l, const scalar_type* r, scalar_type* out, std::size_t n)
+{
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(l + i));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), quot_avx2(a, b));
+  }
+  scalar_kernel<OperatorKind::div>(l + i, r + i, out + i, n - i);
+}
+
+GLFDC_AVX2 void mod_avx2(const scalar_type* l, const scalar_type* r, scalar_type* out, std::size_t n)
+{
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(l + i));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), rem_sse41(a, b, quot_avx2(a, b)));
+  }
+  scalar_kernel<OperatorKind::mod>(l + i, r + i, out + i, n - i);
+}
+
+GLFDC_SSE41 void div_sse41(const scalar_type* l, const scalar_type* r, scalar_type* out, std::size_t n)
+{
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(l + i));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), quot_sse41(a, b));
+  }
+  scalar_kernel<OperatorKind::div>(l + i, r + i, out + i, n - i);
+}
+
+GLFDC_SSE41 void mod_sse41(const scalar_type* l, const scalar_type* r, scalar_type* out, std::size_t n)
+{
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(l + i));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), rem_sse41(a, b, quot_sse41(a, b)));
+  }
+  scalar_kernel<OperatorKind::mod>(l + i, r + i, out + i, n - i);
+}
+
+// Kernels of divisor ranges excluding zero (div_nz and others) - zero divisor lanes are not masked.
+// Lane q is quotient, r is remainder a - q*b.
+#define GLFDC_DEFINE_NZ_KERNEL(name_, attr_, vec_, load_, store_, width_, quot_, result_, fallback_) \
+attr_ void name_(const scalar_type* l, const scalar_type* r, scalar_type* out, std::size_t n) \
+{ \
+  std::size_t i = 0; \
+  for (; i + width_ <= n; i += width_) \
+  { \
+    const vec_ a = load_(reinterpret_cast<const vec_*>(l + i)); \
+    const vec_ b = load_(reinterpret_cast<const vec_*>(r + i)); \
+    const vec_ q = quot_(a, b); \
+    store_(reinterpret_cast<vec_*>(out + i), result_); \
+  } \
+  scalar_nz_kernel<fallback_>(l + i, r + i, out + i, n - i); \
+}
+
+GLFDC_DEFINE_NZ_KERNEL(div_nz_avx2, GLFDC_AVX2, __m128i, _mm_loadu_si128, _mm_storeu_si128, 4,
+                       quot_nz_avx2, q, OpCode::div_nz)
+GLFDC_DEFINE_NZ_KERNEL(mod_nz_avx2, GLFDC_AVX2, __m128i, _mm_loadu_si128, _mm_storeu_si128, 4,
+                       quot_nz_avx2, _mm_sub_epi32(a, _mm_mullo_epi32(q, b)), OpCode::mod_nz)
+GLFDC_DEFINE_NZ_KERNEL(div_narrow_avx2, GLFDC_AVX2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, 8,
+                       quot_narrow_avx2, q, OpCode::div_nz)
+GLFDC_DEFINE_NZ_KERNEL(mod_narrow_avx2, GLFDC_AVX2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, 8,
+                       quot_narrow_avx2, _mm256_sub_epi32(a, _mm256_mullo_epi32(q, b)), OpCode::mod_nz)
+
+GLFDC_DEFINE_NZ_KERNEL(div_nz_sse41, GLFDC_SSE41, __m128i, _mm_loadu_si128, _mm_storeu_si128, 4,
+                       quot_nz_sse41, q, OpCode::div_nz)
+GLFDC_DEFINE_NZ_KERNEL(mod_nz_sse41, GLFDC_SSE41, __m128i, _mm_loadu_si128, _mm_storeu_si128, 4,
+                       quot_nz_sse41, _mm_sub_epi32(a, _mm_mullo_epi32(q, b)), OpCode::mod_nz)
+GLFDC_DEFINE_NZ_KERNEL(div_narrow_sse41, GLFDC_SSE41, __m128i, _mm_loadu_si128, _mm_storeu_si128, 4,
+                       quot_narrow_sse41, q, OpCode::div_nz)
+GLFDC_DEFINE_NZ_KERNEL(mod_narrow_sse41, GLFDC_SSE41, __m128i, _mm_loadu_si128, _mm_storeu_si128, 4,
+                       quot_narrow_sse41, _mm_sub_epi32(a, _mm_mullo_epi32(q, b)), OpCode::mod_nz)
+
+#undef GLFDC_DEFINE_NZ_KERNEL
+#undef GLFDC_AVX2
+#undef GLFDC_SSE41
+
+constexpr KernelTable avx2_kernels = {
+  add_avx2, sub_avx2, mul_avx2, div_avx2, mod_avx2,
+  div_nz_avx2, mod_nz_avx2, div_narrow_avx2, mod_narrow_avx2, "avx2"
+};
+
+constexpr KernelTable sse41_kernels = {
+  add_sse41, sub_sse41, mul_sse41, div_sse41, mod_sse41,
+  div_nz_sse41, mod_nz_sse41, div_narrow_sse41, mod_narrow_sse41, "sse4.1"
+};
+
+#endif // GLFDC_X86_KERNELS
+
+const KernelTable& select_kernels() noexcept
+{
+#ifdef GLFDC_X86_KERNELS
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+    return avx2_kernels;
+
+  if (__builtin_cpu_supports("sse4.1"))
+    return sse41_kernels;
+#endif
+
+  return scalar_kernels;
+}
+
+const KernelTable& kernels() noexcept
+{
+  static const KernelTable& table = select_kernels();
+  return table;
+}
+
+} // namespace anonymous
+
+void detail::batch_apply(OpCode code, const scalar_type* l, const scalar_type* r, scalar_type* out, std::size_t n) noexcept
+{
+  const KernelTable& k = kernels();
+
+  switch (code)
+  {
+  case OpCode::add:
+    return k.add(l, r, out, n);
+  case OpCode::sub:
+    return k.sub(l, r, out, n);
+  case OpCode::mul:
+    return k.mul(l, r, out, n);
+  case OpCode::div:
+    return k.div(l, r, out, n);
+  case OpCode::mod:
+    return k.mod(l, r, out, n);
+  case OpCode::div_nz:
+    return k.div_nz(l, r, out, n);
+  case OpCode::mod_nz:
+    return k.mod_nz(l, r, out, n);
+  case OpCode::div_narrow:
+    return k.div_narrow(l, r, out, n);
+  case OpCode::mod_narrow:
+    return k.mod_narrow(l, r, out, n);
+  case OpCode::div_pow2:
+    return unary_kernel(l, r, out, n, div_pow2);
+  case OpCode::mod_pow2:
+    return unary_kernel(l, r, out, n, mod_pow2);
+  case OpCode::div_magic:
+  case OpCode::mod_magic:
+  case OpCode::memo_load:
+  case OpCode::reg_store:
+    break;
+  }
+
+  assert(false && "Unreachable");
+}
+
+void detail::batch_apply_magic(OpCode code, const DivMagic& divisor, const scalar_type* l, scalar_type* out,
+                               std::size_t n) noexcept
+{
+  assert(code == OpCode::div_magic || code == OpCode::mod_magic);
+
+  if (code == OpCode::div_magic)
+  {
+    for (std::size_t i = 0; i < n; ++i)
+      out[i] = divisor.div(l[i]);
+  }
+  else
+  {
+    for (std::size_t i = 0; i < n; ++i)
+      out[i] = divisor.mod(l[i]);
+  }
+}
+
+const char* detail::batch_isa() noexcept
+{
+  return kernels().isa;
+}
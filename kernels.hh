@@ -0,0 +1,23 @@
+#pragma once
+
+#include "bytecode.hh"
+
+#include <cstddef>
+
+namespace glfdc::detail {
+
+// Lane-wise out[i] = l[i] op r[i] for i < n. out may alias l or r.
+// Division and modulo by zero yield 0 as in cfold(), except for div_nz and others which require
+// nonzero divisors.
+//
+// Uses AVX2 or SSE4.1 if supported by running CPU, scalar loop otherwise.
+void batch_apply(OpCode code, const scalar_type* l, const scalar_type* r, scalar_type* out, std::size_t n) noexcept;
+
+// Lane-wise division (div_magic) or modulo (mod_magic) of l[i] by constant divisor
+void batch_apply_magic(OpCode code, const DivMagic& divisor, const scalar_type* l, scalar_type* out,
+                       std::size_t n) noexcept;
+
+// Name of instruction set used by batch_apply() - "avx2", "sse4.1" or "scalar"
+const char* batch_isa() noexcept;
+
+} // namespace glfdc::detail
@@ -0,0 +1,422 @@
+#include "native.hh"
+
+#include "expr.hh"
+#include "sparse_map.hh"
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+extern char** environ;
+
+using namespace glfdc;
+
+namespace {
+
+constexpr std::uint64_t FNV_OFFSET = 14695981039346656037ull;
+constexpr std::uint64_t FNV_PRIME = 1099511628211ull;
+
+std::uint64_t fnv1a(const std::string& s, std::uint64_t h = FNV_OFFSET) noexcept
+{
+  for (unsigned char c : s)
+  {
+    h ^= c;
+    h *= FNV_PRIME;
+  }
+
+  return h;
+}
+
+// Exit status of command run without shell, output discarded. 127 (as of shell) if program
+// wasn't found, -1 if it couldn't be run otherwise.
+int run_command(const std::vector<std::string>& args)
+{
+  if (args.empty())
+    return 127;
+
+  std::vector<char*> argv;
+
+  for (const auto& arg : args)
+    argv.push_back(const_cast<char*>(arg.c_str()));
+
+  argv.push_back(nullptr);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+  posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+  pid_t pid;
+  const int err = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+
+  posix_spawn_file_actions_destroy(&actions);
+
+  if (err != 0)
+    return (err == ENOENT)? 127 : -1;
+
+  int status;
+
+  while (waitpid(pid, &status, 0) < 0)
+  {
+    if (errno != EINTR)
+      return -1;
+  }
+
+  return WIFEXITED(status)? WEXITSTATUS(status) : -1;
+}
+
+std::string c_scalar_type(bool is_unsigned)
+{
+  static_assert(std::numeric_limits<scalar_type>::is_signed, "");
+
+  return std::string(is_unsigned? "uint" : "int") + std::to_string(8 * sizeof(scalar_type)) + "_t";
+}
+
+// Operators with cfold() semantics, wrap around is made explicit by unsigned arithmetic
+std::string c_prelude()
+{
+  const std::string s = c_scalar_type(false);
+  const std::string u = c_scalar_type(true);
+
+  return
+    "#include <stdint.h>\n"
+    "\n"
+    "typedef " + s + " glfdc_scalar;\n"
+    "typedef " + u + " glfdc_uscalar;\n"
+    "\n"
+    "static inline glfdc_scalar glfdc_add(glfdc_scalar l, glfdc_scalar r) { return (glfdc_scalar)((glfdc_uscalar)l + (glfdc_uscalar)r); }\n"
+    "static inline glfdc_scalar glfdc_sub(glfdc_scalar l, glfdc_scalar r) { return (glfdc_scalar)((glfdc_uscalar)l - (glfdc_uscalar)r); }\n"
+    "static inline glfdc_scalar glfdc_mul(glfdc_scalar l, glfdc_scalar r) { return (glfdc_scalar)((glfdc_uscalar)l * (glfdc_uscalar)r); }\n"
+    "static inline glfdc_scalar glfdc_div(glfdc_scalar l, glfdc_scalar r) { return r == 0? 0 : l / r; }\n"
+    "static inline glfdc_scalar glfdc_mod(glfdc_scalar l, glfdc_scalar r) { return r == 0? 0 : l % r; }\n"
+    "\n";
+}
+
+const char* c_operator(OperatorKind op) noexcept
+{
+  switch (op)
+  {
+  case OperatorKind::add:
+    return "glfdc_add";
+  case OperatorKind::sub:
+    return "glfdc_sub";
+  case OperatorKind::mul:
+    return "glfdc_mul";
+  case OperatorKind::div:
+    return "glfdc_div";
+  case OperatorKind::mod:
+    return "glfdc_mod";
+  }
+
+  assert(false && "Unreachable");
+  return "";
+}
+
+// Definition of SOURCE_NAME holding code as C string literal - compiled into object, so cached object
+// is checked against code it was built from
+std::string c_source_symbol(const std::string& code)
+{
+  std::string ret = std::string("const char ") + NativeSource::SOURCE_NAME + "[] =\n  \"";
+
+  for (unsigned char c : code)
+  {
+    if (c == '\n')
+      ret += "\\n\"\n  \"";
+    else if (c == '"' || c == '\\')
+      ret += {'\\', char(c)};
+    else if (c >= 0x20 && c < 0x7f)
+      ret += char(c);
+    else
+    {
+      char octal[8];
+      std::snprintf(octal, sizeof(octal), "\\%03o", c);
+      ret += octal;
+    }
+  }
+
+  return ret + "\";\n";
+}
+
+// Object was built from code - O(n)
+bool has_source(void* handle, const std::string& code) noexcept
+{
+  const char* source = static_cast<const char*>(dlsym(handle, NativeSource::SOURCE_NAME));
+  return source && code == source;
+}
+
+struct CEmitter
+{
+  const ExprDAG& dag_;
+
+  std::pmr::vector<uintptr_t> bindings_;
+  std::pmr::vector<std::size_t> binding_ids_;
+  sparse_map binding_slots_; // UnboundValue index -> binding slot
+
+  sparse_map locals_; // node key -> local index
+  std::string body_;
+
+  std::size_t key(SExprRef ref) const noexcept
+  {
+    // Same key layout as ReusedExprMapping
+    return is_lref(ref)? std::get<LExprRef>(ref).index_
+                       : std::get<IExprRef>(ref).index_ + dag_.unbound_exprs_.size();
+  }
+
+  std::string operand(Operand op)
+  {
+    if (is_sexpr(op))
+      return "n" + std::to_string(locals_.find(key(std::get<SExprRef>(op))).value());
+
+    const Value val = std::get<Value>(op);
+
+    if (is_unbound_value(op))
+    {
+      const std::uint32_t slot = detail::assign_binding_slot(dag_, std::get<UnboundValue>(val), binding_slots_,
+                                                              bindings_, binding_ids_);
+      return "b[" + std::to_string(slot) + "]";
+    }
+
+    // Cast keeps minimal value from being parsed as negated out of range literal
+    const scalar_type c = std::get<scalar_type>(val);
+
+    if (c == std::numeric_limits<scalar_type>::min())
+      return "(glfdc_scalar)(" + std::to_string(c + 1) + " - 1)";
+
+    return "(glfdc_scalar)" + std::to_string(c);
+  }
+
+  // Postorder over distinct nodes - iterative, so deep chains don't exhaust native stack
+  void emit(SExprRef root)
+  {
+    struct Frame
+    {
+      SExprRef ref_;
+      bool expanded_;
+    };
+
+    std::vector<Frame> stack{{root, false}};
+
+    while (!stack.empty())
+    {
+      const Frame f = stack.back();
+      stack.pop_back();
+
+      if (locals_.has(key(f.ref_)))
+        continue;
+
+      const SExpr e = dag_.fetch(f.ref_);
+
+      if (!f.expanded_)
+      {
+        stack.push_back({f.ref_, true});
+
+        // rhs is pushed first, so lhs is emitted first
+        for (Operand op : {e.rhs_, e.lhs_})
+        {
+          if (is_sexpr(op) && !locals_.has(key(std::get<SExprRef>(op))))
+            stack.push_back({std::get<SExprRef>(op), false});
+        }
+
+        continue;
+      }
+
+      const std::size_t local = locals_.size();
+      const std::string lhs = operand(e.lhs_);
+      const std::string rhs = operand(e.rhs_);
+
+      body_ += "  const glfdc_scalar n" + std::to_string(local) + " = " + c_operator(e.op_) +
+               "(" + lhs + ", " + rhs + ");\n";
+
+      locals_.insert(key(f.ref_), local);
+    }
+  }
+};
+
+} // namespace anonymous
+
+NativeSource NativeSource::emit(const Expr& e)
+{
+  const ExprDAG& dag = e.dag_;
+
+  CEmitter emitter{dag, {}, {}, sparse_map(dag.unbound_values_.size()),
+                   sparse_map(dag.unbound_exprs_.size() + dag.internal_exprs_.size()), {}};
+  emitter.emit(e.subexpr_);
+
+  const std::size_t root = emitter.locals_.find(emitter.key(e.subexpr_)).value();
+
+  NativeSource ret;
+  ret.code_ = c_prelude() + "glfdc_scalar " + FUNCTION_NAME + "(const glfdc_scalar* b)\n{\n" +
+              emitter.body_ + "  return n" + std::to_string(root) + ";\n}\n";
+
+  ret.bindings_.assign(emitter.bindings_.begin(), emitter.bindings_.end());
+  ret.binding_ids_.assign(emitter.binding_ids_.begin(), emitter.binding_ids_.end());
+
+  // Bindings are referred to by slot only, so code is structural
+  ret.hash_ = fnv1a(ret.code_);
+
+  return ret;
+}
+
+scalar_type NativeEvaluator::evaluate(EvalState& es, const scalar_type* binding_values) const
+{
+  if (!fn_)
+    return fallback_->evaluate(es, binding_values);
+
+  scalar_type* slot_values = es.scratch(binding_ids_.size());
+
+  for (std::size_t i=0; i<binding_ids_.size(); ++i)
+    slot_values[i] = binding_values[binding_ids_[i]];
+
+  return fn_(slot_values);
+}
+
+NativeCompiler::NativeCompiler(std::string cache_dir, std::string compiler)
+  : cache_dir_(std::move(cache_dir)), compiler_(std::move(compiler))
+{
+}
+
+std::string NativeCompiler::default_compiler()
+{
+  const char* cc = std::getenv("CC");
+  return (cc && *cc)? cc : "cc";
+}
+
+NativeEvaluator NativeCompiler::load(const Expr& e)
+{
+  NativeSource src = NativeSource::emit(e);
+
+  NativeEvaluator ret;
+  ret.hash_ = src.hash_;
+
+  // Same expression built by different compiler is different object
+  const std::uint64_t key = fnv1a(compiler_, src.hash_);
+
+  if (auto library = open_library(src, key))
+  {
+    ret.fn_ = reinterpret_cast<native_fn_t>(dlsym(library.get(), NativeSource::FUNCTION_NAME));
+
+    if (ret.fn_)
+    {
+      ret.library_ = std::move(library);
+      ret.bindings_ = std::move(src.bindings_);
+      ret.binding_ids_ = std::move(src.binding_ids_);
+
+      return ret;
+    }
+  }
+
+  ret.fallback_ = std::make_unique<ExprEvaluator>(e);
+  return ret;
+}
+
+std::shared_ptr<void> NativeCompiler::open_library(const NativeSource& src, std::uint64_t key)
+{
+  // Cached object is used only if it was built from the same code. On hash collision, or stale or
+  // foreign file, next name of the key is tried.
+  for (unsigned attempt = 0; attempt < MAX_NAME_ATTEMPTS; ++attempt)
+  {
+    char name[48];
+    std::snprintf(name, sizeof(name), "glfdc_%016llx_%u.so", static_cast<unsigned long long>(key), attempt);
+
+    const std::string path = cache_dir_ + "/" + name;
+
+    if (auto it = libraries_.find(path); it != libraries_.end())
+    {
+      if (has_source(it->second.get(), src.code_))
+        return it->second;
+
+      continue;
+    }
+
+    std::error_code ec;
+
+    if (!std::filesystem::exists(path, ec))
+    {
+      if (!available_ || !build(src, path))
+        return nullptr;
+
+      ++compiled_;
+    }
+
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+    if (!handle)
+      return nullptr;
+
+    std::shared_ptr<void> library(handle, [](void* h) { dlclose(h); });
+    libraries_.emplace(path, library);
+
+    if (has_source(handle, src.code_))
+      return library;
+  }
+
+  return nullptr;
+}
+
+bool NativeCompiler::build(const NativeSource& src, const std::string& path)
+{
+  std::error_code ec;
+  std::filesystem::create_directories(cache_dir_, ec);
+
+  // Private names derived from unique file reserved by mkstemp, so concurrent builds of the same
+  // object - by other processes or threads - don't clash
+  std::string base = path + ".XXXXXX";
+  const int fd = mkstemp(base.data());
+
+  if (fd < 0)
+    return false;
+
+  close(fd);
+
+  const std::string tmp = base + ".so";
+  const std::string c_path = base + ".c";
+
+  {
+    std::ofstream out(c_path);
+    out << src.code_ << "\n" << c_source_symbol(src.code_);
+
+    if (!out)
+    {
+      std::filesystem::remove(c_path, ec);
+      std::filesystem::remove(base, ec);
+      return false;
+    }
+  }
+
+  // Compiler prefix is split on white space, paths are passed as they are
+  std::vector<std::string> args;
+  std::istringstream words(compiler_);
+
+  for (std::string word; words >> word;)
+    args.push_back(word);
+
+  args.insert(args.end(), {"-O2", "-shared", "-fPIC", "-o", tmp, c_path});
+
+  const int status = run_command(args);
+
+  std::filesystem::remove(c_path, ec);
+  std::filesystem::remove(base, ec);
+
+  if (status != 0)
+  {
+    // Missing compiler - don't pay for spawning it again. Failed compile is retried by next load.
+    if (status == 127)
+      available_ = false;
+
+    std::filesystem::remove(tmp, ec);
+    return false;
+  }
+
+  std::filesystem::rename(tmp, path, ec);
+  return !ec;
+}
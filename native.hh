@@ -0,0 +1,151 @@
+#pragma once
+
+#include "bytecode.hh"
+#include "eval.hh"
+#include "sexpr.hh"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace glfdc {
+
+struct Expr;
+
+// Straight-line C translation of expression.
+//
+// Every distinct DAG node gets single local, constants are inlined and bindings are read
+// from array indexed by binding slot:
+//
+//   int32_t glfdc_eval(const int32_t* b)
+//   {
+//     const int32_t n0 = glfdc_mul(b[0], b[1]);
+//     const int32_t n1 = glfdc_div(n0, 7);
+//     return n1;
+//   }
+//
+// Operators have the same semantics as cfold(), additions and multiplications wrap around.
+struct NativeSource
+{
+  std::string code_;
+
+  std::vector<uintptr_t> bindings_;      // binding cookie of each binding slot
+  std::vector<std::size_t> binding_ids_; // UnboundValue index of each binding slot
+
+  // Structural hash - equal for expressions of the same shape, constants and binding slots
+  std::uint64_t hash_;
+
+  static NativeSource emit(const Expr& e); // O(n) - n is number of distinct DAG nodes
+
+  static constexpr const char* FUNCTION_NAME = "glfdc_eval";
+  // Code itself as C string, defined next to it in compiled object
+  static constexpr const char* SOURCE_NAME = "glfdc_source";
+};
+
+using native_fn_t = scalar_type (*)(const scalar_type* binding_slots);
+
+// Evaluator running expression compiled into shared object by NativeCompiler,
+// or bytecode interpreter if native code couldn't be built.
+//
+// NB: NativeEvaluator should not outlive Expr it was loaded from
+class NativeEvaluator
+{
+public:
+  // Same semantics as ExprEvaluator::evaluate(), binding_fn is called once per distinct binding.
+  // EvalState is only used for scratch - any mapping can be used.
+  template <typename BindFn_, enable_if_binding_fn_t<BindFn_> = 0>
+  scalar_type evaluate(EvalState& es, BindFn_&& binding_fn) const
+  {
+    if (!fn_)
+      return fallback_->evaluate(es, binding_fn);
+
+    scalar_type* slot_values = es.scratch(bindings_.size());
+
+    for (std::size_t i=0; i<bindings_.size(); ++i)
+      slot_values[i] = binding_fn(bindings_[i]);
+
+    return fn_(slot_values);
+  }
+
+  // binding_values are indexed by UnboundValue::index_
+  scalar_type evaluate(EvalState& es, const scalar_type* binding_values) const;
+
+  bool is_native() const noexcept
+  {
+    return fn_ != nullptr;
+  }
+
+  std::uint64_t hash() const noexcept
+  {
+    return hash_;
+  }
+
+private:
+  friend class NativeCompiler;
+
+  NativeEvaluator() = default;
+
+  std::shared_ptr<void> library_; // keeps shared object loaded
+  native_fn_t fn_ = nullptr;
+
+  std::vector<uintptr_t> bindings_;
+  std::vector<std::size_t> binding_ids_;
+  std::uint64_t hash_ = 0;
+
+  std::unique_ptr<ExprEvaluator> fallback_;
+};
+
+// Compiles expressions with system C compiler into shared objects cached on disk.
+//
+// Shared object of expression is named by its structural hash, so it is built only once
+// and reused by later runs. Object embeds code it was built from, which is compared before
+// cached object is used - on mismatch (hash collision, stale or foreign file) next name is tried.
+// Concurrent processes may share cache directory - objects are published by atomic rename.
+//
+// If compiler is not available, load() falls back to interpreted evaluation.
+class NativeCompiler
+{
+public:
+  // compiler is command line prefix split on white space, e.g. "ccache cc" - run without shell
+  explicit NativeCompiler(std::string cache_dir, std::string compiler = default_compiler());
+
+  NativeEvaluator load(const Expr& e);
+
+  // false once compiler wasn't found - all following loads are interpreted
+  bool is_available() const noexcept
+  {
+    return available_;
+  }
+
+  // Number of shared objects built by this compiler, cache hits excluded
+  std::size_t compiled_count() const noexcept
+  {
+    return compiled_;
+  }
+
+  const std::string& cache_dir() const noexcept
+  {
+    return cache_dir_;
+  }
+
+  // $CC or cc
+  static std::string default_compiler();
+
+private:
+  std::shared_ptr<void> open_library(const NativeSource& src, std::uint64_t key);
+  bool build(const NativeSource& src, const std::string& path);
+
+  std::string cache_dir_;
+  std::string compiler_;
+
+  static constexpr unsigned MAX_NAME_ATTEMPTS = 4;
+
+  std::unordered_map<std::string, std::shared_ptr<void>> libraries_; // loaded objects by path
+
+  std::size_t compiled_ = 0;
+  bool available_ = true;
+};
+
+} // namespace glfdc
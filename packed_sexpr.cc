@@ -0,0 +1 @@
+#include "packed_sexpr.hh"
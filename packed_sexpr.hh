@@ -0,0 +1,131 @@
+#pragma once
+
+#include "sexpr.hh"
+#include "sexpr_cmp.hh"
+
+#include <cassert>
+#include <cstdint>
+#include <limits>
+
+namespace glfdc {
+
+// Compact storage form of SExpr used by ExprDAG: operator, 2b kind tag per operand
+// and 32b payload per operand (scalar immediate, UnboundValue index or subexpression index).
+//
+// NB: Kinds are encoded in the same order as detail::node_kind()
+struct PackedSExpr
+{
+  enum Kind : std::uint8_t
+  {
+    scalar = 0,
+    unbound = 1,
+    lexpr = 2,
+    iexpr = 3,
+  };
+
+  std::uint32_t lhs_;
+  std::uint32_t rhs_;
+
+  OperatorKind op_;
+  std::uint8_t tags_; // lhs kind in bits 0-1, rhs kind in bits 2-3
+
+  Kind lhs_kind() const noexcept
+  {
+    return Kind(tags_ & 0x3u);
+  }
+
+  Kind rhs_kind() const noexcept
+  {
+    return Kind((tags_ >> 2) & 0x3u);
+  }
+
+  bool is_unbound() const noexcept
+  {
+    return lhs_kind() == unbound || rhs_kind() == unbound;
+  }
+
+  bool operator==(const PackedSExpr& other) const noexcept
+  {
+    return lhs_ == other.lhs_ && rhs_ == other.rhs_ && op_ == other.op_ && tags_ == other.tags_;
+  }
+
+  bool operator!=(const PackedSExpr& other) const noexcept
+  {
+    return !(*this == other);
+  }
+
+  static PackedSExpr pack(const SExpr& e) noexcept
+  {
+    const auto l = pack_operand(e.lhs_);
+    const auto r = pack_operand(e.rhs_);
+
+    return PackedSExpr{l.second, r.second, e.op_, std::uint8_t(l.first | (r.first << 2))};
+  }
+
+  SExpr unpack() const noexcept
+  {
+    SExpr e;
+
+    e.lhs_ = unpack_operand(lhs_kind(), lhs_);
+    e.rhs_ = unpack_operand(rhs_kind(), rhs_);
+    e.op_ = op_;
+
+    return e;
+  }
+
+private:
+  static std::pair<unsigned, std::uint32_t> pack_operand(Operand op) noexcept
+  {
+    assert(!std::holds_alternative<std::monostate>(op) && "Empty operand");
+
+    const auto [kind, value] = detail::svalue(op);
+
+    if (kind == scalar)
+      return std::make_pair(kind, detail::bitcast<std::uint32_t>(std::get<scalar_type>(std::get<Value>(op))));
+
+    assert(value <= std::numeric_limits<std::uint32_t>::max() && "Index doesn't fit packed node");
+    return std::make_pair(kind, std::uint32_t(value));
+  }
+
+  static Operand unpack_operand(Kind kind, std::uint32_t payload) noexcept
+  {
+    switch (kind)
+    {
+    case scalar:
+      return Value(detail::bitcast<scalar_type>(payload));
+    case unbound:
+      return Value(UnboundValue{payload});
+    case lexpr:
+      return SExprRef(LExprRef{payload});
+    case iexpr:
+      return SExprRef(IExprRef{payload});
+    }
+
+    assert(false && "Unreachable");
+    return Operand{};
+  }
+};
+
+static_assert(sizeof(scalar_type) <= sizeof(std::uint32_t), "Scalar must fit packed payload");
+static_assert(sizeof(PackedSExpr) == 12, "Packed node should stay 12 bytes");
+
+struct packed_sexpr_hash
+{
+  std::size_t operator() (const PackedSExpr& e) const noexcept
+  {
+    // Two 64b words mixed by multiply-xorshift (as in splitmix64 finalizer)
+    auto mix = [](std::uint64_t x) {
+      x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ull;
+      x ^= x >> 27; x *= 0x94d049bb133111ebull;
+      x ^= x >> 31;
+      return x;
+    };
+
+    const std::uint64_t operands = (std::uint64_t(e.lhs_) << 32) | e.rhs_;
+    const std::uint64_t header = (std::uint64_t(std::uint8_t(e.op_)) << 8) | e.tags_;
+
+    return std::size_t(mix(operands ^ mix(header)));
+  }
+};
+
+} // namespace glfdc
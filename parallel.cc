@@ -0,0 +1,196 @@
+#include "parallel.hh"
+
+#include <algorithm>
+#include <functional>
+
+using namespace glfdc;
+
+EvalStatePool::EvalStatePool(const ReusedExprMapping& mapping, std::size_t capacity)
+  : mapping_(mapping), capacity_(std::max<std::size_t>(capacity, 1)),
+    busy_(new std::atomic<bool>[capacity_]), arena_(capacity_ * EvalState::memo_size(mapping))
+{
+  // Never reallocated - leases point into states_
+  states_.reserve(capacity_);
+
+  for (std::size_t i=0; i<capacity_; ++i)
+  {
+    busy_[i].store(false, std::memory_order_relaxed);
+    states_.emplace_back(mapping_, &arena_);
+  }
+}
+
+EvalStatePool::Lease EvalStatePool::acquire()
+{
+  // Threads start probing at different slots, so they rarely contend
+  const std::size_t start = std::hash<std::thread::id>{}(std::this_thread::get_id()) % capacity_;
+
+  for (std::size_t i=0; i<capacity_; ++i)
+  {
+    const std::size_t slot = (start + i) % capacity_;
+    bool expected = false;
+
+    if (!busy_[slot].load(std::memory_order_relaxed) &&
+        busy_[slot].compare_exchange_strong(expected, true, std::memory_order_acquire))
+    {
+      EvalState* state = &states_[slot];
+      state->clear();
+
+      return Lease(this, slot, state, nullptr);
+    }
+  }
+
+  auto owned = std::make_unique<EvalState>(mapping_);
+  EvalState* state = owned.get();
+
+  return Lease(this, 0, state, std::move(owned));
+}
+
+EvalState& ParallelEvaluator::Worker::state_for(const ReusedExprMapping& mapping)
+{
+  // Jobs mostly use just few mappings
+  for (auto& [m, state] : states_)
+  {
+    if (m == &mapping)
+      return *state;
+  }
+
+  states_.emplace_back(&mapping, std::make_unique<EvalState>(mapping));
+  return *states_.back().second;
+}
+
+ParallelEvaluator::ParallelEvaluator(std::size_t nthreads)
+{
+  nthreads = std::max<std::size_t>(nthreads, 1);
+
+  for (std::size_t i=0; i<nthreads; ++i)
+    workers_.push_back(std::make_unique<Worker>());
+
+  // Worker 0 is calling thread
+  for (std::size_t i=1; i<nthreads; ++i)
+    threads_.emplace_back([this, i] { worker_loop(i); });
+}
+
+ParallelEvaluator::~ParallelEvaluator()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+
+  start_cv_.notify_all();
+
+  for (auto& t : threads_)
+    t.join();
+}
+
+void ParallelEvaluator::evaluate(const EvalJob* jobs, std::size_t njobs, scalar_type* results)
+{
+  const std::size_t nworkers = workers_.size();
+
+  for (std::size_t i=0; i<nworkers; ++i)
+  {
+    workers_[i]->next_.store(njobs * i / nworkers, std::memory_order_relaxed);
+    workers_[i]->end_ = njobs * (i + 1) / nworkers;
+    workers_[i]->evaluated_ = 0;
+  }
+
+  // Too small batch is not worth waking up threads
+  if (njobs <= CHUNK || nworkers == 1)
+  {
+    jobs_ = jobs;
+    results_ = results;
+
+    run(0);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    jobs_ = jobs;
+    results_ = results;
+    running_ = nworkers - 1;
+    ++generation_;
+  }
+
+  start_cv_.notify_all();
+  run(0);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this] { return running_ == 0; });
+}
+
+std::vector<std::size_t> ParallelEvaluator::jobs_per_thread() const
+{
+  std::vector<std::size_t> ret;
+
+  for (const auto& w : workers_)
+    ret.push_back(w->evaluated_);
+
+  return ret;
+}
+
+void ParallelEvaluator::run(std::size_t worker)
+{
+  Worker& self = *workers_[worker];
+  const std::size_t nworkers = workers_.size();
+
+  // Own range first, then steal from the others
+  for (std::size_t k=0; k<nworkers; ++k)
+  {
+    Worker& victim = *workers_[(worker + k) % nworkers];
+
+    while (true)
+    {
+      const std::size_t begin = victim.next_.fetch_add(CHUNK, std::memory_order_relaxed);
+
+      if (begin >= victim.end_)
+        break;
+
+      const std::size_t end = std::min(begin + CHUNK, victim.end_);
+
+      for (std::size_t i=begin; i<end; ++i)
+      {
+        const ExprEvaluator& eval = *jobs_[i].evaluator_;
+        EvalState& es = self.state_for(eval.mapping());
+
+        if (eval.bytecode().is_memoized())
+          es.clear();
+
+        results_[i] = eval.evaluate(es, jobs_[i].binding_values_);
+      }
+
+      self.evaluated_ += end - begin;
+    }
+  }
+}
+
+void ParallelEvaluator::worker_loop(std::size_t worker)
+{
+  std::size_t seen = 0;
+
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_cv_.wait(lock, [&] { return stop_ || generation_ != seen; });
+
+      if (stop_)
+        return;
+
+      seen = generation_;
+    }
+
+    run(worker);
+
+    bool last;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      last = (--running_ == 0);
+    }
+
+    if (last)
+      done_cv_.notify_one();
+  }
+}
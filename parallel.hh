@@ -0,0 +1,170 @@
+#pragma once
+
+#include "eval.hh"
+#include "sexpr.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace glfdc {
+
+// Concurrency contract:
+//
+// - ExprDAG, Bytecode, ExprEvaluator and ReusedExprMapping are immutable once constructed,
+//   all their const member functions may be called from any number of threads at once.
+// - ExpressionBuilder is single threaded - DAG must not be extended while it is being evaluated.
+// - EvalState is memo and scratch of single evaluation - it must not be shared by threads running
+//   at the same time. EvalStatePool hands out states to threads without locking.
+
+// Lock-free pool of EvalStates of single mapping.
+//
+// Memo of all pooled states is allocated from single contiguous arena. States are kept between
+// acquisitions, so their scratch stops growing after warm-up.
+// If all pooled states are in use, acquire() creates a temporary one instead of waiting.
+class EvalStatePool
+{
+public:
+  class Lease
+  {
+  public:
+    Lease(Lease&& other) noexcept : pool_(other.pool_), slot_(other.slot_), state_(other.state_), owned_(std::move(other.owned_))
+    {
+      other.pool_ = nullptr;
+    }
+
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+    Lease& operator=(Lease&&) = delete;
+
+    ~Lease()
+    {
+      if (pool_ && !owned_)
+        pool_->release(slot_);
+    }
+
+    EvalState& state() const noexcept
+    {
+      return *state_;
+    }
+
+  private:
+    friend class EvalStatePool;
+
+    Lease(EvalStatePool* pool, std::size_t slot, EvalState* state, std::unique_ptr<EvalState> owned) noexcept
+      : pool_(pool), slot_(slot), state_(state), owned_(std::move(owned))
+    {
+    }
+
+    EvalStatePool* pool_;
+    std::size_t slot_;
+    EvalState* state_;
+    std::unique_ptr<EvalState> owned_; // overflow state, not returned to pool
+  };
+
+  EvalStatePool(const ReusedExprMapping& mapping, std::size_t capacity = std::thread::hardware_concurrency());
+
+  // Memo of returned state is cleared. Lock-free, O(capacity) worst case.
+  Lease acquire();
+
+  std::size_t capacity() const noexcept
+  {
+    return capacity_;
+  }
+
+  const ReusedExprMapping& mapping() const noexcept
+  {
+    return mapping_;
+  }
+
+private:
+  void release(std::size_t slot) noexcept
+  {
+    busy_[slot].store(false, std::memory_order_release);
+  }
+
+  const ReusedExprMapping& mapping_;
+  const std::size_t capacity_;
+
+  std::unique_ptr<std::atomic<bool>[]> busy_;
+
+  std::pmr::monotonic_buffer_resource arena_; // memo of pooled states
+  std::vector<EvalState> states_;
+};
+
+// Single evaluation of batch
+struct EvalJob
+{
+  const ExprEvaluator* evaluator_;
+  const scalar_type* binding_values_; // indexed by UnboundValue::index_
+};
+
+// Evaluates batches of jobs on fixed set of worker threads.
+//
+// Batch is split into equal contiguous ranges, one per worker. Worker claims chunks of its own range
+// and once it runs out, steals chunks from ranges of other workers, so uneven jobs are still spread
+// over all threads. Calling thread works on batch as well.
+//
+// Each worker keeps its own EvalState per mapping - evaluation itself takes no locks.
+// NB: evaluate() must not be called concurrently on the same ParallelEvaluator.
+class ParallelEvaluator
+{
+public:
+  // nthreads includes calling thread
+  explicit ParallelEvaluator(std::size_t nthreads = std::thread::hardware_concurrency());
+  ~ParallelEvaluator();
+
+  ParallelEvaluator(const ParallelEvaluator&) = delete;
+  ParallelEvaluator& operator=(const ParallelEvaluator&) = delete;
+
+  // results[i] is value of jobs[i], the same as jobs[i].evaluator_->evaluate() with fresh EvalState
+  void evaluate(const EvalJob* jobs, std::size_t njobs, scalar_type* results);
+
+  std::size_t thread_count() const noexcept
+  {
+    return workers_.size();
+  }
+
+  // Jobs each worker evaluated in last batch, stolen ones included
+  std::vector<std::size_t> jobs_per_thread() const;
+
+  // Jobs worker claims at once
+  static constexpr std::size_t CHUNK = 16;
+
+private:
+  struct alignas(64) Worker
+  {
+    std::atomic<std::size_t> next_{0}; // next unclaimed job of range
+    std::size_t end_ = 0;
+    std::size_t evaluated_ = 0;
+
+    // EvalState of each mapping seen by worker
+    std::vector<std::pair<const ReusedExprMapping*, std::unique_ptr<EvalState>>> states_;
+
+    EvalState& state_for(const ReusedExprMapping& mapping);
+  };
+
+  void run(std::size_t worker);
+  void worker_loop(std::size_t worker);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+
+  // Current batch
+  const EvalJob* jobs_ = nullptr;
+  scalar_type* results_ = nullptr;
+
+  std::mutex mutex_;
+  std::condition_variable start_cv_;
+  std::condition_variable done_cv_;
+  std::size_t generation_ = 0;
+  std::size_t running_ = 0;
+  bool stop_ = false;
+};
+
+} // namespace glfdc
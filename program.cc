@@ -0,0 +1,348 @@
+#include "program.hh"
+
+#include "eval.hh"
+
+#include <algorithm>
+#include <numeric>
+
+using namespace glfdc;
+
+namespace {
+
+struct ProgramEmitter
+{
+  const ExprDAG& dag_;
+
+  std::pmr::vector<Instruction>& code_;
+  std::pmr::vector<uintptr_t>& bindings_;
+  std::pmr::vector<std::size_t>& binding_ids_;
+
+  sparse_map binding_slots_; // UnboundValue index -> binding slot
+  sparse_map registers_;     // node id -> register
+
+  ArgKind emit_operand(Operand op, InstrArg& arg)
+  {
+    if (is_sexpr(op))
+    {
+      // Operands are emitted before their users
+      arg.slot_ = std::uint32_t(registers_.find(dag_.node_id(std::get<SExprRef>(op))).value());
+      return ArgKind::reg;
+    }
+
+    const auto val = std::get<Value>(op);
+
+    if (!is_unbound_value(op))
+    {
+      arg.imm_ = std::get<scalar_type>(val);
+      return ArgKind::imm;
+    }
+
+    arg.slot_ = detail::assign_binding_slot(dag_, std::get<UnboundValue>(val), binding_slots_,
+                                            bindings_, binding_ids_);
+    return ArgKind::binding;
+  }
+
+  // Postorder DFS visiting each node once - returns register of root value.
+  // Iterative, so deep chains don't exhaust native stack
+  std::uint32_t emit(SExprRef root)
+  {
+    struct Frame
+    {
+      SExprRef ref_;
+      bool expanded_;
+    };
+
+    std::vector<Frame> stack{{root, false}};
+
+    while (!stack.empty())
+    {
+      const Frame f = stack.back();
+      stack.pop_back();
+
+      if (registers_.has(dag_.node_id(f.ref_)))
+        continue;
+
+      const SExpr e = dag_.fetch(f.ref_);
+
+      if (!f.expanded_)
+      {
+        stack.push_back({f.ref_, true});
+
+        // rhs is pushed first, so lhs is emitted first
+        for (Operand op : {e.rhs_, e.lhs_})
+        {
+          if (is_sexpr(op) && !registers_.has(dag_.node_id(std::get<SExprRef>(op))))
+            stack.push_back({std::get<SExprRef>(op), false});
+        }
+
+        continue;
+      }
+
+      Instruction instr{detail::opcode_of(e.op_), ArgKind::imm, ArgKind::imm, Instruction::NO_SLOT, {0}, {0}};
+
+      instr.lhs_kind_ = emit_operand(e.lhs_, instr.lhs_);
+      instr.rhs_kind_ = emit_operand(e.rhs_, instr.rhs_);
+
+      registers_.insert(dag_.node_id(f.ref_), code_.size());
+      code_.push_back(instr);
+    }
+
+    return std::uint32_t(registers_.find(dag_.node_id(root)).value());
+  }
+};
+
+inline scalar_type load_arg(ArgKind kind, InstrArg arg, const scalar_type* bindings,
+                            const scalar_type* registers) noexcept
+{
+  switch (kind)
+  {
+  case ArgKind::imm:
+    return arg.imm_;
+  case ArgKind::binding:
+    return bindings[arg.slot_];
+  case ArgKind::reg:
+    return registers[arg.slot_];
+  case ArgKind::stack:
+    break;
+  }
+
+  assert(false && "Unreachable");
+  return 0;
+}
+
+const ExprDAG& dag_of(const std::vector<Expr>& roots) noexcept
+{
+  assert(!roots.empty() && "Program needs at least one root");
+  return roots.front().dag_;
+}
+
+} // namespace anonymous
+
+ExprProgram::ExprProgram(const std::vector<Expr>& roots, std::pmr::memory_resource* mr) // O(n) - n unique nodes
+  : dag_(dag_of(roots)), code_(mr), bindings_(mr), binding_ids_(mr)
+{
+  ProgramEmitter emitter{dag_, code_, bindings_, binding_ids_,
+                         sparse_map(dag_.unbound_values_.size()), sparse_map(dag_.node_count())};
+
+  root_regs_.reserve(roots.size());
+
+  for (const Expr& e : roots)
+  {
+    assert(&e.dag_ == &dag_ && "All roots must share ExprDAG");
+    root_regs_.push_back(emitter.emit(e.subexpr_));
+  }
+
+  binding_slots_ = std::move(emitter.binding_slots_);
+
+  build_users();
+}
+
+void ExprProgram::build_users() // O(n)
+{
+  // Counting sort of (operand, user) edges by operand
+  users_offsets_.assign(code_.size() + 1, 0);
+  binding_users_offsets_.assign(bindings_.size() + 1, 0);
+
+  auto for_each_edge = [this](auto fn) {
+    for (std::size_t i = 0; i < code_.size(); ++i)
+    {
+      const Instruction& instr = code_[i];
+
+      fn(instr.lhs_kind_, instr.lhs_, std::uint32_t(i));
+
+      // x op x uses x only once
+      if (instr.lhs_kind_ != instr.rhs_kind_ || instr.lhs_.slot_ != instr.rhs_.slot_)
+        fn(instr.rhs_kind_, instr.rhs_, std::uint32_t(i));
+    }
+  };
+
+  for_each_edge([this](ArgKind kind, InstrArg arg, std::uint32_t) {
+    if (kind == ArgKind::reg)
+      ++users_offsets_[arg.slot_ + 1];
+    else if (kind == ArgKind::binding)
+      ++binding_users_offsets_[arg.slot_ + 1];
+  });
+
+  std::partial_sum(users_offsets_.begin(), users_offsets_.end(), users_offsets_.begin());
+  std::partial_sum(binding_users_offsets_.begin(), binding_users_offsets_.end(), binding_users_offsets_.begin());
+
+  users_.resize(users_offsets_.back());
+  binding_users_.resize(binding_users_offsets_.back());
+
+  std::vector<std::uint32_t> users_pos(users_offsets_.begin(), users_offsets_.end() - 1);
+  std::vector<std::uint32_t> binding_users_pos(binding_users_offsets_.begin(), binding_users_offsets_.end() - 1);
+
+  for_each_edge([&](ArgKind kind, InstrArg arg, std::uint32_t user) {
+    if (kind == ArgKind::reg)
+      users_[users_pos[arg.slot_]++] = user;
+    else if (kind == ArgKind::binding)
+      binding_users_[binding_users_pos[arg.slot_]++] = user;
+  });
+}
+
+void ExprProgram::execute(const scalar_type* binding_values, scalar_type* registers) const noexcept
+{
+  const Instruction* code = code_.data();
+  const std::size_t ninstr = code_.size();
+
+  for (std::size_t i = 0; i < ninstr; ++i)
+  {
+    const Instruction& instr = code[i];
+
+    const scalar_type lval = load_arg(instr.lhs_kind_, instr.lhs_, binding_values, registers);
+    const scalar_type rval = load_arg(instr.rhs_kind_, instr.rhs_, binding_values, registers);
+
+    registers[i] = detail::apply_op(instr.code_, lval, rval);
+  }
+}
+
+void ExprProgram::execute_roots(const scalar_type* binding_values, scalar_type* registers,
+                                scalar_type* results) const noexcept
+{
+  execute(binding_values, registers);
+
+  for (std::size_t i=0; i<root_regs_.size(); ++i)
+    results[i] = registers[root_regs_[i]];
+}
+
+void ExprProgram::evaluate(EvalState& es, const scalar_type* binding_values, scalar_type* results) const
+{
+  scalar_type* slot_values = es.scratch(scratch_size());
+
+  for (std::size_t i=0; i<binding_ids_.size(); ++i)
+    slot_values[i] = binding_values[binding_ids_[i]];
+
+  execute_roots(slot_values, slot_values + binding_ids_.size(), results);
+}
+
+IncrementalState::IncrementalState(const ExprProgram& program)
+  : program_(program),
+    binding_values_(program.bindings().size()),
+    registers_(program.node_count()),
+    dirty_(program.node_count()),
+    changed_(program.node_count())
+{
+}
+
+void IncrementalState::mark_dirty(std::uint32_t reg)
+{
+  if (dirty_[reg])
+    return;
+
+  dirty_[reg] = true;
+  worklist_.push_back(reg);
+  std::push_heap(worklist_.begin(), worklist_.end(), std::greater<std::uint32_t>());
+}
+
+void IncrementalState::set_binding(UnboundValue ubv, scalar_type value)
+{
+  assert(initialized_ && "Not evaluated yet");
+
+  const auto opt_slot = program_.binding_slots_.find(ubv.index_);
+
+  // Not used by program
+  if (opt_slot.has_value())
+    set_binding_slot(opt_slot.value(), value);
+}
+
+void IncrementalState::set_binding_slot(std::size_t slot, scalar_type value)
+{
+  assert(slot < binding_values_.size());
+
+  if (initialized_ && binding_values_[slot] == value)
+    return;
+
+  binding_values_[slot] = value;
+
+  // First evaluation recomputes everything anyway
+  if (!initialized_)
+    return;
+
+  for (auto i = program_.binding_users_offsets_[slot]; i < program_.binding_users_offsets_[slot + 1]; ++i)
+    mark_dirty(program_.binding_users_[i]);
+}
+
+void ExprProgram::evaluate_incremental(IncrementalState& st, const scalar_type* binding_values,
+                                       scalar_type* results) const
+{
+  for (std::size_t i=0; i<binding_ids_.size(); ++i)
+    st.set_binding_slot(i, binding_values[binding_ids_[i]]);
+
+  propagate(st, results);
+}
+
+void ExprProgram::update(IncrementalState& st, scalar_type* results) const
+{
+  assert(&st.program_ == this);
+  assert(st.initialized_ && "Not evaluated yet");
+
+  propagate(st, results);
+}
+
+void ExprProgram::propagate(IncrementalState& st, scalar_type* results) const // O(k log k) - k dirty nodes
+{
+  assert(&st.program_ == this);
+
+  const scalar_type* binding_values = st.binding_values_.data();
+  scalar_type* registers = st.registers_.data();
+
+  if (!st.initialized_)
+  {
+    execute_roots(binding_values, registers, results);
+
+    st.initialized_ = true;
+    st.recomputed_ = code_.size();
+
+    st.changed_roots_.resize(root_regs_.size());
+    std::iota(st.changed_roots_.begin(), st.changed_roots_.end(), std::size_t(0));
+
+    return;
+  }
+
+  st.recomputed_ = 0;
+
+  // Dependents are always later in topological order, so popping smallest register first
+  // recomputes each dirty node once, after all its operands.
+  while (!st.worklist_.empty())
+  {
+    std::pop_heap(st.worklist_.begin(), st.worklist_.end(), std::greater<std::uint32_t>());
+    const std::uint32_t reg = st.worklist_.back();
+    st.worklist_.pop_back();
+
+    st.dirty_[reg] = false;
+    ++st.recomputed_;
+
+    const Instruction& instr = code_[reg];
+
+    const scalar_type lval = load_arg(instr.lhs_kind_, instr.lhs_, binding_values, registers);
+    const scalar_type rval = load_arg(instr.rhs_kind_, instr.rhs_, binding_values, registers);
+    const scalar_type result = detail::apply_op(instr.code_, lval, rval);
+
+    // Value didn't change - dependents stay valid
+    if (result == registers[reg])
+      continue;
+
+    registers[reg] = result;
+
+    st.changed_[reg] = true;
+    st.changed_regs_.push_back(reg);
+
+    for (auto i = users_offsets_[reg]; i < users_offsets_[reg + 1]; ++i)
+      st.mark_dirty(users_[i]);
+  }
+
+  st.changed_roots_.clear();
+
+  for (std::size_t i=0; i<root_regs_.size(); ++i)
+  {
+    if (st.changed_[root_regs_[i]])
+      st.changed_roots_.push_back(i);
+
+    results[i] = registers[root_regs_[i]];
+  }
+
+  for (auto reg : st.changed_regs_)
+    st.changed_[reg] = false;
+
+  st.changed_regs_.clear();
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+#include "bitvector.hh"
+#include "bytecode.hh"
+#include "eval.hh"
+#include "expr.hh"
+#include "result_cache.hh"
+#include "sparse_map.hh"
+
+#include <algorithm>
+#include <memory_resource>
+#include <vector>
+
+namespace glfdc {
+
+class ExprProgram;
+
+// Node values of ExprProgram kept between evaluations.
+//
+// Same idea as EvalState memo, but values are kept across calls instead of being cleared,
+// only nodes depending on changed bindings are recomputed.
+class IncrementalState
+{
+public:
+  explicit IncrementalState(const ExprProgram& program);
+
+  // Updates binding value used by next ExprProgram::update(), no-op if value didn't change
+  void set_binding(UnboundValue ubv, scalar_type value);
+
+  // Indices of roots whose value changed during last evaluation
+  const std::vector<std::size_t>& changed_roots() const noexcept
+  {
+    return changed_roots_;
+  }
+
+  // Number of nodes recomputed during last evaluation
+  std::size_t recomputed_count() const noexcept
+  {
+    return recomputed_;
+  }
+
+  bool is_initialized() const noexcept
+  {
+    return initialized_;
+  }
+
+private:
+  friend class ExprProgram;
+
+  void set_binding_slot(std::size_t slot, scalar_type value);
+  void mark_dirty(std::uint32_t reg);
+
+  const ExprProgram& program_;
+
+  std::vector<scalar_type> binding_values_;
+  std::vector<scalar_type> registers_;
+
+  bitvector_t dirty_;   // queued for recomputation
+  bitvector_t changed_; // value changed during current evaluation
+
+  std::vector<std::uint32_t> worklist_; // min-heap - dependents have higher register
+  std::vector<std::uint32_t> changed_regs_;
+  std::vector<std::size_t> changed_roots_;
+
+  std::size_t recomputed_ = 0;
+  bool initialized_ = false;
+};
+
+// Evaluates set of expressions over the same ExprDAG at once.
+//
+// Every distinct subexpression reachable from roots is linearized once in topological order,
+// so evaluation is O(unique DAG nodes) instead of sum of expression tree sizes.
+// Instruction i stores its result into register i; operands refer to registers of earlier instructions.
+//
+// NB: ExprProgram should not outlive ExprDAG
+class ExprProgram
+{
+public:
+  // Code and binding tables are allocated from mr.
+  // NB: roots must be non-empty and share single ExprDAG
+  explicit ExprProgram(const std::vector<Expr>& roots,
+                       std::pmr::memory_resource* mr = std::pmr::get_default_resource());
+
+  // Writes value of i-th root into results[i], binding_fn is called once per distinct binding
+  template <typename BindFn_, enable_if_binding_fn_t<BindFn_> = 0>
+  void evaluate(EvalState& es, BindFn_&& binding_fn, scalar_type* results) const
+  {
+    scalar_type* binding_values = es.scratch(scratch_size());
+
+    for (std::size_t i=0; i<bindings_.size(); ++i)
+      binding_values[i] = binding_fn(bindings_[i]);
+
+    execute_roots(binding_values, binding_values + bindings_.size(), results);
+  }
+
+  // binding_values are indexed by UnboundValue::index_
+  void evaluate(EvalState& es, const scalar_type* binding_values, scalar_type* results) const;
+
+  // As evaluate(), but results are looked up in cache by values of all bindings first and no
+  // instruction is executed on hit. Results are stored in cache on miss.
+  // NB: Cache has to be created by create_result_cache() of the same program.
+  template <typename BindFn_, enable_if_binding_fn_t<BindFn_> = 0>
+  void evaluate(EvalState& es, ResultCache& cache, BindFn_&& binding_fn, scalar_type* results) const
+  {
+    assert(cache.key_size() == bindings_.size() && cache.result_size() == root_count()
+           && "ResultCache of different program");
+
+    scalar_type* binding_values = es.scratch(scratch_size());
+
+    for (std::size_t i=0; i<bindings_.size(); ++i)
+      binding_values[i] = binding_fn(bindings_[i]);
+
+    const std::uint32_t h = ResultCache::hash(binding_values, bindings_.size());
+
+    if (const scalar_type* cached = cache.find(binding_values, h))
+    {
+      std::copy_n(cached, root_count(), results);
+      return;
+    }
+
+    execute_roots(binding_values, binding_values + bindings_.size(), results);
+    cache.insert(binding_values, h, results);
+  }
+
+  // Cache of results of evaluate() keyed by values of bindings, holding as many result sets as fit max_bytes
+  ResultCache create_result_cache(std::size_t max_bytes,
+                                  std::pmr::memory_resource* mr = std::pmr::get_default_resource()) const
+  {
+    return ResultCache(bindings_.size(), root_count(), max_bytes, mr);
+  }
+
+  // Resolves all bindings and recomputes only nodes depending on bindings that changed since
+  // previous evaluation with the same state (everything on first one).
+  template <typename BindFn_, enable_if_binding_fn_t<BindFn_> = 0>
+  void evaluate_incremental(IncrementalState& st, BindFn_&& binding_fn, scalar_type* results) const
+  {
+    for (std::size_t i=0; i<bindings_.size(); ++i)
+      st.set_binding_slot(i, binding_fn(bindings_[i]));
+
+    propagate(st, results);
+  }
+
+  // binding_values are indexed by UnboundValue::index_
+  void evaluate_incremental(IncrementalState& st, const scalar_type* binding_values, scalar_type* results) const;
+
+  // Size of EvalState scratch needed by evaluate()
+  std::size_t scratch_size() const noexcept
+  {
+    return bindings_.size() + code_.size();
+  }
+
+  // Recomputes nodes depending on bindings changed by IncrementalState::set_binding()
+  // Precondition: st was already evaluated by evaluate_incremental()
+  void update(IncrementalState& st, scalar_type* results) const;
+
+  std::size_t root_count() const noexcept
+  {
+    return root_regs_.size();
+  }
+
+  // Number of unique subexpressions
+  std::size_t node_count() const noexcept
+  {
+    return code_.size();
+  }
+
+  const std::pmr::vector<Instruction>& code() const noexcept
+  {
+    return code_;
+  }
+
+  // Binding cookie of each binding slot
+  const std::pmr::vector<uintptr_t>& bindings() const noexcept
+  {
+    return bindings_;
+  }
+
+  // UnboundValue index of each binding slot
+  const std::pmr::vector<std::size_t>& binding_ids() const noexcept
+  {
+    return binding_ids_;
+  }
+
+  // Register holding value of each root
+  const std::vector<std::uint32_t>& root_registers() const noexcept
+  {
+    return root_regs_;
+  }
+
+  // Precondition: registers has room for node_count() values
+  void execute(const scalar_type* binding_values, scalar_type* registers) const noexcept;
+
+private:
+  friend class IncrementalState;
+
+  void build_users(); // O(n)
+
+  void execute_roots(const scalar_type* binding_values, scalar_type* registers, scalar_type* results) const noexcept;
+  void propagate(IncrementalState& st, scalar_type* results) const;
+
+  const ExprDAG& dag_;
+
+  std::pmr::vector<Instruction> code_;
+  std::pmr::vector<uintptr_t> bindings_;
+  std::pmr::vector<std::size_t> binding_ids_;
+  std::vector<std::uint32_t> root_regs_;
+
+  sparse_map binding_slots_; // UnboundValue index -> binding slot
+
+  // Reverse edges of DAG as compressed adjacency lists:
+  // users of register r are users_[users_offsets_[r] .. users_offsets_[r+1]),
+  // users of binding slot b are binding_users_[binding_users_offsets_[b] .. binding_users_offsets_[b+1])
+  std::vector<std::uint32_t> users_offsets_;
+  std::vector<std::uint32_t> users_;
+  std::vector<std::uint32_t> binding_users_offsets_;
+  std::vector<std::uint32_t> binding_users_;
+};
+
+} // namespace glfdc
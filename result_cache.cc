@@ -0,0 +1,183 @@
+#include "result_cache.hh"
+
+#include <algorithm>
+#include <type_traits>
+
+using namespace glfdc;
+
+template <typename Scalar_>
+BasicResultCache<Scalar_>::BasicResultCache(std::size_t key_size, std::size_t result_size, std::size_t max_bytes,
+                                            std::pmr::memory_resource* mr)
+  : key_size_(key_size), result_size_(result_size), values_(mr), hashes_(mr), referenced_(mr), table_(mr)
+{
+  const std::size_t entry_bytes = stride() * sizeof(Scalar_) + sizeof(std::uint32_t) + sizeof(std::uint8_t);
+
+  // Rough count with two table slots per entry, table is power of two not over twice of it
+  const std::size_t estimate = max_bytes / (entry_bytes + 2 * sizeof(Slot));
+
+  if (estimate == 0)
+    return;
+
+  std::size_t table_size = 1;
+
+  while (table_size * 2 <= 2 * estimate)
+    table_size *= 2;
+
+  // Rest of memory goes to entries, as long as load factor stays at most 3/4
+  const std::size_t entries_bytes = max_bytes - table_size * sizeof(Slot);
+  capacity_ = std::min(entries_bytes / entry_bytes, table_size * 3 / 4);
+
+  assert(capacity_ > 0 && capacity_ < EMPTY);
+
+  values_.resize(capacity_ * stride());
+  hashes_.resize(capacity_);
+  referenced_.resize(capacity_);
+  table_.resize(table_size, Slot{0, EMPTY});
+}
+
+template <typename Scalar_>
+std::uint32_t BasicResultCache<Scalar_>::hash(const Scalar_* key, std::size_t n) noexcept
+{
+  using unsigned_t = std::make_unsigned_t<Scalar_>;
+
+  // Multiply-xorshift of each value, whole word mixed at end (as in splitmix64 finalizer)
+  std::uint64_t h = n;
+
+  for (std::size_t i=0; i<n; ++i)
+  {
+    h = (h ^ std::uint64_t(unsigned_t(key[i]))) * 0x9e3779b97f4a7c15ull;
+    h ^= h >> 32;
+  }
+
+  h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ull;
+  h ^= h >> 27; h *= 0x94d049bb133111ebull;
+  h ^= h >> 31;
+
+  return std::uint32_t(h);
+}
+
+template <typename Scalar_>
+const Scalar_* BasicResultCache<Scalar_>::find(const Scalar_* key, std::uint32_t h) noexcept
+{
+  assert(h == hash(key, key_size_));
+
+  if (!table_.empty())
+  {
+    // Load factor is below 1 - there is always empty slot ending probe sequence
+    for (std::size_t pos = home(h); table_[pos].entry_ != EMPTY; pos = next(pos))
+    {
+      const Slot slot = table_[pos];
+
+      if (slot.hash_ == h && std::equal(key, key + key_size_, entry(slot.entry_)))
+      {
+        referenced_[slot.entry_] = 1;
+        ++stats_.hits_;
+
+        return entry(slot.entry_) + key_size_;
+      }
+    }
+  }
+
+  ++stats_.misses_;
+  return nullptr;
+}
+
+template <typename Scalar_>
+void BasicResultCache<Scalar_>::insert(const Scalar_* key, std::uint32_t h, const Scalar_* results) noexcept
+{
+  assert(h == hash(key, key_size_));
+
+  if (capacity_ == 0)
+    return;
+
+  const std::size_t e = (size_ < capacity_)? size_++ : evict();
+
+  std::copy_n(key, key_size_, entry(e));
+  std::copy_n(results, result_size_, entry(e) + key_size_);
+  hashes_[e] = h;
+  // Not referenced until hit - evicted on next sweep unless used by then
+  referenced_[e] = 0;
+
+  std::size_t pos = home(h);
+
+  while (table_[pos].entry_ != EMPTY)
+  {
+    assert((table_[pos].hash_ != h || !std::equal(key, key + key_size_, entry(table_[pos].entry_)))
+           && "Key is cached already");
+    pos = next(pos);
+  }
+
+  table_[pos] = Slot{h, std::uint32_t(e)};
+  ++stats_.insertions_;
+}
+
+template <typename Scalar_>
+std::size_t BasicResultCache<Scalar_>::evict() noexcept
+{
+  assert(size_ == capacity_ && capacity_ > 0);
+
+  // Terminates within two sweeps - the first one clears all reference bits
+  for (;;)
+  {
+    const std::size_t e = hand_;
+    hand_ = (hand_ + 1 == capacity_)? 0 : hand_ + 1;
+
+    if (referenced_[e])
+    {
+      referenced_[e] = 0;
+      continue;
+    }
+
+    std::size_t pos = home(hashes_[e]);
+
+    while (table_[pos].entry_ != e)
+      pos = next(pos);
+
+    erase_slot(pos);
+    ++stats_.evictions_;
+
+    return e;
+  }
+}
+
+template <typename Scalar_>
+void BasicResultCache<Scalar_>::erase_slot(std::size_t pos) noexcept
+{
+  // Backward shift deletion - no tombstones, probe sequences stay as if entry was never inserted.
+  // Following slot moves into hole unless its home lies cyclically within (hole, slot].
+  const std::size_t mask = table_.size() - 1;
+
+  for (std::size_t cur = next(pos); table_[cur].entry_ != EMPTY; cur = next(cur))
+  {
+    const std::size_t home_pos = home(table_[cur].hash_);
+
+    if (((cur - home_pos) & mask) >= ((cur - pos) & mask))
+    {
+      table_[pos] = table_[cur];
+      pos = cur;
+    }
+  }
+
+  table_[pos].entry_ = EMPTY;
+}
+
+template <typename Scalar_>
+void BasicResultCache<Scalar_>::clear() noexcept // O(capacity)
+{
+  std::fill(table_.begin(), table_.end(), Slot{0, EMPTY});
+  std::fill(referenced_.begin(), referenced_.end(), std::uint8_t(0));
+
+  size_ = 0;
+  hand_ = 0;
+}
+
+template <typename Scalar_>
+std::size_t BasicResultCache<Scalar_>::memory_usage() const noexcept
+{
+  return values_.size() * sizeof(Scalar_) + hashes_.size() * sizeof(std::uint32_t)
+    + referenced_.size() * sizeof(std::uint8_t) + table_.size() * sizeof(Slot);
+}
+
+template class glfdc::BasicResultCache<std::int16_t>;
+template class glfdc::BasicResultCache<std::int32_t>;
+template class glfdc::BasicResultCache<std::int64_t>;
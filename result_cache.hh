@@ -0,0 +1,157 @@
+#pragma once
+
+#include "sexpr.hh"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+namespace glfdc {
+
+// Hit rate counters of ResultCache, kept always - single increment per lookup
+struct ResultCacheCounters
+{
+  std::uint64_t hits_ = 0;
+  std::uint64_t misses_ = 0;
+  std::uint64_t insertions_ = 0;
+  std::uint64_t evictions_ = 0;
+
+  double hit_rate() const noexcept
+  {
+    const std::uint64_t lookups = hits_ + misses_;
+    return lookups? double(hits_) / double(lookups) : 0.0;
+  }
+};
+
+// Bounded cache of evaluation results keyed by values of all bindings of evaluator or program,
+// in order of their binding slots (see Bytecode::bindings() and ExprProgram::bindings()).
+//
+// Entries are fixed size - key of key_size() values followed by result_size() results - stored in
+// single flat array allocated once by constructor, so all memory stays within max_bytes given.
+// Index is open addressing table of entry numbers with linear probing; 32b hash of key is stored
+// next to each entry number, so key is compared only on full hash match.
+//
+// When full, entry to replace is picked by CLOCK: hand sweeps entries in circle and evicts first
+// one not referenced since previous sweep, clearing reference bits it passes by.
+//
+// NB: Not thread safe - as EvalState, cache should be used by single thread at time.
+template <typename Scalar_>
+class BasicResultCache
+{
+public:
+  // Cache holds as many entries as fit max_bytes, no entry if even single doesn't fit
+  BasicResultCache(std::size_t key_size, std::size_t result_size, std::size_t max_bytes,
+                   std::pmr::memory_resource* mr = std::pmr::get_default_resource());
+
+  static std::uint32_t hash(const Scalar_* key, std::size_t n) noexcept;
+
+  // Stored results of key or nullptr - marks entry referenced
+  const Scalar_* find(const Scalar_* key) noexcept // O(1)
+  {
+    return find(key, hash(key, key_size_));
+  }
+
+  const Scalar_* find(const Scalar_* key, std::uint32_t h) noexcept;
+
+  // Stores results of key, replaces entry picked by CLOCK if cache is full.
+  // NB: Precondition is that key isn't cached.
+  void insert(const Scalar_* key, const Scalar_* results) noexcept // O(1)
+  {
+    insert(key, hash(key, key_size_), results);
+  }
+
+  void insert(const Scalar_* key, std::uint32_t h, const Scalar_* results) noexcept;
+
+  // Removes all entries but keeps memory and counters
+  void clear() noexcept; // O(capacity)
+
+  std::size_t key_size() const noexcept
+  {
+    return key_size_;
+  }
+
+  std::size_t result_size() const noexcept
+  {
+    return result_size_;
+  }
+
+  std::size_t size() const noexcept
+  {
+    return size_;
+  }
+
+  // Max number of entries
+  std::size_t capacity() const noexcept
+  {
+    return capacity_;
+  }
+
+  // Bytes allocated by constructor - at most max_bytes
+  std::size_t memory_usage() const noexcept;
+
+  ResultCacheCounters stats() const noexcept
+  {
+    return stats_;
+  }
+
+  void reset_stats() noexcept
+  {
+    stats_ = ResultCacheCounters{};
+  }
+
+private:
+  struct Slot
+  {
+    std::uint32_t hash_;
+    std::uint32_t entry_; // EMPTY if slot is free
+  };
+
+  static constexpr std::uint32_t EMPTY = std::uint32_t(-1);
+
+  std::size_t stride() const noexcept
+  {
+    return key_size_ + result_size_;
+  }
+
+  const Scalar_* entry(std::size_t i) const noexcept
+  {
+    return values_.data() + i * stride();
+  }
+
+  Scalar_* entry(std::size_t i) noexcept
+  {
+    return values_.data() + i * stride();
+  }
+
+  std::size_t home(std::uint32_t h) const noexcept
+  {
+    return h & (table_.size() - 1);
+  }
+
+  std::size_t next(std::size_t pos) const noexcept
+  {
+    return (pos + 1) & (table_.size() - 1);
+  }
+
+  std::size_t evict() noexcept; // returns freed entry
+  void erase_slot(std::size_t pos) noexcept;
+
+  std::size_t key_size_;
+  std::size_t result_size_;
+  std::size_t capacity_ = 0;
+  std::size_t size_ = 0;
+  std::size_t hand_ = 0; // CLOCK hand - next entry considered for eviction
+
+  std::pmr::vector<Scalar_> values_;         // key and results of each entry
+  std::pmr::vector<std::uint32_t> hashes_;   // hash of key of each entry
+  std::pmr::vector<std::uint8_t> referenced_; // CLOCK reference bit of each entry
+  std::pmr::vector<Slot> table_;             // power of two size, load factor at most 3/4
+
+  ResultCacheCounters stats_;
+};
+
+using ResultCache = BasicResultCache<scalar_type>;
+
+} // namespace glfdc
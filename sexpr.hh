@@ -6,6 +6,8 @@
 
 namespace glfdc {
 
+// Scalar of DAG constants and default evaluation scalar - expressions may also be evaluated in other
+// scalar types, see BasicExprEvaluator
 using scalar_type = int;
 
 struct UnboundValue
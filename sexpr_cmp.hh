@@ -90,11 +90,14 @@ std::size_t sexpr_hash::operator() (const SExpr& e) const noexcept
 
   hash_combine(seed, e.op_);
 
-  hash_combine(seed, svalue(e.lhs_).first);
-  hash_combine(seed, svalue(e.lhs_).second);
+  const auto [lkind, lvalue] = svalue(e.lhs_);
+  const auto [rkind, rvalue] = svalue(e.rhs_);
 
-  hash_combine(seed, svalue(e.rhs_).first);
-  hash_combine(seed, svalue(e.rhs_).second);
+  hash_combine(seed, lkind);
+  hash_combine(seed, lvalue);
+
+  hash_combine(seed, rkind);
+  hash_combine(seed, rvalue);
 
   return seed;
 }
@@ -0,0 +1 @@
+#include "sexpr_table.hh"
@@ -0,0 +1,246 @@
+#pragma once
+
+#include "packed_sexpr.hh"
+#include "sexpr.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <vector>
+
+namespace glfdc
+{
+
+// Flat open addressing hash table mapping SExpr to its SExprRef for hash-consing.
+//
+// Robin Hood linear probing: on insert entry closer to its home slot is displaced by one further
+// from home, which keeps probe sequences short and lets lookup stop early on miss.
+// Hash of every entry is stored next to it, so probing compares keys only on full hash match
+// and rehashing doesn't need to recompute hashes.
+//
+// Keys are stored packed and value is only index of node - whether it's LExprRef or IExprRef
+// follows from the key itself.
+//
+// Entries are never erased one by one, only all at once by clear().
+class sexpr_table
+{
+  struct Entry
+  {
+    PackedSExpr key_;
+    std::uint32_t index_;
+  };
+
+  static_assert(sizeof(Entry) == 16, "Entry should stay compact");
+
+public:
+  struct Stats
+  {
+    std::size_t size;
+    std::size_t capacity;
+    double load_factor;
+    std::size_t max_probe_length; // max distance of entry from its home slot
+    double mean_probe_length;
+  };
+
+  sexpr_table() = default;
+
+  explicit sexpr_table(std::pmr::memory_resource* mr) : hashes_(mr), entries_(mr) {}
+
+  static std::size_t hash(const PackedSExpr& key) noexcept
+  {
+    const std::size_t h = packed_sexpr_hash{}(key);
+    // 0 marks empty slot
+    return h != EMPTY? h : 1;
+  }
+
+  std::optional<SExprRef> find(const PackedSExpr& key, std::size_t h) const noexcept // O(1)
+  {
+    if (hashes_.empty())
+      return std::nullopt;
+
+    std::size_t pos = home(h);
+
+    for (std::size_t dist = 0; ; ++dist, pos = next(pos))
+    {
+      const std::size_t slot_hash = hashes_[pos];
+
+      // Empty or richer entry - key would have been placed here
+      if (slot_hash == EMPTY || distance(slot_hash, pos) < dist)
+        return std::nullopt;
+
+      if (slot_hash == h && entries_[pos].key_ == key)
+        return make_ref(key, entries_[pos].index_);
+    }
+  }
+
+  std::optional<SExprRef> find(const SExpr& key) const noexcept
+  {
+    const auto packed = PackedSExpr::pack(key);
+    return find(packed, hash(packed));
+  }
+
+  // Precondition: key is not present
+  void insert(const PackedSExpr& key, SExprRef value, std::size_t h) // O(1) amortized
+  {
+    assert(!find(key, h).has_value() && "Already inserted");
+    assert(key.is_unbound() == is_lref(value) && "Reference kind must follow key");
+
+    if ((size_ + 1) * MAX_LOAD_DEN > capacity() * MAX_LOAD_NUM)
+      rehash(std::max(MIN_CAPACITY, capacity() * 2));
+
+    place(h, Entry{key, std::uint32_t(ref_index(value))});
+    ++size_;
+  }
+
+  void insert(const SExpr& key, SExprRef value)
+  {
+    const auto packed = PackedSExpr::pack(key);
+    insert(packed, value, hash(packed));
+  }
+
+  // Makes room for n entries without rehashing
+  void reserve(std::size_t n)
+  {
+    std::size_t cap = MIN_CAPACITY;
+
+    while (n * MAX_LOAD_DEN > cap * MAX_LOAD_NUM)
+      cap *= 2;
+
+    if (cap > capacity())
+      rehash(cap);
+  }
+
+  // Removes all entries but keeps capacity
+  void clear() noexcept // O(capacity)
+  {
+    std::fill(hashes_.begin(), hashes_.end(), EMPTY);
+    size_ = 0;
+  }
+
+  std::size_t size() const noexcept
+  {
+    return size_;
+  }
+
+  bool empty() const noexcept
+  {
+    return size_ == 0;
+  }
+
+  std::size_t capacity() const noexcept
+  {
+    return hashes_.size();
+  }
+
+  Stats stats() const noexcept // O(capacity)
+  {
+    std::size_t max_probe = 0, total_probe = 0;
+
+    for (std::size_t pos = 0; pos < hashes_.size(); ++pos)
+    {
+      if (hashes_[pos] == EMPTY)
+        continue;
+
+      const std::size_t dist = distance(hashes_[pos], pos);
+
+      max_probe = std::max(max_probe, dist);
+      total_probe += dist;
+    }
+
+    return Stats{
+      size_,
+      capacity(),
+      capacity() == 0? 0.0 : double(size_) / double(capacity()),
+      max_probe,
+      size_ == 0? 0.0 : double(total_probe) / double(size_)
+    };
+  }
+
+private:
+  static constexpr std::size_t EMPTY = 0;
+  static constexpr std::size_t MIN_CAPACITY = 16;
+
+  // Max load factor 7/8
+  static constexpr std::size_t MAX_LOAD_NUM = 7;
+  static constexpr std::size_t MAX_LOAD_DEN = 8;
+
+  static SExprRef make_ref(const PackedSExpr& key, std::uint32_t index) noexcept
+  {
+    return key.is_unbound()? SExprRef(LExprRef{index}) : SExprRef(IExprRef{index});
+  }
+
+  std::size_t home(std::size_t h) const noexcept
+  {
+    // Fibonacci hashing - uses high bits of product
+    constexpr std::uint64_t golden = 0x9e3779b97f4a7c15ull;
+    return std::size_t((std::uint64_t(h) * golden) >> shift_);
+  }
+
+  std::size_t next(std::size_t pos) const noexcept
+  {
+    return (pos + 1) & (capacity() - 1);
+  }
+
+  std::size_t distance(std::size_t h, std::size_t pos) const noexcept
+  {
+    return (pos - home(h)) & (capacity() - 1);
+  }
+
+  void place(std::size_t h, Entry entry) noexcept
+  {
+    std::size_t pos = home(h);
+
+    for (std::size_t dist = 0; ; ++dist, pos = next(pos))
+    {
+      if (hashes_[pos] == EMPTY)
+      {
+        hashes_[pos] = h;
+        entries_[pos] = entry;
+        return;
+      }
+
+      // Take slot from richer entry and carry on placing it instead
+      const std::size_t slot_dist = distance(hashes_[pos], pos);
+
+      if (slot_dist < dist)
+      {
+        std::swap(hashes_[pos], h);
+        std::swap(entries_[pos], entry);
+        dist = slot_dist;
+      }
+    }
+  }
+
+  void rehash(std::size_t new_capacity)
+  {
+    assert((new_capacity & (new_capacity - 1)) == 0 && "Power of two");
+    assert(new_capacity >= size_);
+
+    std::pmr::vector<std::size_t> old_hashes(new_capacity, EMPTY, hashes_.get_allocator());
+    std::pmr::vector<Entry> old_entries(new_capacity, entries_.get_allocator());
+
+    old_hashes.swap(hashes_);
+    old_entries.swap(entries_);
+
+    shift_ = 64;
+    for (std::size_t c = new_capacity; c > 1; c /= 2)
+      --shift_;
+
+    for (std::size_t pos = 0; pos < old_hashes.size(); ++pos)
+    {
+      if (old_hashes[pos] != EMPTY)
+        place(old_hashes[pos], old_entries[pos]);
+    }
+  }
+
+  std::pmr::vector<std::size_t> hashes_;
+  std::pmr::vector<Entry> entries_;
+
+  std::size_t size_ = 0;
+  unsigned shift_ = 64;
+};
+
+} // namespace glfdc
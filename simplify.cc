@@ -0,0 +1,224 @@
+#include "simplify.hh"
+
+#include <cassert>
+
+using namespace glfdc;
+
+namespace {
+
+std::optional<scalar_type> scalar_of(Operand op) noexcept
+{
+  if (!is_scalar(op))
+    return std::nullopt;
+
+  return std::get<scalar_type>(std::get<Value>(op));
+}
+
+Simplified reduce_to(Operand op)
+{
+  return Simplified{op, OperatorKind::add, Operand{}, Operand{}};
+}
+
+// c1 op c2 folded exactly, nullopt if it overflows scalar_type. Chain is kept as it is then - wrapped
+// constant would change value of expression evaluated in wider scalar (see BasicExprEvaluator).
+std::optional<scalar_type> fold(OperatorKind op, scalar_type c1, scalar_type c2) noexcept
+{
+  scalar_type result = 0;
+  bool overflow = false;
+
+  switch (op)
+  {
+  case OperatorKind::add:
+    overflow = __builtin_add_overflow(c1, c2, &result);
+    break;
+  case OperatorKind::sub:
+    overflow = __builtin_sub_overflow(c1, c2, &result);
+    break;
+  case OperatorKind::mul:
+    overflow = __builtin_mul_overflow(c1, c2, &result);
+    break;
+  case OperatorKind::div:
+  case OperatorKind::mod:
+    assert(false && "Not a constant chain operator");
+    return std::nullopt;
+  }
+
+  if (overflow)
+    return std::nullopt;
+
+  return result;
+}
+
+std::optional<Simplified> rewrite(OperatorKind op, std::optional<scalar_type> c, Operand y)
+{
+  if (!c.has_value())
+    return std::nullopt;
+
+  return Simplified{std::nullopt, op, Value(*c), y};
+}
+
+std::optional<Simplified> rewrite(OperatorKind op, Operand y, std::optional<scalar_type> c)
+{
+  if (!c.has_value())
+    return std::nullopt;
+
+  return Simplified{std::nullopt, op, y, Value(*c)};
+}
+
+// Subexpression of form c+y, y-c or c-y
+struct ConstChain
+{
+  OperatorKind op_;
+  bool const_lhs_;
+  scalar_type c_;
+  Operand y_;
+};
+
+std::optional<ConstChain> const_chain(const ExprDAG& dag, Operand op)
+{
+  if (!is_sexpr(op))
+    return std::nullopt;
+
+  const SExpr e = dag.fetch(std::get<SExprRef>(op));
+
+  if (e.op_ != OperatorKind::add && e.op_ != OperatorKind::sub && e.op_ != OperatorKind::mul)
+    return std::nullopt;
+
+  if (const auto c = scalar_of(e.lhs_))
+    return ConstChain{e.op_, true, *c, e.rhs_};
+
+  // Commutative nodes have scalar on left
+  if (const auto c = scalar_of(e.rhs_); c.has_value() && e.op_ == OperatorKind::sub)
+    return ConstChain{e.op_, false, *c, e.lhs_};
+
+  return std::nullopt;
+}
+
+// c2 + chain
+std::optional<Simplified> reassociate_add(scalar_type c2, const ConstChain& s)
+{
+  if (s.op_ == OperatorKind::add)
+    return rewrite(OperatorKind::add, fold(OperatorKind::add, s.c_, c2), s.y_);
+
+  if (s.op_ == OperatorKind::sub && !s.const_lhs_)
+    return rewrite(OperatorKind::add, fold(OperatorKind::sub, c2, s.c_), s.y_);
+
+  if (s.op_ == OperatorKind::sub && s.const_lhs_)
+    return rewrite(OperatorKind::sub, fold(OperatorKind::add, s.c_, c2), s.y_);
+
+  return std::nullopt;
+}
+
+// chain - c2
+std::optional<Simplified> reassociate_sub_const(const ConstChain& s, scalar_type c2)
+{
+  if (s.op_ == OperatorKind::add)
+    return rewrite(OperatorKind::add, fold(OperatorKind::sub, s.c_, c2), s.y_);
+
+  if (s.op_ == OperatorKind::sub && !s.const_lhs_)
+    return rewrite(OperatorKind::sub, s.y_, fold(OperatorKind::add, s.c_, c2));
+
+  if (s.op_ == OperatorKind::sub && s.const_lhs_)
+    return rewrite(OperatorKind::sub, fold(OperatorKind::sub, s.c_, c2), s.y_);
+
+  return std::nullopt;
+}
+
+// c2 - chain
+std::optional<Simplified> reassociate_const_sub(scalar_type c2, const ConstChain& s)
+{
+  if (s.op_ == OperatorKind::add)
+    return rewrite(OperatorKind::sub, fold(OperatorKind::sub, c2, s.c_), s.y_);
+
+  if (s.op_ == OperatorKind::sub && !s.const_lhs_)
+    return rewrite(OperatorKind::sub, fold(OperatorKind::add, c2, s.c_), s.y_);
+
+  if (s.op_ == OperatorKind::sub && s.const_lhs_)
+    return rewrite(OperatorKind::add, fold(OperatorKind::sub, c2, s.c_), s.y_);
+
+  return std::nullopt;
+}
+
+} // namespace anonymous
+
+std::optional<Simplified> glfdc::simplify(const ExprDAG& dag, OperatorKind op, Operand l, Operand r)
+{
+  const auto lc = scalar_of(l);
+  const auto rc = scalar_of(r);
+
+  // Both scalars are handled by cfold
+  if (lc.has_value() && rc.has_value())
+    return std::nullopt;
+
+  const Value zero = Value(scalar_type(0));
+
+  switch (op)
+  {
+  case OperatorKind::add:
+    assert(!rc.has_value() && "Scalar should be reordered to left");
+
+    if (lc == 0)
+      return reduce_to(r);
+
+    if (lc.has_value())
+    {
+      if (const auto s = const_chain(dag, r))
+        return reassociate_add(*lc, *s);
+    }
+    break;
+
+  case OperatorKind::sub:
+    if (rc == 0)
+      return reduce_to(l);
+
+    if (l == r)
+      return reduce_to(zero);
+
+    if (rc.has_value())
+    {
+      if (const auto s = const_chain(dag, l))
+        return reassociate_sub_const(*s, *rc);
+    }
+
+    if (lc.has_value())
+    {
+      if (const auto s = const_chain(dag, r))
+        return reassociate_const_sub(*lc, *s);
+    }
+    break;
+
+  case OperatorKind::mul:
+    assert(!rc.has_value() && "Scalar should be reordered to left");
+
+    if (lc == 0)
+      return reduce_to(zero);
+
+    if (lc == 1)
+      return reduce_to(r);
+
+    if (lc.has_value())
+    {
+      const auto s = const_chain(dag, r);
+
+      if (s.has_value() && s->op_ == OperatorKind::mul)
+        return rewrite(OperatorKind::mul, fold(OperatorKind::mul, s->c_, *lc), s->y_);
+    }
+    break;
+
+  case OperatorKind::div:
+    if (rc == 1)
+      return reduce_to(l);
+
+    // Division by zero evaluates to 0
+    if (rc == 0 || lc == 0)
+      return reduce_to(zero);
+    break;
+
+  case OperatorKind::mod:
+    if (rc == 1 || rc == -1 || rc == 0 || lc == 0 || l == r)
+      return reduce_to(zero);
+    break;
+  }
+
+  return std::nullopt;
+}
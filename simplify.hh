@@ -0,0 +1,38 @@
+#pragma once
+
+#include "expr.hh"
+#include "sexpr.hh"
+
+#include <optional>
+
+namespace glfdc {
+
+// Result of algebraic simplification of single subexpression
+struct Simplified
+{
+  // Set if expression reduces to existing operand
+  std::optional<Operand> operand_;
+
+  // Otherwise cheaper expression to be built instead
+  OperatorKind op_;
+  Operand lhs_;
+  Operand rhs_;
+};
+
+// Rule based simplification of l op r, operands are already simplified and commutative
+// operands reordered (scalar first). Rules preserve evaluator semantics including x/0 == x%0 == 0:
+//
+// identities:  x+0, x-0, x*1, x/1 -> x
+// annihilators: x*0, x%1, x%-1, x/0, x%0, 0/x, 0%x -> 0
+// self:        x-x, x%x -> 0
+// constant chains (c1, c2 scalars):
+//   c2+(c1+y) -> (c1+c2)+y    c2+(y-c1) -> (c2-c1)+y    c2+(c1-y) -> (c1+c2)-y
+//   (c1+y)-c2 -> (c1-c2)+y    (y-c1)-c2 -> y-(c1+c2)    (c1-y)-c2 -> (c1-c2)-y
+//   c2-(c1+y) -> (c2-c1)-y    c2-(y-c1) -> (c2+c1)-y    c2-(c1-y) -> (c2-c1)+y
+//   c2*(c1*y) -> (c1*c2)*y
+// Chain is kept if its folded constant would overflow scalar_type.
+//
+// Returns nullopt if no rule applies.
+std::optional<Simplified> simplify(const ExprDAG& dag, OperatorKind op, Operand l, Operand r);
+
+} // namespace glfdc
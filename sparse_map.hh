@@ -72,6 +72,23 @@ public:
     return dense_.empty();
   }
 
+  // Keys are in range [0, universe())
+  std::size_t universe() const noexcept
+  {
+    return sparse_.size();
+  }
+
+  // (key, value) entries in insertion order
+  auto begin() const noexcept
+  {
+    return dense_.begin();
+  }
+
+  auto end() const noexcept
+  {
+    return dense_.end();
+  }
+
 private:
   std::vector<std::size_t> sparse_;
   std::vector<map_entry_t> dense_;
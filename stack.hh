@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cassert>
+#include <cstdint>
 #include <limits>
 #include <stack>
 #include <tuple>
@@ -23,6 +24,8 @@ public:
 
   EvalStack() = default;
 
+  explicit EvalStack(const typename C_::allocator_type& alloc) : base_t(alloc) {}
+
   EvalStack(const EvalStack& ) = default;
   EvalStack(EvalStack&& ) = default;
 
@@ -49,8 +52,8 @@ public:
     this->c.resize(this->c.size() - n);
   }
 
-  template <typename BndFn_>
-  void fill_gaps(const std::vector<binding_gap_t>& binding_gaps, BndFn_ fn) noexcept
+  template <typename Gaps_, typename BndFn_>
+  void fill_gaps(const Gaps_& binding_gaps, BndFn_ fn) noexcept
   {
     for (auto [idx, bind] : binding_gaps)
     {
@@ -0,0 +1 @@
+#include "static_expr.hh"
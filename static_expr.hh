@@ -0,0 +1,238 @@
+#pragma once
+
+#include "cfold.hh"
+#include "expr_builder.hh"
+#include "sexpr.hh"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Expressions known at C++ compile time.
+//
+// Expression is encoded in its type, so evaluation is fully inlined with no operator dispatch
+// and constant subexpressions are folded by cfold() during compilation:
+//
+//   using namespace glfdc::static_expr;
+//
+//   constexpr auto e = (arg<0> + 3_c) * arg<1> % 8_c;
+//   scalar_type v = e(x, y);                          // ((x + 3) * y) % 8
+//   Operand op = lower(e, builder, bindings);         // same expression in ExprDAG
+//
+// Placeholders arg<I> stand for I-th argument of evaluation - the same role UnboundValue has
+// in ExprDAG. When lowered they can be bound to any Operand, including runtime built subexpressions.
+namespace glfdc::static_expr {
+
+template <typename Derived_>
+struct StaticExpr;
+
+template <std::size_t I_>
+struct Placeholder;
+
+template <scalar_type V_>
+struct Constant;
+
+template <OperatorKind Op_, typename L_, typename R_>
+struct Node;
+
+template <typename T_>
+constexpr bool is_static_expr_v = std::is_base_of_v<StaticExpr<std::decay_t<T_>>, std::decay_t<T_>>;
+
+template <typename T_>
+struct is_constant : std::false_type {};
+
+template <scalar_type V_>
+struct is_constant<Constant<V_>> : std::true_type {};
+
+template <typename T_>
+struct is_placeholder : std::false_type {};
+
+template <std::size_t I_>
+struct is_placeholder<Placeholder<I_>> : std::true_type {};
+
+// Number of arguments needed to evaluate expression - highest placeholder index + 1
+template <typename E_>
+struct arity : std::integral_constant<std::size_t, 0> {};
+
+template <std::size_t I_>
+struct arity<Placeholder<I_>> : std::integral_constant<std::size_t, I_ + 1> {};
+
+template <OperatorKind Op_, typename L_, typename R_>
+struct arity<Node<Op_, L_, R_>>
+  : std::integral_constant<std::size_t, (arity<L_>::value > arity<R_>::value)? arity<L_>::value : arity<R_>::value> {};
+
+template <typename E_>
+constexpr std::size_t arity_v = arity<std::remove_cv_t<E_>>::value;
+
+// Evaluates e, args holds at least arity_v<E_> values
+template <typename E_>
+constexpr scalar_type evaluate(E_, const scalar_type* args) noexcept
+{
+  if constexpr (is_constant<E_>::value)
+  {
+    (void)args;
+    return E_::value;
+  }
+  else if constexpr (is_placeholder<E_>::value)
+  {
+    return args[E_::index];
+  }
+  else
+  {
+    return cfold(E_::op, evaluate(typename E_::lhs_type{}, args), evaluate(typename E_::rhs_type{}, args));
+  }
+}
+
+template <typename Derived_>
+struct StaticExpr
+{
+  template <typename... Args_>
+  constexpr scalar_type operator()(Args_... args) const noexcept
+  {
+    static_assert(sizeof...(Args_) >= arity_v<Derived_>, "Not enough arguments");
+
+    const scalar_type values[sizeof...(Args_) + 1] = {scalar_type(args)...};
+    return evaluate(Derived_{}, values);
+  }
+};
+
+template <std::size_t I_>
+struct Placeholder : StaticExpr<Placeholder<I_>>
+{
+  static constexpr std::size_t index = I_;
+};
+
+template <scalar_type V_>
+struct Constant : StaticExpr<Constant<V_>>
+{
+  static constexpr scalar_type value = V_;
+};
+
+template <OperatorKind Op_, typename L_, typename R_>
+struct Node : StaticExpr<Node<Op_, L_, R_>>
+{
+  static constexpr OperatorKind op = Op_;
+
+  using lhs_type = L_;
+  using rhs_type = R_;
+};
+
+template <std::size_t I_>
+constexpr Placeholder<I_> arg{};
+
+template <scalar_type V_>
+constexpr Constant<V_> constant{};
+
+namespace detail {
+
+// Constant operands are folded right away
+template <OperatorKind Op_, typename L_, typename R_>
+constexpr auto make_node(L_, R_) noexcept
+{
+  if constexpr (is_constant<L_>::value && is_constant<R_>::value)
+    return Constant<cfold(Op_, L_::value, R_::value)>{};
+  else
+    return Node<Op_, L_, R_>{};
+}
+
+constexpr scalar_type parse_literal(const char* digits, std::size_t n) noexcept
+{
+  scalar_type ret = 0;
+
+  for (std::size_t i=0; i<n; ++i)
+    ret = ret * 10 + scalar_type(digits[i] - '0');
+
+  return ret;
+}
+
+template <typename L_, typename R_>
+using enable_if_static_exprs_t = std::enable_if_t<is_static_expr_v<L_> && is_static_expr_v<R_>, int>;
+
+} // namespace detail
+
+template <typename L_, typename R_, detail::enable_if_static_exprs_t<L_, R_> = 0>
+constexpr auto operator+(L_ l, R_ r) noexcept
+{
+  return detail::make_node<OperatorKind::add>(l, r);
+}
+
+template <typename L_, typename R_, detail::enable_if_static_exprs_t<L_, R_> = 0>
+constexpr auto operator-(L_ l, R_ r) noexcept
+{
+  return detail::make_node<OperatorKind::sub>(l, r);
+}
+
+template <typename L_, typename R_, detail::enable_if_static_exprs_t<L_, R_> = 0>
+constexpr auto operator*(L_ l, R_ r) noexcept
+{
+  return detail::make_node<OperatorKind::mul>(l, r);
+}
+
+template <typename L_, typename R_, detail::enable_if_static_exprs_t<L_, R_> = 0>
+constexpr auto operator/(L_ l, R_ r) noexcept
+{
+  return detail::make_node<OperatorKind::div>(l, r);
+}
+
+template <typename L_, typename R_, detail::enable_if_static_exprs_t<L_, R_> = 0>
+constexpr auto operator%(L_ l, R_ r) noexcept
+{
+  return detail::make_node<OperatorKind::mod>(l, r);
+}
+
+// -e is 0 - e
+template <typename E_, std::enable_if_t<is_static_expr_v<E_>, int> = 0>
+constexpr auto operator-(E_ e) noexcept
+{
+  return detail::make_node<OperatorKind::sub>(Constant<0>{}, e);
+}
+
+// Decimal scalar constant: 42_c
+template <char... Digits_>
+constexpr auto operator""_c() noexcept
+{
+  constexpr char digits[] = {Digits_...};
+  static_assert(((Digits_ >= '0' && Digits_ <= '9') && ...), "Only decimal literals are supported");
+
+  return Constant<detail::parse_literal(digits, sizeof...(Digits_))>{};
+}
+
+// Builds e in builder's DAG, placeholder arg<I> is replaced by args[I].
+// Precondition: args holds at least arity_v<E_> operands.
+template <typename E_>
+Operand lower(E_, ExpressionBuilder& builder, const Operand* args)
+{
+  if constexpr (is_constant<E_>::value)
+  {
+    (void)builder;
+    (void)args;
+    return Value(E_::value);
+  }
+  else if constexpr (is_placeholder<E_>::value)
+  {
+    (void)builder;
+    return args[E_::index];
+  }
+  else
+  {
+    const Operand l = lower(typename E_::lhs_type{}, builder, args);
+    const Operand r = lower(typename E_::rhs_type{}, builder, args);
+
+    return builder.create_sexpr(E_::op, l, r);
+  }
+}
+
+// Placeholder arg<I> is bound to bindings[I]
+template <typename E_>
+Operand lower(E_ e, ExpressionBuilder& builder, const uintptr_t* bindings)
+{
+  std::array<Operand, arity_v<E_> + 1> args;
+
+  for (std::size_t i=0; i<arity_v<E_>; ++i)
+    args[i] = builder.get_binding(bindings[i]);
+
+  return lower(e, builder, args.data());
+}
+
+} // namespace glfdc::static_expr
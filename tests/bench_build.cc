@@ -0,0 +1,151 @@
+#include "../concurrent_builder.hh"
+#include "../expr_builder.hh"
+
+#include "unknowns.hh"
+
+#include "catch2/catch.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <thread>
+
+using namespace glfdc;
+
+TEST_CASE("Binding lookup: rb-tree vs flat map", "[.][benchmark]")
+{
+  const Unknowns test_unk{20000};
+
+  std::vector<uintptr_t> addresses;
+
+  for (std::size_t i=0; i<test_unk.size(); ++i)
+    addresses.push_back(test_unk.get((i * 7919) % test_unk.size()));
+
+  std::map<uintptr_t, std::size_t> rb_tree;
+  binding_map flat;
+
+  for (std::size_t i=0; i<addresses.size(); ++i)
+  {
+    rb_tree.insert(std::make_pair(addresses[i], i));
+    flat.insert(addresses[i], i);
+  }
+
+  ExpressionBuilder builder;
+  std::vector<Value> values(addresses.size());
+  builder.get_bindings(addresses.data(), addresses.size(), values.data());
+
+  BENCHMARK("std::map::find x20000")
+  {
+    std::size_t sum = 0;
+
+    for (auto a : addresses)
+      sum += rb_tree.find(a)->second;
+
+    return sum;
+  };
+
+  BENCHMARK("binding_map::find x20000")
+  {
+    std::size_t sum = 0;
+
+    for (auto a : addresses)
+      sum += flat.find(a).value();
+
+    return sum;
+  };
+
+  BENCHMARK("get_binding x20000")
+  {
+    std::size_t sum = 0;
+
+    for (auto a : addresses)
+      sum += std::get<UnboundValue>(builder.get_binding(a)).index_;
+
+    return sum;
+  };
+
+  BENCHMARK("get_bindings x20000")
+  {
+    builder.get_bindings(addresses.data(), addresses.size(), values.data());
+    return std::get<UnboundValue>(values.back()).index_;
+  };
+}
+
+TEST_CASE("Memory footprint of subexpression nodes", "[.][benchmark]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  const std::size_t n = 1000000;
+
+  // Shallow nodes only - footprint doesn't depend on shape
+  auto ux = builder.get_binding(test_unkwns.get(0));
+  for (std::size_t i=0; i<n; ++i)
+    builder.create_sexpr(OperatorKind::add, ux, Value(int(i) + 1));
+
+  const auto& dag = builder.dag();
+  const auto stats = builder.lookup_stats();
+
+  const double node_bytes = double(sizeof(PackedSExpr) * (dag.unbound_exprs_.capacity() + dag.internal_exprs_.capacity()))
+                          / double(dag.node_count());
+
+  // Hash table stores 16b entry and 8b hash per slot
+  const double table_bytes = double(stats.capacity * (16 + sizeof(std::size_t))) / double(dag.node_count());
+
+  std::cout << "nodes: " << dag.node_count() << "\n"
+            << "sizeof(SExpr): " << sizeof(SExpr) << " B, sizeof(PackedSExpr): " << sizeof(PackedSExpr) << " B\n"
+            << "DAG storage: " << node_bytes << " B/node (incl. vector slack)\n"
+            << "hash-consing table: " << table_bytes << " B/node\n";
+
+  REQUIRE(dag.node_count() == n);
+}
+
+TEST_CASE("Concurrent builder throughput", "[.][benchmark]")
+{
+  const Unknowns test_unk{4096};
+
+  constexpr std::size_t nodes_per_thread = 200000;
+  const OperatorKind ops[] = {OperatorKind::add, OperatorKind::mul, OperatorKind::sub};
+
+  // Every thread builds its own chains - distinct nodes, no contention on the same entries
+  auto build = [&](ConcurrentExpressionBuilder& builder, std::size_t t) {
+    Operand acc = builder.get_binding(test_unk.get(t));
+
+    for (std::size_t i=0; i<nodes_per_thread; ++i)
+    {
+      const Value v = (i % 2)? builder.get_binding(test_unk.get((t * 131 + i) % test_unk.size()))
+                             : Value(int(i % 1000) + 2);
+      acc = builder.create_sexpr(ops[i % std::size(ops)], acc, v);
+    }
+  };
+
+  double base_rate = 0;
+
+  for (std::size_t nthreads : {1, 2, 4, 8})
+  {
+    ConcurrentExpressionBuilder builder;
+    builder.reserve(nthreads * nodes_per_thread);
+
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+
+    for (std::size_t t=0; t<nthreads; ++t)
+      threads.emplace_back(build, std::ref(builder), t);
+
+    for (auto& t : threads)
+      t.join();
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    const double rate = double(builder.node_count()) / elapsed.count();
+
+    if (nthreads == 1)
+      base_rate = rate;
+
+    std::cout << nthreads << " threads: " << builder.node_count() << " nodes, "
+              << rate / 1e6 << " M nodes/s, speedup " << rate / base_rate
+              << " (" << std::thread::hardware_concurrency() << " cores)\n";
+
+    REQUIRE(builder.node_count() == nthreads * nodes_per_thread);
+  }
+}
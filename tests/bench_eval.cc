@@ -0,0 +1,352 @@
+#include "../eval.hh"
+#include "../expr_builder.hh"
+#include "../interval.hh"
+#include "../program.hh"
+
+#include "unknowns.hh"
+
+#include "catch2/catch.hpp"
+
+using namespace glfdc;
+
+TEST_CASE("Bytecode vs reference evaluation", "[.][benchmark]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto binding_fn = [&test_unkwns](uintptr_t p) -> int {
+    return int(test_unkwns.index(p)) + 1;
+  };
+
+  // Balanced-ish expression over all unknowns with some reused subexpressions
+  std::vector<Operand> level;
+
+  for (std::size_t i=0; i<test_unkwns.size(); ++i)
+    level.push_back(builder.create_sexpr(OperatorKind::mul, builder.get_binding(test_unkwns.get(i)), Value(int(i) + 2)));
+
+  const OperatorKind ops[] = {OperatorKind::add, OperatorKind::sub, OperatorKind::mod, OperatorKind::div};
+  std::size_t op_idx = 0;
+
+  while (level.size() > 1)
+  {
+    std::vector<Operand> next;
+
+    for (std::size_t i=0; i+1<level.size(); i+=2)
+    {
+      auto op = ops[op_idx++ % std::size(ops)];
+      next.push_back(builder.create_sexpr(op, level[i], level[i+1]));
+    }
+
+    if (level.size() % 2)
+      next.push_back(builder.create_sexpr(OperatorKind::add, level.back(), level.front()));
+
+    level = std::move(next);
+  }
+
+  auto expr = builder.create_expr(level.front()).value();
+
+  auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+  auto lazy_mapping = std::apply(ReusedExprMapping::create_lazy_mapping, builder.reuses());
+
+  ExprEvaluator eager_eval(expr);
+  ExprEvaluator lazy_eval(expr, lazy_mapping);
+
+  EvalState es(eager_mapping);
+  EvalState lazy_es(lazy_mapping);
+
+  REQUIRE(eager_eval.evaluate(es, binding_fn) == eager_eval.evaluate_reference(es, binding_fn));
+
+  BENCHMARK("reference eager")
+  {
+    return eager_eval.evaluate_reference(es, binding_fn);
+  };
+
+  BENCHMARK("bytecode eager")
+  {
+    return eager_eval.evaluate(es, binding_fn);
+  };
+
+  BENCHMARK("reference lazy")
+  {
+    lazy_es.clear();
+    return lazy_eval.evaluate_reference(lazy_es, binding_fn);
+  };
+
+  BENCHMARK("bytecode lazy")
+  {
+    lazy_es.clear();
+    return lazy_eval.evaluate(lazy_es, binding_fn);
+  };
+}
+
+TEST_CASE("Batched vs per binding set evaluation", "[.][benchmark]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto ux = builder.get_binding(test_unkwns.get_by_name("x"));
+  auto uy = builder.get_binding(test_unkwns.get_by_name("y"));
+
+  // (x * 4 + y) / 8 - (x % 3)
+  auto s_1 = builder.create_sexpr(OperatorKind::mul, ux, Value(4));
+  auto s_2 = builder.create_sexpr(OperatorKind::add, s_1, uy);
+  auto s_3 = builder.create_sexpr(OperatorKind::div, s_2, Value(8));
+  auto s_4 = builder.create_sexpr(OperatorKind::mod, ux, Value(3));
+  auto s_5 = builder.create_sexpr(OperatorKind::sub, s_3, s_4);
+
+  auto expr = builder.create_expr(s_5).value();
+
+  constexpr std::size_t nlanes = 4096;
+
+  std::vector<int> col_x(nlanes), col_y(nlanes), results(nlanes);
+
+  for (std::size_t i=0; i<nlanes; ++i)
+  {
+    col_x[i] = int(i);
+    col_y[i] = int(nlanes - i);
+  }
+
+  const int* columns[] = {col_x.data(), col_y.data()};
+
+  auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+  EvalState es(eager_mapping);
+  ExprEvaluator eval(expr);
+
+  BENCHMARK("evaluate x4096")
+  {
+    std::size_t lane = 0;
+    auto binding_fn = [&](uintptr_t p) -> int {
+      return columns[std::get<UnboundValue>(builder.get_binding(p)).index_][lane];
+    };
+
+    for (lane=0; lane<nlanes; ++lane)
+      results[lane] = eval.evaluate(es, binding_fn);
+
+    return results.back();
+  };
+
+  BENCHMARK("evaluate_batch x4096")
+  {
+    eval.evaluate_batch(es, columns, nlanes, results.data());
+    return results.back();
+  };
+}
+
+TEST_CASE("Range specialized batch evaluation", "[.][benchmark]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto ux = builder.get_binding(test_unkwns.get_by_name("x"));
+  auto uy = builder.get_binding(test_unkwns.get_by_name("y"));
+
+  // x / y + x % y, x in [0, 4095], y in [1, 4096]
+  auto s_1 = builder.create_sexpr(OperatorKind::div, ux, uy);
+  auto s_2 = builder.create_sexpr(OperatorKind::mod, ux, uy);
+  auto s_3 = builder.create_sexpr(OperatorKind::add, s_1, s_2);
+
+  auto expr = builder.create_expr(s_3).value();
+
+  constexpr std::size_t nlanes = 4096;
+
+  std::vector<int> col_x(nlanes), col_y(nlanes), results(nlanes);
+
+  for (std::size_t i=0; i<nlanes; ++i)
+  {
+    col_x[i] = int(i);
+    col_y[i] = int(nlanes - i);
+  }
+
+  const int* columns[] = {col_x.data(), col_y.data()};
+  const Interval binding_ranges[] = {{0, 4095}, {1, 4096}};
+
+  const RangeAnalysis ranges(builder.dag(), binding_ranges);
+
+  auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+  EvalState es(eager_mapping);
+
+  ExprEvaluator plain(expr);
+  ExprEvaluator specialized(expr, eager_mapping, ranges);
+
+  BENCHMARK("evaluate_batch x4096")
+  {
+    plain.evaluate_batch(es, columns, nlanes, results.data());
+    return results.back();
+  };
+
+  BENCHMARK("evaluate_batch with ranges x4096")
+  {
+    specialized.evaluate_batch(es, columns, nlanes, results.data());
+    return results.back();
+  };
+}
+
+TEST_CASE("Multi-root program vs evaluator per root", "[.][benchmark]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto binding_fn = [&test_unkwns](uintptr_t p) -> int {
+    return int(test_unkwns.index(p)) + 1;
+  };
+
+  // Chain of roots each extending previous one: r_i = r_{i-1} * u_i + i
+  std::vector<Expr> roots;
+  Operand prev = builder.get_binding(test_unkwns.get(0));
+
+  for (std::size_t i=1; i<test_unkwns.size(); ++i)
+  {
+    auto prod = builder.create_sexpr(OperatorKind::mul, prev, builder.get_binding(test_unkwns.get(i)));
+    prev = builder.create_sexpr(OperatorKind::add, prod, Value(int(i)));
+    roots.push_back(builder.create_expr(prev).value());
+  }
+
+  auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+  EvalState es(eager_mapping);
+
+  std::vector<ExprEvaluator> evaluators;
+  for (const Expr& e : roots)
+    evaluators.emplace_back(e);
+
+  ExprProgram program(roots);
+  std::vector<int> results(roots.size());
+
+  BENCHMARK("evaluator per root")
+  {
+    for (std::size_t i=0; i<evaluators.size(); ++i)
+      results[i] = evaluators[i].evaluate(es, binding_fn);
+
+    return results.back();
+  };
+
+  BENCHMARK("multi-root program")
+  {
+    program.evaluate(es, binding_fn, results.data());
+    return results.back();
+  };
+}
+
+TEST_CASE("Binding resolution", "[.][benchmark]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  // Sum of products of every pair of neighbouring unknowns - each unknown appears twice
+  Operand sum = Value(0);
+
+  for (std::size_t i=0; i+1<test_unkwns.size(); ++i)
+  {
+    auto prod = builder.create_sexpr(OperatorKind::mul, builder.get_binding(test_unkwns.get(i)),
+                                     builder.get_binding(test_unkwns.get(i+1)));
+    sum = builder.create_sexpr(OperatorKind::add, sum, prod);
+  }
+
+  auto expr = builder.create_expr(sum).value();
+
+  auto binding_fn = [&test_unkwns](uintptr_t p) -> int {
+    return int(test_unkwns.index(p)) + 1;
+  };
+
+  std::vector<int> binding_values;
+  for (auto binding : builder.dag().unbound_values_)
+    binding_values.push_back(binding_fn(binding));
+
+  auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+  EvalState es(eager_mapping);
+  ExprEvaluator eval(expr);
+
+  std::function<int (uintptr_t)> type_erased_fn = binding_fn;
+
+  BENCHMARK("reference std::function per gap")
+  {
+    return eval.evaluate_reference(es, type_erased_fn);
+  };
+
+  BENCHMARK("std::function")
+  {
+    return eval.evaluate(es, type_erased_fn);
+  };
+
+  BENCHMARK("lambda")
+  {
+    return eval.evaluate(es, binding_fn);
+  };
+
+  BENCHMARK("values indexed by UnboundValue")
+  {
+    return eval.evaluate(es, binding_values.data());
+  };
+}
+
+TEST_CASE("Memo reset of large mapping", "[.][benchmark]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto ux = builder.get_binding(test_unkwns.get_by_name("x"));
+  auto uy = builder.get_binding(test_unkwns.get_by_name("y"));
+
+  auto binding_fn = [&test_unkwns](uintptr_t p) -> int { return int(test_unkwns.index(p)) + 1; };
+
+  // Small expression evaluated with state of mapping of 100k reused subexpressions
+  Operand s = builder.create_sexpr(OperatorKind::add, ux, uy);
+  const Operand small = builder.create_sexpr(OperatorKind::mul, s, uy);
+
+  for (int i=0; i<100000; ++i)
+    s = builder.create_sexpr((i % 2)? OperatorKind::add : OperatorKind::mul, s, (i % 3)? ux : uy);
+
+  auto lazy_mapping = std::apply(ReusedExprMapping::create_lazy_mapping, builder.reuses());
+
+  ExprEvaluator eval(builder.create_expr(small).value(), lazy_mapping);
+  EvalState es(lazy_mapping);
+
+  BENCHMARK("clear and evaluate")
+  {
+    es.clear();
+    return eval.evaluate(es, binding_fn);
+  };
+}
+
+TEST_CASE("Result cache over repeating binding sets", "[.][benchmark]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  // Long chain over all unknowns - evaluation cost well above single cache lookup
+  Operand s = builder.get_binding(test_unkwns.get(0));
+
+  for (int round=0; round<8; ++round)
+  {
+    for (std::size_t i=1; i<test_unkwns.size(); ++i)
+    {
+      auto op = (i % 3 == 0)? OperatorKind::mod : (i % 2)? OperatorKind::add : OperatorKind::mul;
+      s = builder.create_sexpr(op, s, builder.get_binding(test_unkwns.get(i)));
+    }
+  }
+
+  auto expr = builder.create_expr(s).value();
+
+  ExprEvaluator eval(expr);
+  EvalState es(eval.mapping());
+  ExprEvaluator::ResultCache cache = eval.create_result_cache(1 << 16);
+
+  // Binding values cycle through 64 distinct sets
+  int shape = 0;
+  auto binding_fn = [&test_unkwns, &shape](uintptr_t p) -> int {
+    return int(test_unkwns.index(p)) + shape + 1;
+  };
+
+  BENCHMARK("bytecode")
+  {
+    shape = (shape + 1) % 64;
+    return eval.evaluate(es, binding_fn);
+  };
+
+  BENCHMARK("bytecode with result cache")
+  {
+    shape = (shape + 1) % 64;
+    return eval.evaluate(es, cache, binding_fn);
+  };
+
+  REQUIRE(cache.stats().hit_rate() > 0.9);
+}
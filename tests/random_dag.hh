@@ -0,0 +1,112 @@
+#pragma once
+
+#include "../expr_builder.hh"
+
+#include "unknowns.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace glfdc;
+
+// Shape of DAG built by random_dag()
+struct RandomDagParams
+{
+  // Bindings of unknowns 0 .. nbindings-1 are first entries of the pool
+  std::size_t nbindings = 6;
+  // Number of nodes added after bindings
+  std::size_t nnodes = 100;
+  // Left operand is one of the last lhs_window entries - builds deep chains
+  std::size_t lhs_window = 4;
+  // Every const_every-th node has constant right operand, every const_lhs_every-th (0 - never) constant
+  // left one, other right operands are any entry of the pool or binding only with rhs_binding_only
+  std::size_t const_every = 3;
+  std::size_t const_lhs_every = 0;
+  bool rhs_binding_only = false;
+  int const_lo = -9;
+  int const_hi = 9;
+
+  // No-overflow policy: value range of every node is derived from [binding_lo, binding_hi] and constants, node
+  // whose range exceeds [-value_limit, value_limit] is drawn again. Evaluating the DAG with binding values in
+  // that range is free of overflow in scalar type with max() >= value_limit. Excluding min() of the type also
+  // excludes min() / -1. value_limit up to 32b max() keeps products of ranges in int64.
+  int binding_lo = -1000;
+  int binding_hi = 1000;
+  std::int64_t value_limit = std::numeric_limits<scalar_type>::max();
+};
+
+// Builds pseudo-random DAG of + - * / % and returns the pool of bindings followed by added nodes. Draws depend
+// on seed and params only, so any builders given the same arguments build the same DAG, entries of their pools
+// correspond.
+template <typename Builder_>
+std::vector<Operand> random_dag(Builder_& builder, const Unknowns& unknowns, unsigned seed,
+                                const RandomDagParams& params = {})
+{
+  using Range = std::pair<std::int64_t, std::int64_t>;
+
+  const OperatorKind ops[] = {OperatorKind('+'), OperatorKind('-'), OperatorKind('*'), OperatorKind('/'),
+                              OperatorKind('%')};
+
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<std::size_t> op_dist(0, std::size(ops) - 1);
+  std::uniform_int_distribution<int> const_dist(params.const_lo, params.const_hi);
+
+  std::vector<Operand> pool;
+  std::vector<Range> ranges;
+
+  for (std::size_t i=0; i<params.nbindings; ++i)
+  {
+    pool.push_back(builder.get_binding(unknowns.get(i)));
+    ranges.emplace_back(params.binding_lo, params.binding_hi);
+  }
+
+  for (std::size_t n=0; n<params.nnodes;)
+  {
+    const std::size_t li = pool.size() - 1 - rng() % std::min(params.lhs_window, pool.size());
+    const std::size_t ri = rng() % (params.rhs_binding_only? params.nbindings : pool.size());
+    const OperatorKind op = ops[op_dist(rng)];
+    const int lc = const_dist(rng);
+    const int rc = const_dist(rng);
+
+    const bool is_lconst = params.const_lhs_every != 0 && (n + 1) % params.const_lhs_every == 0;
+    const bool is_rconst = n % params.const_every == 0;
+
+    const auto [l_lo, l_hi] = is_lconst? Range(lc, lc) : ranges[li];
+    const auto [r_lo, r_hi] = is_rconst? Range(rc, rc) : ranges[ri];
+
+    std::int64_t lo, hi;
+
+    if (op == OperatorKind('+'))
+      lo = l_lo + r_lo, hi = l_hi + r_hi;
+    else if (op == OperatorKind('-'))
+      lo = l_lo - r_hi, hi = l_hi - r_lo;
+    else if (op == OperatorKind('*'))
+    {
+      const std::int64_t p[] = {l_lo * r_lo, l_lo * r_hi, l_hi * r_lo, l_hi * r_hi};
+      lo = *std::min_element(std::begin(p), std::end(p));
+      hi = *std::max_element(std::begin(p), std::end(p));
+    }
+    else
+    {
+      // Quotient and remainder are not larger than dividend in magnitude, division by zero gives 0
+      hi = std::max(-l_lo, l_hi);
+      lo = -hi;
+    }
+
+    if (lo < -params.value_limit || hi > params.value_limit)
+      continue;
+
+    const Operand l = is_lconst? Operand(Value(lc)) : pool[li];
+    const Operand r = is_rconst? Operand(Value(rc)) : pool[ri];
+
+    pool.push_back(builder.create_sexpr(op, l, r));
+    ranges.emplace_back(lo, hi);
+    ++n;
+  }
+
+  return pool;
+}
@@ -1,15 +1,48 @@
 #include "catch2/catch.hpp"
 
+#include "eval.hh"
 #include "expr_builder.hh"
+#include "program.hh"
 
 #include "unknowns.hh"
 
 #include <iostream>
+#include <memory_resource>
 #include <vector>
 
 using namespace glfdc;
 
-auto mk_op = [](char c) -> OperatorKind { return OperatorKind(c); };
+static auto mk_op = [](char c) -> OperatorKind { return OperatorKind(c); };
+
+namespace {
+
+// Forwards to upstream resource and counts allocations
+class counting_resource : public std::pmr::memory_resource
+{
+public:
+  std::size_t allocations = 0;
+  std::size_t deallocations = 0;
+
+private:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override
+  {
+    ++allocations;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+  {
+    ++deallocations;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+  {
+    return this == &other;
+  }
+};
+
+} // namespace anonymous
 
 std::string operator_str(OperatorKind oper)
 {
@@ -124,6 +157,7 @@ TEST_CASE("Verify primitive subexpr", "[build]")
       DYNAMIC_SECTION("Expr " << i << operator_str(op) << test_unk.name(unk))
       {
         ExpressionBuilder builder;
+        builder.set_simplify(false);
      
         Value unbnd = builder.get_binding(unk);
         auto operand = builder.create_sexpr(op, Value(i), unbnd);
@@ -139,6 +173,7 @@ TEST_CASE("Verify primitive subexpr", "[build]")
       DYNAMIC_SECTION("Expr " << test_unk.name(unk) << operator_str(op) << j)
       {
         ExpressionBuilder builder;
+        builder.set_simplify(false);
      
         Value unbnd = builder.get_binding(unk);
         auto operand = builder.create_sexpr(op, unbnd, Value(j));
@@ -154,6 +189,7 @@ TEST_CASE("Verify primitive subexpr", "[build]")
       DYNAMIC_SECTION("Expr " << test_unk.name(unk) << operator_str(op) << j)
       {
         ExpressionBuilder builder;
+        builder.set_simplify(false);
      
         Value unbnd = builder.get_binding(unk);
         auto operand = builder.create_sexpr(op, unbnd, Value(j));
@@ -169,6 +205,7 @@ TEST_CASE("Verify primitive subexpr", "[build]")
       DYNAMIC_SECTION("Expr " << test_unk.name(unk) << operator_str(op) << test_unk.name(unk))
       {
         ExpressionBuilder builder;
+        builder.set_simplify(false);
      
         Value unbnd = builder.get_binding(unk);
         auto operand = builder.create_sexpr(op, unbnd, unbnd);
@@ -191,6 +228,8 @@ TEST_CASE("Verify primitive subexpr", "[build]")
 
       ExpressionBuilder builder;
 
+      builder.set_simplify(false);
+
       auto ud = builder.get_binding(d);
       auto ue = builder.get_binding(e);
       auto uf = builder.get_binding(f);
@@ -382,6 +421,7 @@ TEST_CASE("Complex exprs", "[build]")
   SECTION("mutilevel exprs")
   {
     ExpressionBuilder builder;
+    builder.set_simplify(false);
     auto test_unkwns = alpahabetic_unknowns(); // All single latin letter unknowns
 
     GIVEN("Unknowns x, y, z")
@@ -577,3 +617,321 @@ TEST_CASE("Complex exprs", "[build]")
     }
   }
 }
+
+TEST_CASE("Hash-consing table", "[build]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto ux = builder.get_binding(test_unkwns.get_by_name("x"));
+  auto uy = builder.get_binding(test_unkwns.get_by_name("y"));
+
+  const int n = 5000;
+
+  GIVEN("reserved builder")
+  {
+    builder.reserve(2 * n);
+    const auto reserved = builder.lookup_stats();
+
+    std::vector<Operand> exprs;
+
+    for (int i=0; i<n; ++i)
+    {
+      auto s = builder.create_sexpr(mk_op('*'), ux, Value(i + 2));
+      exprs.push_back(builder.create_sexpr(mk_op('+'), s, uy));
+    }
+
+    const auto stats = builder.lookup_stats();
+
+    THEN("table is not rehashed")
+    {
+      REQUIRE(stats.capacity == reserved.capacity);
+      REQUIRE(stats.size == std::size_t(2 * n));
+      REQUIRE(stats.load_factor <= 0.875);
+      REQUIRE(stats.mean_probe_length <= double(stats.max_probe_length));
+    }
+
+    THEN("same expressions are deduplicated")
+    {
+      for (int i=0; i<n; ++i)
+      {
+        auto s = builder.create_sexpr(mk_op('*'), Value(i + 2), ux);
+        REQUIRE(builder.create_sexpr(mk_op('+'), uy, s) == exprs[i]);
+      }
+
+      REQUIRE(builder.lookup_stats().size == std::size_t(2 * n));
+    }
+  }
+
+  GIVEN("sexpr_table growing from empty")
+  {
+    sexpr_table table;
+
+    REQUIRE(table.empty());
+    REQUIRE(!table.find(SExpr{Value(1), ux, mk_op('+')}).has_value());
+
+    for (int i=0; i<n; ++i)
+      table.insert(SExpr{Value(i), ux, mk_op('-')}, SExprRef(LExprRef{std::size_t(i)}));
+
+    THEN("every key is found")
+    {
+      REQUIRE(table.size() == std::size_t(n));
+
+      for (int i=0; i<n; ++i)
+      {
+        const auto ref = table.find(SExpr{Value(i), ux, mk_op('-')});
+        REQUIRE(ref.has_value());
+        REQUIRE(ref_index(*ref) == std::size_t(i));
+      }
+
+      REQUIRE(!table.find(SExpr{Value(n), ux, mk_op('-')}).has_value());
+      REQUIRE(!table.find(SExpr{Value(0), ux, mk_op('+')}).has_value());
+    }
+  }
+}
+
+TEST_CASE("Binding lookup", "[build]")
+{
+  const Unknowns test_unk{1000};
+
+  ExpressionBuilder builder;
+  builder.reserve_bindings(test_unk.size() / 2);
+
+  std::vector<uintptr_t> addresses;
+
+  for (std::size_t i=0; i<test_unk.size(); ++i)
+    addresses.push_back(test_unk.get(i));
+
+  GIVEN("first half bound one by one")
+  {
+    std::vector<Value> first;
+
+    for (std::size_t i=0; i<addresses.size()/2; ++i)
+      first.push_back(builder.get_binding(addresses[i]));
+
+    WHEN("all bound in bulk")
+    {
+      std::vector<Value> all(addresses.size());
+      builder.get_bindings(addresses.data(), addresses.size(), all.data());
+
+      THEN("existing bindings are found and new ones created in order")
+      {
+        for (std::size_t i=0; i<addresses.size(); ++i)
+        {
+          REQUIRE(std::get<UnboundValue>(all[i]).index_ == i);
+
+          if (i < first.size())
+            REQUIRE(all[i] == first[i]);
+
+          REQUIRE(builder.dag().get_binding(std::get<UnboundValue>(all[i])) == addresses[i]);
+        }
+
+        REQUIRE(builder.dag().unbound_lookup_.size() == addresses.size());
+      }
+    }
+  }
+
+  GIVEN("binding_map")
+  {
+    binding_map map;
+
+    REQUIRE(!map.find(addresses[0]).has_value());
+
+    for (std::size_t i=0; i<addresses.size(); i+=2)
+      map.insert(addresses[i], i);
+
+    THEN("only inserted keys are found")
+    {
+      for (std::size_t i=0; i<addresses.size(); ++i)
+      {
+        auto slot = map.find(addresses[i]);
+
+        REQUIRE(slot.has_value() == (i % 2 == 0));
+
+        if (slot.has_value())
+          REQUIRE(slot.value() == i);
+      }
+    }
+
+    THEN("address 0 is ordinary key")
+    {
+      REQUIRE(!map.find(0).has_value());
+
+      const std::size_t size = map.size();
+      map.insert(0, 42);
+
+      REQUIRE(map.find(0) == std::optional<std::size_t>(42));
+      REQUIRE(map.size() == size + 1);
+      REQUIRE(map.find(addresses[0]) == std::optional<std::size_t>(0));
+
+      map.clear();
+      REQUIRE(!map.find(0).has_value());
+
+      ExpressionBuilder builder;
+      const Value b = builder.get_binding(0);
+
+      REQUIRE(builder.get_binding(0) == b);
+      REQUIRE(builder.add_binding_equivalence(0, 1) == b);
+      REQUIRE(builder.get_binding(1) == b);
+      REQUIRE(builder.dag().unbound_values_.size() == 1);
+    }
+  }
+}
+
+TEST_CASE("Packed subexpressions", "[build]")
+{
+  ExpressionBuilder builder;
+  builder.set_simplify(false);
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto ux = builder.get_binding(test_unkwns.get_by_name("x"));
+  auto uy = builder.get_binding(test_unkwns.get_by_name("y"));
+
+  auto op = GENERATE(mk_op('+'), mk_op('-'), mk_op('*'), mk_op('/'), mk_op('%'));
+  auto i = GENERATE(0, 1, -1, std::numeric_limits<int>::max(), std::numeric_limits<int>::min());
+
+  DYNAMIC_SECTION("Operator " << char(op) << " with scalar " << i)
+  {
+    auto s_1 = builder.create_sexpr(op, ux, Value(i));
+    auto s_2 = builder.create_sexpr(op, Value(i), s_1);
+    auto s_3 = builder.create_sexpr(op, s_2, uy);
+
+    THEN("unpacked node equals packed one")
+    {
+      for (auto s : {s_1, s_2, s_3})
+      {
+        auto ref = std::get<SExprRef>(s);
+        auto e = builder.dag().fetch(ref);
+
+        REQUIRE(PackedSExpr::pack(e) == builder.dag().fetch_packed(ref));
+        REQUIRE(sexpr_eq{}(PackedSExpr::pack(e).unpack(), e));
+        REQUIRE(e.is_unbound() == is_lref(ref));
+      }
+
+      auto e_2 = builder.dag().fetch(std::get<SExprRef>(s_2));
+      REQUIRE((e_2.lhs_ == Operand(Value(i)) || e_2.rhs_ == Operand(Value(i))));
+    }
+  }
+
+  SECTION("Memory footprint")
+  {
+    REQUIRE(sizeof(PackedSExpr) == 12);
+    REQUIRE(sizeof(PackedSExpr) < sizeof(SExpr));
+
+    const std::size_t n = 10000;
+    builder.reserve(n);
+
+    for (std::size_t j=0; j<n; ++j)
+      builder.create_sexpr(mk_op('+'), ux, Value(int(j) + 1));
+
+    const auto& dag = builder.dag();
+    const double bytes_per_node = double(sizeof(PackedSExpr) * (dag.unbound_exprs_.size() + dag.internal_exprs_.size()))
+                                / double(dag.node_count());
+
+    REQUIRE(dag.node_count() == n);
+    REQUIRE(bytes_per_node == 12.0);
+  }
+}
+
+TEST_CASE("Builder reset", "[build]")
+{
+  counting_resource resource;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto ux = test_unkwns.get_by_name("x");
+  auto uy = test_unkwns.get_by_name("y");
+
+  auto build = [&](ExpressionBuilder& builder, int n) {
+    Operand acc = builder.create_sexpr(mk_op('*'), builder.get_binding(ux), builder.get_binding(uy));
+
+    for (int i=1; i<=n; ++i)
+      acc = builder.create_sexpr(mk_op('+'), builder.create_sexpr(mk_op('%'), acc, Value(i)), builder.get_binding(ux));
+
+    return acc;
+  };
+
+  {
+    ExpressionBuilder builder(&resource);
+
+    const auto first = build(builder, 200);
+    const auto nodes = builder.dag().node_count();
+    const auto allocations = resource.allocations;
+
+    REQUIRE(allocations > 0);
+
+    SECTION("reset drops all nodes and bindings")
+    {
+      builder.reset();
+
+      REQUIRE(builder.dag().node_count() == 0);
+      REQUIRE(builder.dag().unbound_values_.empty());
+      REQUIRE(builder.lookup_stats().size == 0);
+      REQUIRE(builder.reuses().first.empty());
+      REQUIRE(builder.reuses().second.empty());
+    }
+
+    SECTION("rebuilding DAG of the same size doesn't allocate")
+    {
+      for (int round=0; round<10; ++round)
+      {
+        builder.reset();
+        const auto again = build(builder, 200);
+
+        REQUIRE(again == first);
+        REQUIRE(builder.dag().node_count() == nodes);
+      }
+
+      REQUIRE(resource.allocations == allocations);
+    }
+
+    SECTION("evaluator storage comes from given resource")
+    {
+      auto e = builder.create_expr(first).value();
+
+      const auto before = resource.allocations;
+      ExprEvaluator eval(e, &resource);
+
+      REQUIRE(resource.allocations > before);
+
+      const auto mapping = ReusedExprMapping::create_eager_mapping();
+      EvalState es(mapping);
+      auto binding_fn = [&](uintptr_t p) -> int { return int(test_unkwns.index(p)) + 1; };
+
+      REQUIRE(eval.evaluate(es, binding_fn) == eval.evaluate_reference(es, binding_fn));
+    }
+
+    SECTION("program storage comes from given resource")
+    {
+      auto e = builder.create_expr(first).value();
+
+      const auto before = resource.allocations;
+      ExprProgram program({e}, &resource);
+
+      REQUIRE(resource.allocations > before);
+      REQUIRE(program.code().get_allocator().resource() == &resource);
+
+      const auto mapping = ReusedExprMapping::create_eager_mapping();
+      EvalState es(mapping);
+      auto binding_fn = [&](uintptr_t p) -> int { return int(test_unkwns.index(p)) + 1; };
+
+      int result;
+      program.evaluate(es, binding_fn, &result);
+
+      ExprEvaluator eval(e);
+      REQUIRE(result == eval.evaluate(es, binding_fn));
+    }
+  }
+
+  REQUIRE(resource.allocations == resource.deallocations);
+
+  SECTION("monotonic buffer")
+  {
+    std::pmr::monotonic_buffer_resource arena;
+    ExpressionBuilder builder(&arena);
+
+    const auto r = build(builder, 50);
+
+    REQUIRE(builder.create_expr(r).has_value());
+    REQUIRE(builder.dag().node_count() > 50);
+  }
+}
@@ -0,0 +1,134 @@
+#include "../concurrent_builder.hh"
+#include "../eval.hh"
+#include "../expr_builder.hh"
+
+#include "random_dag.hh"
+#include "unknowns.hh"
+
+#include "catch2/catch.hpp"
+
+#include <thread>
+
+using namespace glfdc;
+
+namespace {
+
+// Builds pseudo-random kernel over bindings, the same for the same seed
+template <typename Builder_>
+Operand build_kernel(Builder_& builder, const Unknowns& unknowns, unsigned seed, std::size_t size)
+{
+  RandomDagParams params;
+  params.nbindings = 8;
+  params.nnodes = size;
+  // Right operand is leaf - keeps ExpressionBuilder::mark_reuse() cheap
+  params.rhs_binding_only = true;
+  params.const_lo = 2;
+
+  return random_dag(builder, unknowns, seed, params).back();
+}
+
+} // namespace anonymous
+
+TEST_CASE("Concurrent builder", "[build][concurrent]")
+{
+  auto test_unkwns = alpahabetic_unknowns();
+
+  SECTION("single thread builds the same DAG as ExpressionBuilder")
+  {
+    ExpressionBuilder builder;
+    builder.set_simplify(false);
+
+    ConcurrentExpressionBuilder concurrent(8);
+    REQUIRE(concurrent.shard_count() == 8);
+
+    for (unsigned seed=1; seed<=4; ++seed)
+    {
+      const Operand expected = build_kernel(builder, test_unkwns, seed, 200);
+      REQUIRE(build_kernel(concurrent, test_unkwns, seed, 200) == expected);
+    }
+
+    const ExprDAG& dag = concurrent.finish();
+
+    REQUIRE(dag.unbound_exprs_ == builder.dag().unbound_exprs_);
+    REQUIRE(dag.internal_exprs_ == builder.dag().internal_exprs_);
+    REQUIRE(dag.unbound_values_ == builder.dag().unbound_values_);
+
+    REQUIRE(concurrent.reuses().first == builder.reuses().first);
+    REQUIRE(concurrent.reuses().second == builder.reuses().second);
+  }
+
+  SECTION("threads dedupe identical subexpressions")
+  {
+    constexpr std::size_t nthreads = 4;
+    constexpr unsigned nkernels = 16;
+
+    ConcurrentExpressionBuilder concurrent;
+
+    // Every thread builds all kernels, each starting at different one
+    std::vector<std::vector<Operand>> roots(nthreads, std::vector<Operand>(nkernels));
+    std::vector<std::thread> threads;
+
+    for (std::size_t t=0; t<nthreads; ++t)
+    {
+      threads.emplace_back([&, t] {
+        for (unsigned k=0; k<nkernels; ++k)
+        {
+          const unsigned kernel = unsigned(k + t * 5) % nkernels;
+          roots[t][kernel] = build_kernel(concurrent, test_unkwns, kernel + 1, 300);
+        }
+      });
+    }
+
+    for (auto& t : threads)
+      t.join();
+
+    for (std::size_t t=1; t<nthreads; ++t)
+      REQUIRE(roots[t] == roots[0]);
+
+    ExpressionBuilder builder;
+    builder.set_simplify(false);
+
+    std::vector<Operand> serial_roots;
+
+    for (unsigned k=0; k<nkernels; ++k)
+      serial_roots.push_back(build_kernel(builder, test_unkwns, k + 1, 300));
+
+    REQUIRE(concurrent.node_count() == builder.dag().node_count());
+
+    concurrent.finish();
+
+    REQUIRE(concurrent.dag().unbound_values_.size() == builder.dag().unbound_values_.size());
+
+    // Node order differs, values don't
+    auto binding_fn = [&test_unkwns](uintptr_t p) -> int {
+      return int(test_unkwns.index(p)) * 3 - 31;
+    };
+
+    auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+    EvalState es(eager_mapping);
+
+    for (unsigned k=0; k<nkernels; ++k)
+    {
+      if (is_value(roots[0][k]))
+      {
+        REQUIRE(is_value(serial_roots[k]));
+        continue;
+      }
+
+      const Expr e = concurrent.create_expr(roots[0][k]).value();
+      const Expr serial_e = builder.create_expr(serial_roots[k]).value();
+
+      REQUIRE(ExprEvaluator(e).evaluate(es, binding_fn) == ExprEvaluator(serial_e).evaluate(es, binding_fn));
+    }
+
+    THEN("lazy mapping of published DAG evaluates the same")
+    {
+      auto lazy_mapping = std::apply(ReusedExprMapping::create_lazy_mapping, concurrent.reuses());
+      EvalState lazy_es(lazy_mapping);
+
+      const Expr e = concurrent.create_expr(roots[0][3]).value();
+
+      REQUIRE(ExprEvaluator(e, lazy_mapping).evaluate(lazy_es, binding_fn) == ExprEvaluator(e).evaluate(es, binding_fn));
+    }
+  }
+}
@@ -2,16 +2,24 @@
 #include "../expr_builder.hh"
 
 #include "../cfold.hh"
+#include "../divisor.hh"
+#include "../kernels.hh"
+#include "../program.hh"
 
+#include "random_dag.hh"
 #include "unknowns.hh"
 
 #include "catch2/catch.hpp"
 
+#include <cstdlib>
 #include <iostream>
+#include <limits>
+#include <memory_resource>
+#include <random>
 
 using namespace glfdc;
 
-auto mk_op = [](char c) -> OperatorKind { return OperatorKind(c); };
+static auto mk_op = [](char c) -> OperatorKind { return OperatorKind(c); };
 
 TEST_CASE("Expression evalution", "[eval]")
 { 
@@ -46,6 +54,7 @@ TEST_CASE("Expression evalution", "[eval]")
                        << char(op3) << " (y " << char(op2) << " " << j << ")")
        {
          ExpressionBuilder builder;
+         builder.set_simplify(false);
 
          auto test_unkwns = alpahabetic_unknowns();
 
@@ -92,6 +101,7 @@ TEST_CASE("Expression evalution", "[eval]")
          GIVEN("lazy mapping")
          {
             ExpressionBuilder builder;
+            builder.set_simplify(false);
 
 #        define DECLARE_unknown(_n) auto _n = test_unkwns.get_by_name(#_n); auto u ## _n = builder.get_binding(_n);
          DECLARE_unknown(x);
@@ -111,3 +121,724 @@ TEST_CASE("Expression evalution", "[eval]")
      }
   }
 }
+
+TEST_CASE("Bytecode evaluation", "[eval]")
+{
+  auto op1 = GENERATE(mk_op('+'), mk_op('-'), mk_op('*'), mk_op('/'), mk_op('%'));
+  auto op2 = GENERATE(mk_op('+'), mk_op('-'), mk_op('*'), mk_op('/'), mk_op('%'));
+
+  // Values of x, y, z: -17, -16, -15 and 6, 8, 10 - every intermediate result fits int
+  auto scale = GENERATE(1, 2);
+
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  // Bind each unknown to value derived from its position in alphabet
+  auto binding_fn = [&test_unkwns, scale](uintptr_t p) -> int {
+    return int(test_unkwns.index(p)) * scale - 40;
+  };
+
+# define DECLARE_unknown(_n) auto _n = test_unkwns.get_by_name(#_n); auto u ## _n = builder.get_binding(_n);
+  DECLARE_unknown(x);
+  DECLARE_unknown(y);
+  DECLARE_unknown(z);
+# undef DECLARE_unknown
+
+  auto s_1 = builder.create_sexpr(op1, ux, Value(3));
+  auto s_2 = builder.create_sexpr(op2, Value(-5), uy);
+  auto s_3 = builder.create_sexpr(op2, s_1, s_2);
+  auto s_4 = builder.create_sexpr(op1, s_3, s_1);
+  auto s_5 = builder.create_sexpr(mk_op('-'), uz, s_3);
+  auto s_6 = builder.create_sexpr(op1, s_4, s_5);
+
+  auto e_6 = builder.create_expr(s_6).value();
+  auto e_4 = builder.create_expr(s_4).value();
+
+  DYNAMIC_SECTION("Expression ops: " << char(op1) << " " << char(op2) << " scale: " << scale)
+  {
+    auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+    auto lazy_mapping = std::apply(ReusedExprMapping::create_lazy_mapping, builder.reuses());
+
+    REQUIRE(!lazy_mapping.empty());
+
+    EvalState es(eager_mapping);
+    EvalState lazy_es(lazy_mapping);
+
+    ExprEvaluator eval_e_6(e_6);
+    ExprEvaluator lazy_eval_e_6(e_6, lazy_mapping);
+    ExprEvaluator lazy_eval_e_4(e_4, lazy_mapping);
+
+    const int expected = eval_e_6.evaluate_reference(es, binding_fn);
+
+    // Reference in int64 - nothing overflowed
+    const BasicExprEvaluator<std::int64_t> eval64_e_6(e_6);
+    BasicEvalState<std::int64_t> es64(eager_mapping);
+    REQUIRE(eval64_e_6.evaluate(es64, [&](uintptr_t p) -> std::int64_t { return binding_fn(p); }) == expected);
+
+    THEN("bytecode matches reference evaluation")
+    {
+      REQUIRE(eval_e_6.evaluate(es, binding_fn) == expected);
+    }
+
+    THEN("subexpression with scalar right operand matches reference evaluation")
+    {
+      auto s_7 = builder.create_sexpr(op2, s_4, Value(7));
+      auto e_7 = builder.create_expr(s_7).value();
+
+      ExprEvaluator eval_e_7(e_7);
+
+      REQUIRE(eval_e_7.evaluate(es, binding_fn) == eval_e_7.evaluate_reference(es, binding_fn));
+    }
+
+    THEN("bindings indexed by UnboundValue give the same result")
+    {
+      std::vector<int> binding_values;
+
+      for (auto binding : builder.dag().unbound_values_)
+        binding_values.push_back(binding_fn(binding));
+
+      REQUIRE(eval_e_6.evaluate(es, binding_values.data()) == expected);
+    }
+
+    THEN("bytecode of each distinct binding is resolved once")
+    {
+      REQUIRE(eval_e_6.bytecode().bindings().size() == 3);
+      REQUIRE(!eval_e_6.bytecode().is_memoized());
+      REQUIRE(lazy_eval_e_6.bytecode().is_memoized());
+    }
+
+    THEN("lazy bytecode matches reference evaluation")
+    {
+      const int expected_e4 = lazy_eval_e_4.evaluate_reference(es, binding_fn);
+
+      REQUIRE(lazy_eval_e_6.evaluate(lazy_es, binding_fn) == expected);
+      // Served from memo
+      REQUIRE(lazy_eval_e_4.evaluate(lazy_es, binding_fn) == expected_e4);
+      REQUIRE(lazy_eval_e_6.evaluate(lazy_es, binding_fn) == expected);
+
+      lazy_es.clear();
+
+      REQUIRE(lazy_eval_e_4.evaluate(lazy_es, binding_fn) == expected_e4);
+      REQUIRE(lazy_eval_e_6.evaluate(lazy_es, binding_fn) == expected);
+    }
+  }
+}
+
+TEST_CASE("Batch kernels", "[eval]")
+{
+  auto op = GENERATE(mk_op('+'), mk_op('-'), mk_op('*'), mk_op('/'), mk_op('%'));
+  auto n = GENERATE(1, 7, 64, 101);
+
+  DYNAMIC_SECTION("Operator " << char(op) << " over " << n << " lanes using " << detail::batch_isa())
+  {
+    std::mt19937 gen(n);
+    std::uniform_int_distribution<int> dist(-1000, 1000);
+
+    std::vector<int> l(n), r(n), out(n);
+
+    for (int i=0; i<n; ++i)
+    {
+      l[i] = dist(gen);
+      // Make sure to hit zero divisors
+      r[i] = (i % 5 == 0)? 0 : dist(gen);
+    }
+
+    const OpCode codes[] = {OpCode::add, OpCode::sub, OpCode::mul, OpCode::div, OpCode::mod};
+    const OperatorKind kinds[] = {OperatorKind::add, OperatorKind::sub, OperatorKind::mul,
+                                  OperatorKind::div, OperatorKind::mod};
+
+    const auto kind_idx = std::size_t(std::find(std::begin(kinds), std::end(kinds), op) - std::begin(kinds));
+
+    detail::batch_apply(codes[kind_idx], l.data(), r.data(), out.data(), out.size());
+
+    THEN("results match cfold")
+    {
+      for (int i=0; i<n; ++i)
+        REQUIRE(out[i] == cfold(op, l[i], r[i]));
+    }
+  }
+}
+
+TEST_CASE("Batched evaluation", "[eval]")
+{
+  auto op1 = GENERATE(mk_op('+'), mk_op('-'), mk_op('*'), mk_op('/'), mk_op('%'));
+  auto op2 = GENERATE(mk_op('+'), mk_op('-'), mk_op('*'), mk_op('/'), mk_op('%'));
+
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+# define DECLARE_unknown(_n) auto _n = test_unkwns.get_by_name(#_n); auto u ## _n = builder.get_binding(_n);
+  DECLARE_unknown(x);
+  DECLARE_unknown(y);
+  DECLARE_unknown(z);
+# undef DECLARE_unknown
+
+  auto s_1 = builder.create_sexpr(op1, ux, Value(3));
+  auto s_2 = builder.create_sexpr(op2, uz, uy);
+  auto s_3 = builder.create_sexpr(op2, s_1, s_2);
+  auto s_4 = builder.create_sexpr(op1, s_3, s_1);
+  auto s_5 = builder.create_sexpr(mk_op('-'), s_4, Value(7));
+
+  auto e_5 = builder.create_expr(s_5).value();
+
+  DYNAMIC_SECTION("Expression ops: " << char(op1) << " " << char(op2))
+  {
+    const std::size_t nlanes = 203;
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> dist(-50, 50);
+
+    // Column per UnboundValue
+    std::vector<std::vector<int>> columns(builder.dag().unbound_values_.size(), std::vector<int>(nlanes));
+    std::vector<const int*> column_ptrs;
+
+    for (auto& c : columns)
+    {
+      std::generate(c.begin(), c.end(), [&] { return dist(gen); });
+      column_ptrs.push_back(c.data());
+    }
+
+    auto lazy_mapping = std::apply(ReusedExprMapping::create_lazy_mapping, builder.reuses());
+
+    EvalState es(lazy_mapping);
+    ExprEvaluator eval_e_5(e_5, lazy_mapping);
+
+    std::vector<int> results(nlanes);
+    eval_e_5.evaluate_batch(es, column_ptrs.data(), nlanes, results.data());
+
+    THEN("every lane matches scalar evaluation")
+    {
+      for (std::size_t lane=0; lane<nlanes; ++lane)
+      {
+        auto binding_fn = [&](uintptr_t p) -> int {
+          auto ubv = std::get<UnboundValue>(builder.get_binding(p));
+          return columns[ubv.index_][lane];
+        };
+
+        es.clear();
+        REQUIRE(results[lane] == eval_e_5.evaluate(es, binding_fn));
+      }
+    }
+  }
+}
+
+TEST_CASE("Shared subexpressions", "[eval]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto ux = builder.get_binding(test_unkwns.get_by_name("x"));
+  auto uy = builder.get_binding(test_unkwns.get_by_name("y"));
+
+  auto binding_fn = [&test_unkwns](uintptr_t p) -> int { return int(test_unkwns.index(p)) + 3; };
+
+  const int x = binding_fn(test_unkwns.get_by_name("x"));
+  const int y = binding_fn(test_unkwns.get_by_name("y"));
+
+  SECTION("doubling DAG is linearized once per node")
+  {
+    // s_k = (s_k-1 * s_k-1) % 1009 - expression tree of 64 levels would have 2^65 leaves
+    constexpr int levels = 64;
+
+    Operand s = builder.create_sexpr(mk_op('+'), ux, uy);
+    int expected = x + y;
+
+    for (int k=0; k<levels; ++k)
+    {
+      s = builder.create_sexpr(mk_op('%'), builder.create_sexpr(mk_op('*'), s, s), Value(1009));
+      expected = (expected * expected) % 1009;
+    }
+
+    const Expr e = builder.create_expr(s).value();
+
+    auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+    auto lazy_mapping = std::apply(ReusedExprMapping::create_lazy_mapping, builder.reuses());
+
+    for (const ReusedExprMapping* mapping : {&eager_mapping, &lazy_mapping})
+    {
+      const ExprEvaluator eval(e, *mapping);
+      EvalState es(*mapping);
+
+      REQUIRE(eval.operations().size() == 1 + 2 * levels);
+      REQUIRE(eval.operations().back().ref == std::get<SExprRef>(s));
+
+      // Each node once, at most with memo load and register store
+      REQUIRE(eval.bytecode().code().size() <= 3 * eval.operations().size());
+      REQUIRE(eval.bytecode().register_count() == levels);
+
+      REQUIRE(eval.evaluate(es, binding_fn) == expected);
+      es.clear();
+      REQUIRE(eval.evaluate_reference(es, binding_fn) == expected);
+
+      const int col_x[] = {x, x}, col_y[] = {y, y};
+      const int* columns[] = {col_x, col_y};
+      int results[2];
+
+      eval.evaluate_batch(es, columns, 2, results);
+
+      REQUIRE(results[0] == expected);
+      REQUIRE(results[1] == expected);
+    }
+  }
+
+  SECTION("register written in code skipped by memo hit")
+  {
+    auto s_1 = builder.create_sexpr(mk_op('*'), ux, uy);
+    auto s_2 = builder.create_sexpr(mk_op('-'), s_1, ux);
+    auto s_3 = builder.create_sexpr(mk_op('-'), s_2, s_1);
+
+    const Expr e = builder.create_expr(s_3).value();
+
+    // Only s_2 is memoized - s_1 is evaluated within its code, skipped once s_2 is memoized
+    auto [reused_unbound, reused_internal] = builder.reuses();
+    bitvector_t only_s_2(reused_unbound.size(), false);
+    only_s_2[ref_index(std::get<SExprRef>(s_2))] = true;
+
+    REQUIRE(is_lref(std::get<SExprRef>(s_2)));
+
+    auto mapping = ReusedExprMapping::create_lazy_mapping(only_s_2, bitvector_t(reused_internal.size(), false));
+    REQUIRE(mapping.size() == 1);
+
+    const ExprEvaluator eval(e, mapping);
+    EvalState es(mapping);
+
+    const int expected = (x * y - x) - x * y;
+
+    REQUIRE(eval.evaluate(es, binding_fn) == expected);
+    // s_2 memoized - s_1 is evaluated again past skipped code
+    REQUIRE(eval.evaluate(es, binding_fn) == expected);
+    REQUIRE(eval.evaluate_reference(es, binding_fn) == expected);
+
+    REQUIRE(std::count_if(eval.bytecode().code().begin(), eval.bytecode().code().end(), [](const Instruction& instr) {
+      return instr.code_ == OpCode::mul;
+    }) == 2);
+  }
+}
+
+TEST_CASE("Deep expressions", "[eval]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto uy = builder.get_binding(test_unkwns.get_by_name("y"));
+  auto uz = builder.get_binding(test_unkwns.get_by_name("z"));
+
+  auto binding_fn = [&test_unkwns](uintptr_t p) -> int { return int(test_unkwns.index(p)) + 3; };
+
+  const int y = binding_fn(test_unkwns.get_by_name("y"));
+  const int z = binding_fn(test_unkwns.get_by_name("z"));
+
+  // Left deep chain of unrolled reduction ((((y * y) + z) % 10007) * y) ..., far deeper than native
+  // stack would allow to traverse recursively
+  constexpr int depth = 1000000;
+
+  Operand s = uy;
+  int expected = y;
+
+  for (int k=0; k<depth; ++k)
+  {
+    switch (k % 3)
+    {
+    case 0:
+      s = builder.create_sexpr(mk_op('*'), s, uy);
+      expected *= y;
+      break;
+    case 1:
+      s = builder.create_sexpr(mk_op('+'), s, uz);
+      expected += z;
+      break;
+    default:
+      s = builder.create_sexpr(mk_op('%'), s, Value(10007));
+      expected %= 10007;
+      break;
+    }
+  }
+
+  const Expr e = builder.create_expr(s).value();
+
+  auto lazy_mapping = std::apply(ReusedExprMapping::create_lazy_mapping, builder.reuses());
+  REQUIRE(lazy_mapping.size() == depth - 1);
+
+  const ExprEvaluator eval(e);
+  const ExprEvaluator lazy_eval(e, lazy_mapping);
+
+  REQUIRE(eval.operations().size() == depth);
+
+  auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+
+  EvalState es(eager_mapping);
+  EvalState lazy_es(lazy_mapping);
+
+  REQUIRE(eval.evaluate(es, binding_fn) == expected);
+  REQUIRE(eval.evaluate_reference(es, binding_fn) == expected);
+
+  REQUIRE(lazy_eval.evaluate(lazy_es, binding_fn) == expected);
+  lazy_es.clear();
+  REQUIRE(lazy_eval.evaluate_reference(lazy_es, binding_fn) == expected);
+
+  const ExprProgram program({e});
+  int result = 0;
+
+  program.evaluate(es, binding_fn, &result);
+  REQUIRE(result == expected);
+}
+
+TEST_CASE("Evaluation state memo", "[eval]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto ux = builder.get_binding(test_unkwns.get_by_name("x"));
+  auto uy = builder.get_binding(test_unkwns.get_by_name("y"));
+
+  auto s_1 = builder.create_sexpr(mk_op('*'), ux, uy);
+  auto s_2 = builder.create_sexpr(mk_op('-'), s_1, ux);
+  auto s_3 = builder.create_sexpr(mk_op('*'), s_1, s_2);
+
+  const Expr e = builder.create_expr(s_3).value();
+
+  auto lazy_mapping = std::apply(ReusedExprMapping::create_lazy_mapping, builder.reuses());
+  REQUIRE(lazy_mapping.size() == 2);
+
+  const std::size_t slot = lazy_mapping.slot(std::get<SExprRef>(s_1)).value();
+
+  SECTION("clear forgets memoized values")
+  {
+    EvalState es(lazy_mapping);
+
+    REQUIRE(es.slot(std::get<SExprRef>(s_1)) == slot);
+    REQUIRE(!es.slot(std::get<SExprRef>(s_3)).has_value());
+    REQUIRE(!es.has_value(slot));
+
+    for (int i=0; i<3; ++i)
+    {
+      es.store(slot, 42 + i);
+
+      REQUIRE(es.has_value(slot));
+      REQUIRE(es.value(slot) == 42 + i);
+
+      const EvalState copy = es;
+      es.clear();
+
+      REQUIRE(!es.has_value(slot));
+      REQUIRE(copy.value(slot) == 42 + i);
+    }
+  }
+
+  SECTION("states are allocated from single arena")
+  {
+    constexpr std::size_t nstates = 16;
+
+    // Memo of all states fits into buffer - nothing allocated beyond it
+    std::vector<std::byte> buffer(nstates * EvalState::memo_size(lazy_mapping));
+    std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size(), std::pmr::null_memory_resource());
+
+    std::vector<EvalState> states;
+    states.reserve(nstates);
+
+    for (std::size_t i=0; i<nstates; ++i)
+      states.emplace_back(lazy_mapping, &arena);
+
+    const ExprEvaluator eval(e, lazy_mapping);
+    auto binding_fn = [&test_unkwns](uintptr_t p) -> int { return int(test_unkwns.index(p)) + 3; };
+
+    // Memo slots are resolved once by evaluator
+    for (const Operation& op : eval.operations())
+    {
+      const auto memo_slot = lazy_mapping.slot(op.ref);
+      REQUIRE(op.memo_slot == (memo_slot.has_value()? std::uint32_t(*memo_slot) : Operation::NO_SLOT));
+    }
+
+    const int expected = eval.evaluate_reference(states.front(), binding_fn);
+
+    for (EvalState& es : states)
+    {
+      REQUIRE(eval.evaluate(es, binding_fn) == expected);
+      REQUIRE(es.has_value(slot));
+    }
+  }
+}
+
+TEST_CASE("Constant divisors", "[eval]")
+{
+  constexpr int min = std::numeric_limits<int>::min();
+  constexpr int max = std::numeric_limits<int>::max();
+
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<int> full(min, max);
+  std::uniform_int_distribution<int> small(-300, 300);
+  // Neither x - y nor sum of two quotients by divisor 1 or -1 may overflow
+  std::uniform_int_distribution<int> wide(min / 2 + 1000, max / 2 - 1000);
+
+  std::vector<int> dividends = {0, 1, -1, 2, -2, 7, -7, max, min, max - 1, min + 1};
+
+  for (int i=0; i<500; ++i)
+    dividends.push_back(i % 2? full(gen) : small(gen));
+
+  SECTION("powers of two match cfold")
+  {
+    for (unsigned k=0; k<31; ++k)
+    {
+      const int d = 1 << k;
+      REQUIRE(detail::pow2_shift(d) == k);
+
+      for (int n : dividends)
+      {
+        REQUIRE(detail::div_pow2(n, k) == cfold(OperatorKind::div, n, d));
+        REQUIRE(detail::mod_pow2(n, k) == cfold(OperatorKind::mod, n, d));
+      }
+    }
+
+    REQUIRE(!detail::pow2_shift(0).has_value());
+    REQUIRE(!detail::pow2_shift(-4).has_value());
+    REQUIRE(!detail::pow2_shift(12).has_value());
+  }
+
+  SECTION("magic numbers match cfold")
+  {
+    std::vector<int> divisors = {2, -2, 3, -3, 5, 6, 7, -7, 10, 25, 125, 641, -1000, max, min, min + 1, 1 << 30};
+
+    for (int i=0; i<300; ++i)
+      divisors.push_back(i % 2? full(gen) : small(gen));
+
+    for (int d : divisors)
+    {
+      if (d >= -1 && d <= 1)
+        continue;
+
+      const DivMagic magic = DivMagic::create(d);
+
+      for (int n : dividends)
+      {
+        REQUIRE(magic.div(n) == cfold(OperatorKind::div, n, d));
+        REQUIRE(magic.mod(n) == cfold(OperatorKind::mod, n, d));
+      }
+    }
+  }
+
+  SECTION("evaluator emits specialized instructions")
+  {
+    auto op = GENERATE(mk_op('/'), mk_op('%'));
+    auto d = GENERATE(-16, -5, -1, 0, 1, 2, 3, 8, 10, 64, 1000, 1 << 20);
+
+    ExpressionBuilder builder;
+    // Keep trivial divisors to exercise generic instructions too
+    builder.set_simplify(false);
+
+    auto test_unkwns = alpahabetic_unknowns();
+
+    auto ux = builder.get_binding(test_unkwns.get_by_name("x"));
+    auto uy = builder.get_binding(test_unkwns.get_by_name("y"));
+
+    auto s_1 = builder.create_sexpr(mk_op('-'), ux, uy);
+    auto s_2 = builder.create_sexpr(op, s_1, Value(d));
+    auto s_3 = builder.create_sexpr(op, ux, Value(d));
+    auto s_4 = builder.create_sexpr(mk_op('+'), s_2, s_3);
+
+    auto e_4 = builder.create_expr(s_4).value();
+
+    auto mapping = ReusedExprMapping::create_eager_mapping();
+    EvalState es(mapping);
+
+    ExprEvaluator eval(e_4);
+
+    DYNAMIC_SECTION("Expression (x - y) " << char(op) << " " << d << " + x " << char(op) << " " << d)
+    {
+      const auto& code = eval.bytecode().code();
+      const auto specialized = std::count_if(code.begin(), code.end(), [](const Instruction& instr) {
+        return instr.code_ == OpCode::div_pow2 || instr.code_ == OpCode::mod_pow2 ||
+               instr.code_ == OpCode::div_magic || instr.code_ == OpCode::mod_magic;
+      });
+
+      REQUIRE(specialized == ((d >= -1 && d <= 1)? 0 : 2));
+
+      for (const Instruction& instr : code)
+      {
+        if (instr.code_ == OpCode::div_pow2 || instr.code_ == OpCode::mod_pow2)
+        {
+          REQUIRE(instr.rhs_kind_ == ArgKind::imm);
+          REQUIRE((1 << instr.rhs_.imm_) == std::abs(d));
+        }
+      }
+
+      for (int i=0; i<200; ++i)
+      {
+        const int x = i % 2? wide(gen) : small(gen);
+        const int y = small(gen);
+
+        auto binding_fn = [&](uintptr_t p) -> int {
+          return p == test_unkwns.get_by_name("x")? x : y;
+        };
+
+        REQUIRE(eval.evaluate(es, binding_fn) == eval.evaluate_reference(es, binding_fn));
+      }
+
+      THEN("batched evaluation matches too")
+      {
+        const std::size_t nlanes = 100;
+        std::vector<int> xs(nlanes), ys(nlanes), results(nlanes);
+
+        std::generate(xs.begin(), xs.end(), [&] { return wide(gen); });
+        std::generate(ys.begin(), ys.end(), [&] { return small(gen); });
+
+        const int* columns[] = {xs.data(), ys.data()};
+        eval.evaluate_batch(es, columns, nlanes, results.data());
+
+        for (std::size_t lane=0; lane<nlanes; ++lane)
+        {
+          const int values[] = {xs[lane], ys[lane]};
+          REQUIRE(results[lane] == eval.evaluate(es, values));
+        }
+      }
+    }
+  }
+}
+
+TEMPLATE_TEST_CASE("Evaluation in other scalar types", "[eval]", std::int16_t, std::int32_t, std::int64_t)
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  RandomDagParams params;
+  params.nnodes = 150;
+  params.lhs_window = 6;
+  params.const_lo = 2;
+  params.const_hi = 301;
+  params.value_limit = std::min<std::int64_t>(std::numeric_limits<TestType>::max(),
+                                              std::numeric_limits<scalar_type>::max());
+
+  const std::vector<Operand> pool = random_dag(builder, test_unkwns, 19, params);
+
+  const Expr e = builder.create_expr(pool.back()).value();
+  auto lazy_mapping = std::apply(ReusedExprMapping::create_lazy_mapping, builder.reuses());
+
+  const BasicExprEvaluator<TestType> eager(e);
+  const BasicExprEvaluator<TestType> lazy(e, lazy_mapping);
+
+  REQUIRE(eager.bytecode().template fits<TestType>());
+
+  auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+  BasicEvalState<TestType> eager_es(eager_mapping);
+  BasicEvalState<TestType> lazy_es(lazy_mapping);
+
+  constexpr std::size_t nlanes = 100;
+  const std::size_t nunbound = builder.dag().unbound_values_.size();
+
+  std::mt19937 rng(19);
+  std::vector<std::vector<TestType>> columns(nunbound, std::vector<TestType>(nlanes));
+
+  for (auto& column : columns)
+  {
+    for (auto& v : column)
+      v = TestType(int(rng() % 2001) - 1000);
+  }
+
+  std::vector<const TestType*> column_ptrs;
+
+  for (const auto& column : columns)
+    column_ptrs.push_back(column.data());
+
+  std::vector<TestType> results(nlanes);
+  lazy.evaluate_batch(lazy_es, column_ptrs.data(), nlanes, results.data());
+
+  for (std::size_t lane=0; lane<nlanes; ++lane)
+  {
+    auto binding_fn = [&](uintptr_t p) -> TestType {
+      return columns[std::get<UnboundValue>(builder.get_binding(p)).index_][lane];
+    };
+
+    const TestType expected = eager.evaluate_reference(eager_es, binding_fn);
+
+    REQUIRE(eager.evaluate(eager_es, binding_fn) == expected);
+    REQUIRE(results[lane] == expected);
+
+    lazy_es.clear();
+    REQUIRE(lazy.evaluate(lazy_es, binding_fn) == expected);
+  }
+}
+
+TEST_CASE("Scalar type width", "[eval]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto ux = builder.get_binding(test_unkwns.get_by_name("x"));
+  auto uy = builder.get_binding(test_unkwns.get_by_name("y"));
+  auto uz = builder.get_binding(test_unkwns.get_by_name("z"));
+
+  // (x * y * z) / 8 + (x * y) % 1000
+  auto s_xy = builder.create_sexpr(mk_op('*'), ux, uy);
+  auto s_xyz = builder.create_sexpr(mk_op('*'), s_xy, uz);
+  auto s_div = builder.create_sexpr(mk_op('/'), s_xyz, Value(8));
+  auto s_mod = builder.create_sexpr(mk_op('%'), s_xy, Value(1000));
+  auto s_root = builder.create_sexpr(mk_op('+'), s_div, s_mod);
+
+  const Expr e = builder.create_expr(s_root).value();
+  auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+
+  SECTION("int64 doesn't overflow on large dims")
+  {
+    const BasicExprEvaluator<std::int64_t> eval(e);
+    BasicEvalState<std::int64_t> es(eager_mapping);
+
+    const std::int64_t xy = std::int64_t(65535) * 65535;
+    const std::int64_t expected = xy * 65535 / 8 + xy % 1000;
+
+    REQUIRE(eval.evaluate(es, [](uintptr_t) -> std::int64_t { return 65535; }) == expected);
+    // x * y alone exceeds int
+    REQUIRE(xy > std::numeric_limits<int>::max());
+  }
+
+  SECTION("int16 wraps around like int16 arithmetic")
+  {
+    const BasicExprEvaluator<std::int16_t> eval(e);
+    BasicEvalState<std::int16_t> es(eager_mapping);
+
+    auto wrap = [](int v) { return std::int16_t(v); };
+
+    const std::int16_t xy = wrap(300 * 300);
+    const std::int16_t expected = wrap(wrap(xy * 300) / 8 + xy % 1000);
+
+    REQUIRE(eval.evaluate(es, [](uintptr_t) -> std::int16_t { return 300; }) == expected);
+  }
+
+  SECTION("int16 evaluates simplified constant chains")
+  {
+    ExpressionBuilder simplifying;
+    auto sx = simplifying.get_binding(test_unkwns.get_by_name("x"));
+
+    // Folded into x * 40000 and x + 60000 - constants out of int16 range
+    auto s_mul = simplifying.create_sexpr(mk_op('*'), simplifying.create_sexpr(mk_op('*'), sx, Value(200)), Value(200));
+    auto s_add = simplifying.create_sexpr(mk_op('+'), simplifying.create_sexpr(mk_op('+'), sx, Value(30000)), Value(30000));
+    auto s_sum = simplifying.create_sexpr(mk_op('-'), s_mul, s_add);
+
+    REQUIRE(simplifying.rewrite_count() > 0);
+
+    const BasicExprEvaluator<std::int16_t> eval(simplifying.create_expr(s_sum).value());
+    BasicEvalState<std::int16_t> es(eager_mapping);
+
+    auto wrap = [](int v) { return std::int16_t(v); };
+
+    for (int x : {-300, -7, 0, 3, 300, 32767})
+    {
+      const std::int16_t expected = wrap(wrap(wrap(x * 200) * 200) - wrap(wrap(x + 30000) + 30000));
+      REQUIRE(eval.evaluate(es, [x](uintptr_t) -> std::int16_t { return std::int16_t(x); }) == expected);
+    }
+  }
+
+  SECTION("constant operands of division have to fit scalar type")
+  {
+    auto s_sum = builder.create_sexpr(mk_op('+'), ux, Value(100000));
+    auto s_div = builder.create_sexpr(mk_op('/'), ux, Value(100000));
+
+    const ExprEvaluator sum_eval(builder.create_expr(s_sum).value());
+    const ExprEvaluator div_eval(builder.create_expr(s_div).value());
+
+    // Sum wraps around in int16 as if the constant was truncated
+    REQUIRE(sum_eval.bytecode().fits<std::int16_t>());
+
+    REQUIRE(div_eval.bytecode().fits<std::int32_t>());
+    REQUIRE(div_eval.bytecode().fits<std::int64_t>());
+    REQUIRE_FALSE(div_eval.bytecode().fits<std::int16_t>());
+  }
+}
@@ -0,0 +1,116 @@
+#include "../eval.hh"
+#include "../expr_builder.hh"
+
+#include "unknowns.hh"
+
+#include "catch2/catch.hpp"
+
+#include <numeric>
+
+using namespace glfdc;
+
+static auto mk_op = [](char c) -> OperatorKind { return OperatorKind(c); };
+
+TEST_CASE("Evaluation statistics", "[eval][stats]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto ux = builder.get_binding(test_unkwns.get_by_name("x"));
+  auto uy = builder.get_binding(test_unkwns.get_by_name("y"));
+
+  // (x*y) * ((x*y) - x) - both x*y and (x*y)-x are memoized
+  auto s_1 = builder.create_sexpr(mk_op('*'), ux, uy);
+  auto s_2 = builder.create_sexpr(mk_op('-'), s_1, ux);
+  auto s_3 = builder.create_sexpr(mk_op('*'), s_1, s_2);
+
+  const Expr e = builder.create_expr(s_3).value();
+
+  auto lazy_mapping = std::apply(ReusedExprMapping::create_lazy_mapping, builder.reuses());
+  REQUIRE(lazy_mapping.size() == 2);
+
+  ExprEvaluator eval(e, lazy_mapping);
+  EvalState es(lazy_mapping);
+
+  auto binding_fn = [&test_unkwns](uintptr_t p) -> int { return int(test_unkwns.index(p)) + 2; };
+
+  reset_eval_stats_total();
+
+  EvalState reference_es(lazy_mapping);
+  REQUIRE(eval.evaluate(es, binding_fn) == eval.evaluate_reference(reference_es, binding_fn));
+
+  if (!eval_stats_enabled)
+  {
+    REQUIRE(eval.stats().evaluations_ == 0);
+    REQUIRE(es.stats().operations_ == 0);
+    REQUIRE(es.slot_stats().empty());
+    REQUIRE(eval_stats_total().evaluations_ == 0);
+    return;
+  }
+
+  SECTION("first evaluation misses every memo slot")
+  {
+    // Without reference evaluation done above
+    eval.reset_stats();
+
+    es.clear();
+    es.reset_stats();
+    eval.evaluate(es, binding_fn);
+
+    const EvalCounters c = es.stats();
+
+    REQUIRE(c.evaluations_ == 1);
+    REQUIRE(c.operations_ == 3);
+    REQUIRE(c.memo_misses_ == 2);
+    REQUIRE(c.memo_hits_ == 0);
+    REQUIRE(c.binding_calls_ == 2);
+    REQUIRE(c.peak_stack_depth_ == eval.bytecode().max_depth());
+
+    THEN("memoized subexpressions are not evaluated again")
+    {
+      eval.evaluate(es, binding_fn);
+
+      const EvalCounters c2 = es.stats();
+
+      REQUIRE(c2.evaluations_ == 2);
+      REQUIRE(c2.operations_ == 3 + 1);
+      REQUIRE(c2.memo_hits_ == 2);
+      REQUIRE(c2.memo_misses_ == 2);
+
+      const auto slots = es.slot_stats();
+      REQUIRE(slots.size() == 2);
+
+      for (const auto& slot : slots)
+        REQUIRE(slot.misses_ == 1);
+
+      REQUIRE(std::accumulate(slots.begin(), slots.end(), std::uint64_t(0),
+                              [](std::uint64_t n, const MemoSlotCounters& s) { return n + s.hits_; }) == c2.memo_hits_);
+
+      // Evaluator counts the same evaluations
+      REQUIRE(eval.stats().evaluations_ == 2);
+      REQUIRE(eval.stats().operations_ == c2.operations_);
+    }
+  }
+
+  SECTION("reference and batched evaluation are counted as well")
+  {
+    const EvalCounters total = eval_stats_total();
+
+    // Bytecode and reference evaluation from above
+    REQUIRE(total.evaluations_ == 2);
+    REQUIRE(total.operations_ == 6);
+    REQUIRE(total.binding_calls_ == 2 + 2);
+    REQUIRE(eval.stats().evaluations_ == 2);
+
+    const int col_x[] = {1, 2, 3}, col_y[] = {4, 5, 6};
+    const int* columns[] = {col_x, col_y};
+    int results[3];
+
+    eval.evaluate_batch(es, columns, 3, results);
+
+    REQUIRE(eval.stats().evaluations_ == 2 + 3);
+    // Batch doesn't memoize, but x*y is held in register
+    REQUIRE(eval.stats().operations_ == 6 + 3 * 3);
+    REQUIRE(eval_stats_total().evaluations_ == 2 + 3);
+  }
+}
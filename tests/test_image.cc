@@ -0,0 +1,226 @@
+#include "../eval.hh"
+#include "../expr_builder.hh"
+#include "../image.hh"
+
+#include "unknowns.hh"
+
+#include "catch2/catch.hpp"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include <unistd.h>
+
+using namespace glfdc;
+
+static auto mk_op = [](char c) -> OperatorKind { return OperatorKind(c); };
+
+TEST_CASE("Mapped image", "[image]")
+{
+  const std::string path = (std::filesystem::temp_directory_path() /
+                            ("glfdc_image_" + std::to_string(getpid()) + ".img")).string();
+
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto binding_fn = [&test_unkwns](uintptr_t p) -> int {
+    return int(test_unkwns.index(p)) * 3 - 20;
+  };
+
+  auto ux = builder.get_binding(test_unkwns.get_by_name("x"));
+  auto uy = builder.get_binding(test_unkwns.get_by_name("y"));
+  auto uz = builder.get_binding(test_unkwns.get_by_name("z"));
+
+  auto s_1 = builder.create_sexpr(mk_op('*'), ux, uy);
+  auto s_2 = builder.create_sexpr(mk_op('/'), s_1, Value(7));
+  auto s_3 = builder.create_sexpr(mk_op('%'), builder.create_sexpr(mk_op('-'), uz, s_1), Value(8));
+  auto s_4 = builder.create_sexpr(mk_op('+'), s_2, s_3);
+
+  const Expr e_4 = builder.create_expr(s_4).value();
+  const Expr e_3 = builder.create_expr(s_3).value();
+
+  auto lazy_mapping = std::apply(ReusedExprMapping::create_lazy_mapping, builder.reuses());
+
+  const ExprEvaluator eager(e_4);
+  const ExprEvaluator lazy_e_4(e_4, lazy_mapping);
+  const ExprEvaluator lazy_e_3(e_3, lazy_mapping);
+
+  auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+  EvalState es(eager_mapping);
+
+  const int expected_e_4 = eager.evaluate(es, binding_fn);
+  const int expected_e_3 = lazy_e_3.evaluate_reference(es, binding_fn);
+
+  REQUIRE(write_image(path, builder.dag(), {&eager, &lazy_e_4, &lazy_e_3}));
+
+  auto image = MappedImage::open(path);
+  REQUIRE(image.has_value());
+
+  SECTION("DAG is stored as is")
+  {
+    const ExprDAGView& dag = image->dag();
+
+    REQUIRE(dag.node_count() == builder.dag().node_count());
+    REQUIRE(dag.nunbound_values_ == 3);
+    REQUIRE(dag.get_binding(UnboundValue{1}) == builder.dag().get_binding(UnboundValue{1}));
+    REQUIRE(dag.fetch_packed(std::get<SExprRef>(s_4)) == builder.dag().fetch_packed(std::get<SExprRef>(s_4)));
+  }
+
+  SECTION("evaluators run off mapped pages")
+  {
+    const auto& evaluators = image->evaluators();
+    REQUIRE(evaluators.size() == 3);
+
+    // Evaluators compiled with the same mapping share it
+    REQUIRE(image->mappings().size() == 2);
+    REQUIRE(&evaluators[1].mapping() == &evaluators[2].mapping());
+    REQUIRE(evaluators[1].mapping().size() == lazy_mapping.size());
+
+    REQUIRE(evaluators[0].root() == e_4.subexpr_);
+    REQUIRE(evaluators[0].evaluate(es, binding_fn) == expected_e_4);
+
+    EvalState lazy_es(evaluators[1].mapping());
+
+    REQUIRE(evaluators[1].evaluate(lazy_es, binding_fn) == expected_e_4);
+    // Served from memo
+    REQUIRE(evaluators[2].evaluate(lazy_es, binding_fn) == expected_e_3);
+
+    std::vector<int> binding_values;
+
+    for (auto binding : builder.dag().unbound_values_)
+      binding_values.push_back(binding_fn(binding));
+
+    lazy_es.clear();
+    REQUIRE(evaluators[2].evaluate(lazy_es, binding_values.data()) == expected_e_3);
+
+    THEN("image outlives moved from object")
+    {
+      MappedImage moved = std::move(image.value());
+      REQUIRE(moved.evaluators()[0].evaluate(es, binding_fn) == expected_e_4);
+    }
+  }
+
+  SECTION("incompatible file is rejected")
+  {
+    image.reset();
+
+    std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+    f.seekp(8);
+    const std::uint32_t version = image::VERSION + 1;
+    f.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    f.close();
+
+    REQUIRE(!MappedImage::open(path).has_value());
+    REQUIRE(!MappedImage::open(path + ".missing").has_value());
+  }
+
+  SECTION("truncated file is rejected")
+  {
+    const auto size = std::filesystem::file_size(path);
+    std::filesystem::resize_file(path, size - 16);
+
+    REQUIRE(!MappedImage::open(path).has_value());
+  }
+
+  SECTION("mapping predating later nodes is restored")
+  {
+    image.reset();
+
+    // New unbound node shifts keys of internal ones
+    auto s_5 = builder.create_sexpr(mk_op('*'), ux, uz);
+    const Expr e_5 = builder.create_expr(builder.create_sexpr(mk_op('-'), s_5, s_4)).value();
+    const ExprEvaluator eager_e_5(e_5);
+
+    REQUIRE(write_image(path, builder.dag(), {&lazy_e_3, &eager_e_5}));
+
+    auto reopened = MappedImage::open(path);
+    REQUIRE(reopened.has_value());
+
+    const ReusedExprMapping& restored = reopened->evaluators()[0].mapping();
+    REQUIRE(restored.size() == lazy_mapping.size());
+
+    for (const Operand& op : {s_1, s_2, s_3, s_4})
+      REQUIRE(restored.slot(std::get<SExprRef>(op)) == lazy_mapping.slot(std::get<SExprRef>(op)));
+
+    EvalState lazy_es(restored);
+    REQUIRE(reopened->evaluators()[0].evaluate(lazy_es, binding_fn) == expected_e_3);
+    REQUIRE(reopened->evaluators()[1].evaluate(es, binding_fn) == eager_e_5.evaluate(es, binding_fn));
+  }
+
+  SECTION("corrupt records and code are rejected")
+  {
+    image.reset();
+
+    std::vector<char> bytes(std::filesystem::file_size(path));
+    std::ifstream(path, std::ios::binary).read(bytes.data(), std::streamsize(bytes.size()));
+
+    auto rejects = [&](std::uint64_t offset, auto value) {
+      std::vector<char> corrupt = bytes;
+      std::memcpy(corrupt.data() + offset, &value, sizeof(value));
+      std::ofstream(path, std::ios::binary | std::ios::trunc).write(corrupt.data(), std::streamsize(corrupt.size()));
+
+      return !MappedImage::open(path).has_value();
+    };
+
+    image::Header h;
+    std::memcpy(&h, bytes.data(), sizeof(h));
+
+    // Mapping and code of lazy_e_4
+    const std::uint64_t mapping_at = h.mappings_.offset_ + sizeof(image::Mapping);
+    const std::uint64_t record_at = h.evaluators_.offset_ + sizeof(image::Evaluator);
+
+    image::Evaluator r;
+    std::memcpy(&r, bytes.data() + record_at, sizeof(r));
+
+    REQUIRE(rejects(mapping_at + offsetof(image::Mapping, universe_), std::uint64_t(1) << 60));
+    REQUIRE(rejects(mapping_at + offsetof(image::Mapping, unbound_count_), std::uint64_t(0)));
+    REQUIRE(rejects(record_at + offsetof(image::Evaluator, max_depth_), std::uint64_t(0)));
+    REQUIRE(rejects(record_at + offsetof(image::Evaluator, nregisters_), r.code_.count_ + 1));
+    REQUIRE(rejects(record_at + offsetof(image::Evaluator, mapping_), h.mappings_.count_));
+
+    std::size_t memo_loads = 0, binding_args = 0;
+
+    for (std::size_t pc=0; pc<r.code_.count_; ++pc)
+    {
+      const std::uint64_t at = r.code_.offset_ + pc * sizeof(Instruction);
+
+      Instruction instr;
+      std::memcpy(&instr, bytes.data() + at, sizeof(instr));
+
+      REQUIRE(rejects(at + offsetof(Instruction, code_), std::uint8_t(0xff)));
+
+      if (instr.code_ == OpCode::memo_load)
+      {
+        ++memo_loads;
+        REQUIRE(rejects(at + offsetof(Instruction, memo_slot_), std::uint32_t(lazy_mapping.size())));
+        REQUIRE(rejects(at + offsetof(Instruction, rhs_), std::uint32_t(r.code_.count_ + 1)));
+        REQUIRE(rejects(at + offsetof(Instruction, rhs_), std::uint32_t(pc)));
+        continue;
+      }
+
+      if (instr.code_ == OpCode::reg_store)
+        continue;
+
+      if (instr.lhs_kind_ == ArgKind::binding)
+      {
+        ++binding_args;
+        REQUIRE(rejects(at + offsetof(Instruction, lhs_), std::uint32_t(r.bindings_.count_)));
+      }
+
+      // Extra stack operand leaves stack unbalanced
+      if (instr.lhs_kind_ != ArgKind::stack)
+        REQUIRE(rejects(at + offsetof(Instruction, lhs_kind_), ArgKind::stack));
+    }
+
+    REQUIRE(memo_loads > 0);
+    REQUIRE(binding_args > 0);
+
+    std::ofstream(path, std::ios::binary | std::ios::trunc).write(bytes.data(), std::streamsize(bytes.size()));
+    REQUIRE(MappedImage::open(path).has_value());
+  }
+
+  std::remove(path.c_str());
+}
@@ -0,0 +1,235 @@
+#include "../eval.hh"
+#include "../expr_builder.hh"
+#include "../interval.hh"
+
+#include "unknowns.hh"
+
+#include "catch2/catch.hpp"
+
+#include <random>
+
+using namespace glfdc;
+
+static auto mk_op = [](char c) -> OperatorKind { return OperatorKind(c); };
+
+TEST_CASE("Interval arithmetic", "[interval]")
+{
+  const OperatorKind ops[] = {mk_op('+'), mk_op('-'), mk_op('*'), mk_op('/'), mk_op('%')};
+
+  SECTION("contains every result and is tight for +-*")
+  {
+    constexpr int BOUND = 5;
+
+    for (OperatorKind op : ops)
+    for (int llo=-BOUND; llo<=BOUND; ++llo)
+    for (int lhi=llo; lhi<=BOUND; ++lhi)
+    for (int rlo=-BOUND; rlo<=BOUND; ++rlo)
+    for (int rhi=rlo; rhi<=BOUND; ++rhi)
+    {
+      const Interval range = interval_of(op, Interval{llo, lhi}, Interval{rlo, rhi});
+
+      int lo = std::numeric_limits<int>::max();
+      int hi = std::numeric_limits<int>::min();
+
+      for (int l=llo; l<=lhi; ++l)
+      for (int r=rlo; r<=rhi; ++r)
+      {
+        const int v = cfold(op, l, r);
+        REQUIRE(range.contains(v));
+
+        lo = std::min(lo, v);
+        hi = std::max(hi, v);
+      }
+
+      if (op == OperatorKind::add || op == OperatorKind::sub || op == OperatorKind::mul || op == OperatorKind::div)
+        REQUIRE(range == Interval{lo, hi});
+    }
+  }
+
+  SECTION("possible overflow gives full range")
+  {
+    constexpr int max = std::numeric_limits<int>::max();
+
+    REQUIRE(interval_of(mk_op('+'), Interval{0, max}, Interval{0, 1}).is_full());
+    REQUIRE(interval_of(mk_op('*'), Interval{1, 65536}, Interval{1, 65536}).is_full());
+    REQUIRE(interval_of(mk_op('/'), Interval::full(), Interval{-1, -1}).is_full());
+
+    REQUIRE(interval_of(mk_op('*'), Interval{1, 65535}, Interval{1, 32768}) == Interval{1, 65535 * 32768});
+  }
+
+  SECTION("modulo is bounded by divisor and dividend")
+  {
+    REQUIRE(interval_of(mk_op('%'), Interval{0, 1000}, Interval{1, 8}) == Interval{0, 7});
+    REQUIRE(interval_of(mk_op('%'), Interval{-1000, 3}, Interval{-8, 8}) == Interval{-7, 3});
+    REQUIRE(interval_of(mk_op('%'), Interval{0, 5}, Interval{8, 64}) == Interval{0, 5});
+    REQUIRE(interval_of(mk_op('%'), Interval{10, 20}, Interval{0, 0}) == Interval::point(0));
+  }
+}
+
+TEST_CASE("Range analysis", "[interval]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto ux = builder.get_binding(test_unkwns.get_by_name("x"));
+  auto uy = builder.get_binding(test_unkwns.get_by_name("y"));
+  auto uz = builder.get_binding(test_unkwns.get_by_name("z"));
+
+  // x in [0, 100], y in [1, 65535], z in [-5, 5]
+  auto binding_range = [&](uintptr_t p) -> Interval {
+    const auto name = test_unkwns.index(p);
+
+    if (name == test_unkwns.index(test_unkwns.get_by_name("x")))
+      return Interval{0, 100};
+
+    if (name == test_unkwns.index(test_unkwns.get_by_name("y")))
+      return Interval{1, 65535};
+
+    return Interval{-5, 5};
+  };
+
+  auto s_mod = builder.create_sexpr(mk_op('%'), ux, Value(4));  // [0, 3]
+  auto s_fold = builder.create_sexpr(mk_op('/'), s_mod, Value(8)); // [0, 0]
+  auto s_div = builder.create_sexpr(mk_op('/'), ux, uy);           // [0, 100]
+  auto s_mul = builder.create_sexpr(mk_op('*'), uy, Value(65536)); // may overflow
+  auto s_nz = builder.create_sexpr(mk_op('%'), s_mul, uy);
+  auto s_guard = builder.create_sexpr(mk_op('/'), s_div, uz);
+  auto s_add = builder.create_sexpr(mk_op('+'), s_fold, s_div);
+  auto s_root = builder.create_sexpr(mk_op('-'), s_add, s_guard);
+
+  const RangeAnalysis ranges(builder.dag(), binding_range);
+
+  REQUIRE(ranges.range(s_mod) == Interval{0, 3});
+  REQUIRE(ranges.range(s_fold) == Interval::point(0));
+  REQUIRE(ranges.constant(s_fold) == 0);
+  REQUIRE(ranges.range(s_div) == Interval{0, 100});
+  REQUIRE(ranges.range(s_mul).is_full());
+  REQUIRE(ranges.range(s_nz) == Interval{-65534, 65534});
+  REQUIRE(ranges.range(s_guard) == Interval{-100, 100});
+  REQUIRE(ranges.range(s_root) == Interval{-100, 200});
+
+  auto opcodes = [](const Bytecode& code) {
+    std::vector<OpCode> ret;
+
+    for (const Instruction& instr : code.code())
+      ret.push_back(instr.code_);
+
+    return ret;
+  };
+
+  auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+
+  SECTION("single valued subexpression is folded")
+  {
+    const Expr e = builder.create_expr(s_fold).value();
+    const ExprEvaluator eval(e, eager_mapping, ranges);
+
+    REQUIRE(eval.bytecode().code().size() == 1);
+    REQUIRE(eval.bytecode().bindings().empty());
+
+    EvalState es(eager_mapping);
+    REQUIRE(eval.evaluate(es, [](uintptr_t) { return 77; }) == 0);
+
+    const ExprEvaluator root_eval(builder.create_expr(s_add).value(), eager_mapping, ranges);
+    REQUIRE(opcodes(root_eval.bytecode()) == std::vector<OpCode>{OpCode::div_narrow, OpCode::add});
+  }
+
+  SECTION("zero check is dropped for divisor excluding zero")
+  {
+    REQUIRE(opcodes(ExprEvaluator(builder.create_expr(s_nz).value(), eager_mapping, ranges).bytecode())
+            == std::vector<OpCode>{OpCode::mul, OpCode::mod_nz});
+
+    REQUIRE(opcodes(ExprEvaluator(builder.create_expr(s_guard).value(), eager_mapping, ranges).bytecode())
+            == std::vector<OpCode>{OpCode::div_narrow, OpCode::div});
+
+    // Without ranges nothing changes
+    REQUIRE(opcodes(ExprEvaluator(builder.create_expr(s_guard).value()).bytecode())
+            == std::vector<OpCode>{OpCode::div, OpCode::div});
+  }
+
+  SECTION("specialized evaluation matches for values within ranges")
+  {
+    const Expr e = builder.create_expr(s_root).value();
+
+    const ExprEvaluator plain(e);
+    const ExprEvaluator specialized(e, eager_mapping, ranges);
+
+    constexpr std::size_t nlanes = 300;
+    const std::size_t nunbound = builder.dag().unbound_values_.size();
+
+    std::mt19937 rng(18);
+    std::vector<std::vector<int>> columns(nunbound, std::vector<int>(nlanes));
+
+    for (std::size_t b=0; b<nunbound; ++b)
+    {
+      const Interval r = binding_range(builder.dag().unbound_values_[b]);
+
+      for (auto& v : columns[b])
+        v = r.lo_ + int(rng() % unsigned(r.hi_ - r.lo_ + 1));
+    }
+
+    std::vector<const int*> column_ptrs;
+
+    for (const auto& c : columns)
+      column_ptrs.push_back(c.data());
+
+    EvalState es(eager_mapping);
+
+    std::vector<int> expected(nlanes), results(nlanes);
+    plain.evaluate_batch(es, column_ptrs.data(), nlanes, expected.data());
+    specialized.evaluate_batch(es, column_ptrs.data(), nlanes, results.data());
+
+    REQUIRE(results == expected);
+
+    for (std::size_t lane=0; lane<nlanes; ++lane)
+    {
+      std::vector<int> values;
+
+      for (const auto& c : columns)
+        values.push_back(c[lane]);
+
+      REQUIRE(specialized.evaluate(es, values.data()) == expected[lane]);
+    }
+  }
+}
+
+TEST_CASE("Ranges and scalar width", "[interval]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto ux = builder.get_binding(test_unkwns.get_by_name("x"));
+  auto uy = builder.get_binding(test_unkwns.get_by_name("y"));
+
+  // y / (x*256), x in [1, 300], y in [0, 30000] - divisor excludes zero in 32b only
+  auto s_mul = builder.create_sexpr(mk_op('*'), ux, Value(256));
+  auto s_div = builder.create_sexpr(mk_op('/'), uy, s_mul);
+
+  const Expr e = builder.create_expr(s_div).value();
+  const Interval binding_ranges[] = {Interval{1, 300}, Interval{0, 30000}};
+  const RangeAnalysis ranges(builder.dag(), binding_ranges);
+
+  REQUIRE(!ranges.range(s_mul).contains(0));
+
+  auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+
+  // Ranges are accepted only by evaluator of scalar_type
+  static_assert(std::is_constructible_v<ExprEvaluator, const Expr&, const ReusedExprMapping&, const RangeAnalysis&>);
+  static_assert(!std::is_constructible_v<BasicExprEvaluator<std::int16_t>, const Expr&, const ReusedExprMapping&,
+                                         const RangeAnalysis&>);
+  static_assert(!std::is_constructible_v<BasicExprEvaluator<std::int64_t>, const Expr&, const ReusedExprMapping&,
+                                         const RangeAnalysis&>);
+
+  // x*256 wraps to 0 in int16 for x = 256 within its range
+  const BasicExprEvaluator<std::int16_t> eval16(e);
+  BasicEvalState<std::int16_t> es16(eager_mapping);
+  const std::int16_t values16[] = {256, 30000};
+
+  REQUIRE(eval16.evaluate(es16, values16) == 0);
+
+  const ExprEvaluator specialized(e, eager_mapping, ranges);
+  EvalState es(eager_mapping);
+  const int values[] = {256, 30000};
+
+  REQUIRE(specialized.evaluate(es, values) == 30000 / 65536);
+}
@@ -0,0 +1,266 @@
+#include "../eval.hh"
+#include "../expr_builder.hh"
+#include "../native.hh"
+
+#include "random_dag.hh"
+#include "unknowns.hh"
+
+#include "catch2/catch.hpp"
+
+#include <filesystem>
+#include <limits>
+#include <optional>
+#include <random>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace glfdc;
+
+static auto mk_op = [](char c) -> OperatorKind { return OperatorKind(c); };
+
+namespace {
+
+struct TempCacheDir
+{
+  std::string path_;
+
+  TempCacheDir()
+    : path_((std::filesystem::temp_directory_path() / ("glfdc_native_" + std::to_string(getpid()))).string())
+  {
+    std::filesystem::remove_all(path_);
+  }
+
+  ~TempCacheDir()
+  {
+    std::filesystem::remove_all(path_);
+  }
+};
+
+} // namespace anonymous
+
+TEST_CASE("Native source emission", "[native]")
+{
+  ExpressionBuilder builder;
+  builder.set_simplify(false);
+
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto ux = builder.get_binding(test_unkwns.get_by_name("x"));
+  auto uy = builder.get_binding(test_unkwns.get_by_name("y"));
+
+  auto s = builder.create_sexpr(mk_op('*'), ux, uy);
+  auto root = builder.create_sexpr(mk_op('+'), builder.create_sexpr(mk_op('/'), s, Value(3)), s);
+
+  const Expr e = builder.create_expr(root).value();
+  const NativeSource src = NativeSource::emit(e);
+
+  SECTION("one local per distinct node")
+  {
+    REQUIRE(src.code_.find("n2 = glfdc_add(n0, n1)") != std::string::npos);
+    REQUIRE(src.code_.find("n3") == std::string::npos);
+
+    REQUIRE(src.bindings_.size() == 2);
+    REQUIRE(src.binding_ids_.size() == 2);
+  }
+
+  SECTION("hash is structural")
+  {
+    ExpressionBuilder other;
+    other.set_simplify(false);
+
+    // Different bindings in the same shape
+    auto ua = other.get_binding(test_unkwns.get_by_name("a"));
+    auto ub = other.get_binding(test_unkwns.get_by_name("b"));
+
+    auto t = other.create_sexpr(mk_op('*'), ua, ub);
+    auto other_root = other.create_sexpr(mk_op('+'), other.create_sexpr(mk_op('/'), t, Value(3)), t);
+
+    REQUIRE(NativeSource::emit(other.create_expr(other_root).value()).hash_ == src.hash_);
+
+    auto changed_root = other.create_sexpr(mk_op('+'), other.create_sexpr(mk_op('/'), t, Value(4)), t);
+    REQUIRE(NativeSource::emit(other.create_expr(changed_root).value()).hash_ != src.hash_);
+  }
+}
+
+TEST_CASE("Native evaluation", "[native]")
+{
+  TempCacheDir cache;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  ExpressionBuilder builder;
+  builder.set_simplify(false);
+
+  // Entries which could overflow scalar_type are not added, wrap around of native code is checked separately
+  RandomDagParams params;
+  params.nnodes = 100;
+
+  const std::vector<Operand> pool = random_dag(builder, test_unkwns, 42, params);
+
+  const Expr e = builder.create_expr(pool.back()).value();
+  const ExprEvaluator reference(e);
+
+  auto mapping = ReusedExprMapping::create_eager_mapping();
+  EvalState es(mapping);
+
+  std::mt19937 rng(42);
+
+  auto check = [&](const NativeEvaluator& native) {
+    std::uniform_int_distribution<int> value_dist(-1000, 1000);
+
+    for (int i=0; i<32; ++i)
+    {
+      std::vector<int> values(test_unkwns.size());
+
+      for (auto& v : values)
+        v = (i == 0)? 0 : value_dist(rng);
+
+      auto binding_fn = [&](uintptr_t p) -> int { return values[test_unkwns.index(p)]; };
+
+      std::vector<scalar_type> by_index;
+
+      for (std::size_t u=0; u<builder.dag().unbound_values_.size(); ++u)
+        by_index.push_back(binding_fn(builder.dag().unbound_values_[u]));
+
+      const scalar_type expected = reference.evaluate(es, binding_fn);
+
+      REQUIRE(native.evaluate(es, binding_fn) == expected);
+      REQUIRE(native.evaluate(es, by_index.data()) == expected);
+    }
+  };
+
+  SECTION("system compiler")
+  {
+    NativeCompiler compiler(cache.path_);
+    const NativeEvaluator native = compiler.load(e);
+
+    // Nothing to check without compiler
+    if (!compiler.is_available())
+      return;
+
+    REQUIRE(native.is_native());
+    REQUIRE(compiler.compiled_count() == 1);
+    check(native);
+
+    THEN("shared object is cached")
+    {
+      REQUIRE(compiler.load(e).is_native());
+
+      NativeCompiler fresh(cache.path_);
+      REQUIRE(fresh.load(e).is_native());
+
+      REQUIRE(compiler.compiled_count() == 1);
+      REQUIRE(fresh.compiled_count() == 0);
+    }
+
+    THEN("cache directory is passed to compiler as it is")
+    {
+      NativeCompiler quoted(cache.path_ + "/it's $(false); exit 1");
+
+      REQUIRE(quoted.load(e).is_native());
+      REQUIRE(quoted.compiled_count() == 1);
+    }
+
+    THEN("multiplication wraps around")
+    {
+      constexpr scalar_type min = std::numeric_limits<scalar_type>::min();
+
+      ExpressionBuilder wrap_builder;
+      auto s_wrap = wrap_builder.create_sexpr(mk_op('*'), wrap_builder.get_binding(test_unkwns.get(0)), Value(min));
+      const Expr e_wrap = wrap_builder.create_expr(s_wrap).value();
+
+      // 3 * min is min modulo 2^n
+      REQUIRE(compiler.load(e_wrap).evaluate(es, [](uintptr_t) { return 3; }) == min);
+    }
+  }
+
+  SECTION("foreign object under cache name is not used")
+  {
+    ExpressionBuilder other_builder;
+    auto s_other = other_builder.create_sexpr(mk_op('+'), other_builder.get_binding(test_unkwns.get(0)), Value(1));
+    const Expr e_other = other_builder.create_expr(s_other).value();
+
+    // Objects are unloaded once their compilers are gone
+    {
+      NativeCompiler compiler(cache.path_);
+      NativeCompiler other(cache.path_ + "/other");
+
+      if (!compiler.load(e).is_native() || !other.load(e_other).is_native())
+        return;
+    }
+
+    std::vector<std::filesystem::path> objects[2];
+
+    for (int i : {0, 1})
+    {
+      for (const auto& entry : std::filesystem::directory_iterator(i? cache.path_ + "/other" : cache.path_))
+      {
+        if (entry.path().extension() == ".so")
+          objects[i].push_back(entry.path());
+      }
+    }
+
+    REQUIRE(objects[0].size() == 1);
+    REQUIRE(objects[1].size() == 1);
+
+    // Object of x+1 published under name of e
+    std::filesystem::copy_file(objects[1][0], objects[0][0].string() + ".tmp");
+    std::filesystem::rename(objects[0][0].string() + ".tmp", objects[0][0]);
+
+    NativeCompiler fresh(cache.path_);
+    const NativeEvaluator native = fresh.load(e);
+
+    REQUIRE(native.is_native());
+    REQUIRE(fresh.compiled_count() == 1);
+    check(native);
+  }
+
+  SECTION("threads of one process build the same object at once")
+  {
+    NativeCompiler compilers[4] = {NativeCompiler(cache.path_), NativeCompiler(cache.path_),
+                                   NativeCompiler(cache.path_), NativeCompiler(cache.path_)};
+    std::optional<NativeEvaluator> natives[std::size(compilers)];
+
+    std::vector<std::thread> threads;
+
+    for (std::size_t i=0; i<std::size(compilers); ++i)
+      threads.emplace_back([&, i] { natives[i].emplace(compilers[i].load(e)); });
+
+    for (auto& t : threads)
+      t.join();
+
+    if (!compilers[0].is_available())
+      return;
+
+    for (const auto& native : natives)
+    {
+      REQUIRE(native->is_native());
+      check(*native);
+    }
+
+    // Temporary files are gone
+    for (const auto& entry : std::filesystem::directory_iterator(cache.path_))
+      REQUIRE(entry.path().extension() == ".so");
+  }
+
+  SECTION("failed compile keeps compiler available")
+  {
+    NativeCompiler compiler(cache.path_, "false");
+    const NativeEvaluator native = compiler.load(e);
+
+    REQUIRE(!native.is_native());
+    REQUIRE(compiler.is_available());
+    REQUIRE(compiler.compiled_count() == 0);
+    check(native);
+  }
+
+  SECTION("missing compiler falls back to interpreter")
+  {
+    NativeCompiler compiler(cache.path_, "/nonexistent/cc");
+    const NativeEvaluator native = compiler.load(e);
+
+    REQUIRE(!native.is_native());
+    REQUIRE(!compiler.is_available());
+    check(native);
+  }
+}
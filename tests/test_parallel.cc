@@ -0,0 +1,156 @@
+#include "../eval.hh"
+#include "../expr_builder.hh"
+#include "../parallel.hh"
+
+#include "random_dag.hh"
+#include "unknowns.hh"
+
+#include "catch2/catch.hpp"
+
+#include <numeric>
+#include <random>
+#include <thread>
+
+using namespace glfdc;
+
+TEST_CASE("Parallel evaluation", "[parallel]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  RandomDagParams params;
+  params.nbindings = 8;
+  params.nnodes = 200;
+  params.lhs_window = 8;
+  params.const_every = 4;
+  params.const_lo = 2;
+  params.const_hi = 14;
+
+  const std::vector<Operand> pool = random_dag(builder, test_unkwns, 7, params);
+
+  std::vector<Expr> exprs;
+
+  for (std::size_t i=pool.size()-1; exprs.size()<6; i-=11)
+  {
+    if (is_sexpr(pool[i]))
+      exprs.push_back(builder.create_expr(pool[i]).value());
+  }
+
+  auto lazy_mapping = std::apply(ReusedExprMapping::create_lazy_mapping, builder.reuses());
+
+  // Eager and lazy evaluator of each expression
+  std::vector<std::unique_ptr<ExprEvaluator>> evaluators;
+
+  for (const Expr& e : exprs)
+  {
+    evaluators.push_back(std::make_unique<ExprEvaluator>(e));
+    evaluators.push_back(std::make_unique<ExprEvaluator>(e, lazy_mapping));
+  }
+
+  const std::size_t nunbound = builder.dag().unbound_values_.size();
+  constexpr std::size_t nsets = 64;
+
+  std::mt19937 rng(7);
+  std::vector<std::vector<int>> binding_sets(nsets, std::vector<int>(nunbound));
+
+  for (auto& set : binding_sets)
+  {
+    for (auto& v : set)
+      v = int(rng() % 2001) - 1000;
+  }
+
+  std::vector<EvalJob> jobs;
+
+  for (std::size_t i=0; i<1000; ++i)
+    jobs.push_back(EvalJob{evaluators[i % evaluators.size()].get(), binding_sets[(i * 7) % nsets].data()});
+
+  auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+  std::vector<int> expected;
+
+  for (const EvalJob& job : jobs)
+  {
+    EvalState es(job.evaluator_->mapping());
+    expected.push_back(job.evaluator_->evaluate(es, job.binding_values_));
+  }
+
+  SECTION("batch matches serial evaluation")
+  {
+    auto nthreads = GENERATE(1u, 2u, 4u);
+    ParallelEvaluator parallel(nthreads);
+
+    REQUIRE(parallel.thread_count() == nthreads);
+
+    for (int round=0; round<3; ++round)
+    {
+      std::vector<int> results(jobs.size());
+      parallel.evaluate(jobs.data(), jobs.size(), results.data());
+
+      REQUIRE(results == expected);
+
+      const auto per_thread = parallel.jobs_per_thread();
+      REQUIRE(std::accumulate(per_thread.begin(), per_thread.end(), std::size_t(0)) == jobs.size());
+    }
+
+    THEN("small batch is evaluated by calling thread")
+    {
+      std::vector<int> results(5);
+      parallel.evaluate(jobs.data(), 5, results.data());
+
+      REQUIRE(std::equal(results.begin(), results.end(), expected.begin()));
+      REQUIRE(parallel.jobs_per_thread()[0] == 5);
+    }
+
+    THEN("empty batch")
+    {
+      parallel.evaluate(jobs.data(), 0, nullptr);
+    }
+  }
+
+  SECTION("shared evaluators with pooled states")
+  {
+    EvalStatePool states(lazy_mapping, 2);
+    REQUIRE(states.capacity() == 2);
+
+    std::atomic<std::size_t> mismatches{0};
+    std::vector<std::thread> threads;
+
+    for (std::size_t t=0; t<4; ++t)
+    {
+      threads.emplace_back([&, t] {
+        for (std::size_t i=t; i<jobs.size(); i+=4)
+        {
+          const EvalJob& job = jobs[i];
+
+          if (!job.evaluator_->bytecode().is_memoized())
+            continue;
+
+          // More threads than pooled states - some leases are temporary
+          auto lease = states.acquire();
+
+          if (job.evaluator_->evaluate(lease.state(), job.binding_values_) != expected[i])
+            ++mismatches;
+        }
+      });
+    }
+
+    for (auto& t : threads)
+      t.join();
+
+    REQUIRE(mismatches == 0);
+
+    THEN("released state is reused with clear memo")
+    {
+      EvalState* first = nullptr;
+
+      {
+        auto lease = states.acquire();
+        first = &lease.state();
+        jobs[1].evaluator_->evaluate(lease.state(), jobs[1].binding_values_);
+      }
+
+      auto lease = states.acquire();
+      REQUIRE(&lease.state() == first);
+      REQUIRE(jobs[1].evaluator_->evaluate(lease.state(), jobs[1].binding_values_) == expected[1]);
+    }
+  }
+}
@@ -0,0 +1,203 @@
+#include "../eval.hh"
+#include "../expr_builder.hh"
+#include "../program.hh"
+
+#include "unknowns.hh"
+
+#include "catch2/catch.hpp"
+
+#include <numeric>
+
+using namespace glfdc;
+
+static auto mk_op = [](char c) -> OperatorKind { return OperatorKind(c); };
+
+TEST_CASE("Multi-root program", "[program]")
+{
+  auto op1 = GENERATE(mk_op('+'), mk_op('-'), mk_op('*'), mk_op('/'), mk_op('%'));
+  auto op2 = GENERATE(mk_op('+'), mk_op('-'), mk_op('*'), mk_op('/'), mk_op('%'));
+  auto op3 = GENERATE(mk_op('+'), mk_op('-'), mk_op('*'), mk_op('/'), mk_op('%'));
+
+  ExpressionBuilder builder;
+  builder.set_simplify(false);
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto binding_fn = [&test_unkwns](uintptr_t p) -> int {
+    return int(test_unkwns.index(p)) - 20;
+  };
+
+# define DECLARE_unknown(_n) auto _n = test_unkwns.get_by_name(#_n); auto u ## _n = builder.get_binding(_n);
+  DECLARE_unknown(x);
+  DECLARE_unknown(y);
+# undef DECLARE_unknown
+
+  auto s_1 = builder.create_sexpr(op1, ux, Value(3));
+  auto s_2 = builder.create_sexpr(op2, uy, Value(-2));
+  auto s_1_2 = builder.create_sexpr(op3, s_1, s_2);
+  auto s_1_1 = builder.create_sexpr(op1, s_1, s_1);
+  auto s_r = builder.create_sexpr(op2, s_1_1, s_1_2);
+
+  std::vector<Expr> roots = {
+    builder.create_expr(s_1).value(),
+    builder.create_expr(s_2).value(),
+    builder.create_expr(s_1_2).value(),
+    builder.create_expr(s_1_1).value(),
+    builder.create_expr(s_r).value(),
+  };
+
+  DYNAMIC_SECTION("Expression ops: " << char(op1) << " " << char(op2) << " " << char(op3))
+  {
+    ExprProgram program(roots);
+
+    THEN("each unique subexpression is linearized once")
+    {
+      REQUIRE(program.root_count() == roots.size());
+      REQUIRE(program.node_count() == 5);
+      REQUIRE(program.bindings().size() == 2);
+    }
+
+    THEN("results match evaluation of each root")
+    {
+      auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+      EvalState es(eager_mapping);
+
+      std::vector<int> results(roots.size());
+      program.evaluate(es, binding_fn, results.data());
+
+      for (std::size_t i=0; i<roots.size(); ++i)
+      {
+        ExprEvaluator eval(roots[i]);
+        REQUIRE(results[i] == eval.evaluate(es, binding_fn));
+      }
+
+      std::vector<int> binding_values, results_by_index(roots.size());
+
+      for (auto binding : builder.dag().unbound_values_)
+        binding_values.push_back(binding_fn(binding));
+
+      program.evaluate(es, binding_values.data(), results_by_index.data());
+      REQUIRE(results_by_index == results);
+    }
+  }
+}
+
+TEST_CASE("Incremental program evaluation", "[program]")
+{
+  auto op = GENERATE(mk_op('+'), mk_op('-'), mk_op('*'), mk_op('/'), mk_op('%'));
+
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  std::vector<int> values(test_unkwns.size());
+  std::iota(values.begin(), values.end(), 1);
+
+  auto binding_fn = [&](uintptr_t p) -> int {
+    return values[test_unkwns.index(p)];
+  };
+
+# define DECLARE_unknown(_n) auto _n = test_unkwns.get_by_name(#_n); auto u ## _n = builder.get_binding(_n);
+  DECLARE_unknown(x);
+  DECLARE_unknown(y);
+  DECLARE_unknown(z);
+# undef DECLARE_unknown
+
+  // r_0 = (x op 3) * x, r_1 = (y op z) + 1, r_2 = r_0 - r_1
+  auto s_x = builder.create_sexpr(op, ux, Value(3));
+  auto r_0 = builder.create_sexpr(mk_op('*'), s_x, ux);
+  auto s_yz = builder.create_sexpr(op, uy, uz);
+  auto r_1 = builder.create_sexpr(mk_op('+'), s_yz, Value(1));
+  auto r_2 = builder.create_sexpr(mk_op('-'), r_0, r_1);
+
+  std::vector<Expr> roots = {
+    builder.create_expr(r_0).value(),
+    builder.create_expr(r_1).value(),
+    builder.create_expr(r_2).value(),
+  };
+
+  ExprProgram program(roots);
+  IncrementalState st(program);
+
+  auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+  EvalState es(eager_mapping);
+
+  std::vector<int> results(roots.size()), expected(roots.size());
+
+  DYNAMIC_SECTION("Operator " << char(op))
+  {
+    program.evaluate_incremental(st, binding_fn, results.data());
+    program.evaluate(es, binding_fn, expected.data());
+
+    REQUIRE(st.is_initialized());
+    REQUIRE(results == expected);
+    REQUIRE(st.changed_roots().size() == roots.size());
+    REQUIRE(st.recomputed_count() == program.node_count());
+
+    WHEN("nothing changed")
+    {
+      program.evaluate_incremental(st, binding_fn, results.data());
+
+      THEN("nothing is recomputed")
+      {
+        REQUIRE(results == expected);
+        REQUIRE(st.changed_roots().empty());
+        REQUIRE(st.recomputed_count() == 0);
+      }
+    }
+
+    WHEN("only y changed")
+    {
+      values[test_unkwns.index(y)] = 17;
+
+      program.evaluate_incremental(st, binding_fn, results.data());
+      program.evaluate(es, binding_fn, expected.data());
+
+      THEN("only dependents of y are recomputed")
+      {
+        REQUIRE(results == expected);
+        REQUIRE(st.recomputed_count() <= 3);
+
+        for (auto root : st.changed_roots())
+          REQUIRE(root != 0);
+      }
+    }
+
+    WHEN("z is changed in bindings indexed by UnboundValue")
+    {
+      values[test_unkwns.index(z)] = 5;
+
+      std::vector<int> binding_values;
+
+      for (auto binding : builder.dag().unbound_values_)
+        binding_values.push_back(binding_fn(binding));
+
+      program.evaluate_incremental(st, binding_values.data(), results.data());
+      program.evaluate(es, binding_fn, expected.data());
+
+      THEN("only dependents of z are recomputed")
+      {
+        REQUIRE(results == expected);
+        REQUIRE(st.recomputed_count() <= 3);
+      }
+    }
+
+    WHEN("x is changed through set_binding")
+    {
+      values[test_unkwns.index(x)] = -4;
+
+      st.set_binding(std::get<UnboundValue>(ux), -4);
+      program.update(st, results.data());
+      program.evaluate(es, binding_fn, expected.data());
+
+      THEN("dependents of x are recomputed")
+      {
+        REQUIRE(results == expected);
+        REQUIRE(st.recomputed_count() <= 3);
+        REQUIRE(!st.changed_roots().empty());
+        REQUIRE(st.changed_roots().front() == 0);
+
+        for (auto root : st.changed_roots())
+          REQUIRE(root != 1);
+      }
+    }
+  }
+}
@@ -0,0 +1,177 @@
+#include "../eval.hh"
+#include "../expr_builder.hh"
+#include "../program.hh"
+#include "../result_cache.hh"
+
+#include "unknowns.hh"
+
+#include "catch2/catch.hpp"
+
+#include <map>
+#include <random>
+
+using namespace glfdc;
+
+static auto mk_op = [](char c) -> OperatorKind { return OperatorKind(c); };
+
+TEST_CASE("Result cache", "[cache]")
+{
+  SECTION("cache without room for single entry stores nothing")
+  {
+    ResultCache cache(4, 1, 16);
+    const int key[] = {1, 2, 3, 4}, result = 5;
+
+    REQUIRE(cache.capacity() == 0);
+    REQUIRE(cache.find(key) == nullptr);
+
+    cache.insert(key, &result);
+
+    REQUIRE(cache.find(key) == nullptr);
+    REQUIRE(cache.stats().misses_ == 2);
+    REQUIRE(cache.memory_usage() == 0);
+  }
+
+  SECTION("memory stays within cap")
+  {
+    for (std::size_t cap : {64, 1000, 4096, 100000})
+    {
+      ResultCache cache(3, 2, cap);
+
+      REQUIRE(cache.capacity() > 0);
+      REQUIRE(cache.memory_usage() <= cap);
+    }
+  }
+
+  SECTION("lookups match reference map under eviction")
+  {
+    ResultCache cache(2, 1, 2048);
+    const std::size_t capacity = cache.capacity();
+
+    REQUIRE(capacity > 16);
+
+    std::mt19937 gen(7);
+    // Many more distinct keys than capacity - cache keeps evicting
+    std::uniform_int_distribution<int> dist(0, int(capacity));
+
+    for (int i=0; i<20000; ++i)
+    {
+      const int key[] = {dist(gen), dist(gen)};
+      const int expected = key[0] * 1000 + key[1];
+
+      if (const int* cached = cache.find(key))
+      {
+        REQUIRE(*cached == expected);
+        continue;
+      }
+
+      cache.insert(key, &expected);
+      REQUIRE(cache.size() <= capacity);
+    }
+
+    const ResultCacheCounters c = cache.stats();
+
+    REQUIRE(c.hits_ + c.misses_ == 20000);
+    REQUIRE(c.insertions_ == c.misses_);
+    REQUIRE(c.evictions_ == c.insertions_ - capacity);
+    REQUIRE(cache.size() == capacity);
+
+    cache.clear();
+
+    const int key[] = {0, 0};
+    REQUIRE(cache.size() == 0);
+    REQUIRE(cache.find(key) == nullptr);
+  }
+
+  SECTION("referenced entries survive eviction")
+  {
+    ResultCache cache(1, 1, 1024);
+    const int capacity = int(cache.capacity());
+
+    for (int k=0; k<capacity; ++k)
+      cache.insert(&k, &k);
+
+    const int hot = 0;
+    REQUIRE(cache.find(&hot) != nullptr);
+
+    // Each insertion evicts single entry, CLOCK skips referenced one
+    for (int k=capacity; k<2*capacity - 1; ++k)
+      cache.insert(&k, &k);
+
+    REQUIRE(cache.find(&hot) != nullptr);
+    REQUIRE(cache.stats().evictions_ == std::uint64_t(capacity - 1));
+  }
+}
+
+TEST_CASE("Cached evaluation", "[cache][eval]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto ux = builder.get_binding(test_unkwns.get_by_name("x"));
+  auto uy = builder.get_binding(test_unkwns.get_by_name("y"));
+
+  auto s_1 = builder.create_sexpr(mk_op('*'), ux, uy);
+  auto s_2 = builder.create_sexpr(mk_op('-'), s_1, ux);
+  auto s_3 = builder.create_sexpr(mk_op('%'), s_2, Value(7));
+
+  std::vector<Expr> roots = {
+    builder.create_expr(s_1).value(),
+    builder.create_expr(s_2).value(),
+    builder.create_expr(s_3).value(),
+  };
+
+  // Binding values of few repeating shapes
+  std::mt19937 gen(3);
+  std::uniform_int_distribution<int> dist(-4, 4);
+  std::map<uintptr_t, int> values;
+
+  auto binding_fn = [&values](uintptr_t p) -> int { return values.at(p); };
+
+  auto next_bindings = [&]() {
+    values[test_unkwns.get_by_name("x")] = dist(gen);
+    values[test_unkwns.get_by_name("y")] = dist(gen);
+  };
+
+  SECTION("evaluator")
+  {
+    ExprEvaluator eval(roots.back());
+    EvalState es(eval.mapping());
+
+    ExprEvaluator::ResultCache cache = eval.create_result_cache(4096);
+
+    for (int i=0; i<1000; ++i)
+    {
+      next_bindings();
+      REQUIRE(eval.evaluate(es, cache, binding_fn) == eval.evaluate(es, binding_fn));
+    }
+
+    // At most 9*9 distinct binding sets, each missed once
+    REQUIRE(cache.stats().misses_ <= 81);
+    REQUIRE(cache.stats().hits_ == 1000 - cache.stats().misses_);
+    REQUIRE(cache.stats().hit_rate() > 0.9);
+  }
+
+  SECTION("program")
+  {
+    ExprProgram program(roots);
+    auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+    EvalState es(eager_mapping);
+
+    ResultCache cache = program.create_result_cache(4096);
+
+    for (int i=0; i<1000; ++i)
+    {
+      next_bindings();
+
+      std::vector<int> cached(roots.size()), expected(roots.size());
+
+      program.evaluate(es, cache, binding_fn, cached.data());
+      program.evaluate(es, binding_fn, expected.data());
+
+      REQUIRE(cached == expected);
+    }
+
+    REQUIRE(cache.stats().misses_ <= 81);
+    REQUIRE(cache.stats().insertions_ == cache.stats().misses_);
+  }
+}
@@ -0,0 +1,315 @@
+#include "../concurrent_builder.hh"
+#include "../eval.hh"
+#include "../expr_builder.hh"
+#include "../simplify.hh"
+
+#include "random_dag.hh"
+#include "unknowns.hh"
+
+#include "catch2/catch.hpp"
+
+#include <limits>
+
+using namespace glfdc;
+
+static auto mk_op = [](char c) -> OperatorKind { return OperatorKind(c); };
+
+TEST_CASE("Algebraic simplification", "[simplify]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto ux = builder.get_binding(test_unkwns.get_by_name("x"));
+  auto uy = builder.get_binding(test_unkwns.get_by_name("y"));
+
+  const Operand s = builder.create_sexpr(mk_op('*'), ux, uy);
+  const Operand zero = Value(0);
+
+  REQUIRE(builder.simplifies());
+  REQUIRE(builder.rewrite_count() == 0);
+
+  SECTION("identities")
+  {
+    for (Operand x : {Operand(ux), s})
+    {
+      REQUIRE(builder.create_sexpr(mk_op('+'), x, Value(0)) == x);
+      REQUIRE(builder.create_sexpr(mk_op('+'), Value(0), x) == x);
+      REQUIRE(builder.create_sexpr(mk_op('-'), x, Value(0)) == x);
+      REQUIRE(builder.create_sexpr(mk_op('*'), x, Value(1)) == x);
+      REQUIRE(builder.create_sexpr(mk_op('*'), Value(1), x) == x);
+      REQUIRE(builder.create_sexpr(mk_op('/'), x, Value(1)) == x);
+    }
+
+    REQUIRE(builder.rewrite_count() == 12);
+    REQUIRE(builder.dag().node_count() == 1);
+  }
+
+  SECTION("annihilators")
+  {
+    for (Operand x : {Operand(ux), s})
+    {
+      REQUIRE(builder.create_sexpr(mk_op('*'), x, Value(0)) == zero);
+      REQUIRE(builder.create_sexpr(mk_op('%'), x, Value(1)) == zero);
+      REQUIRE(builder.create_sexpr(mk_op('%'), x, Value(-1)) == zero);
+      REQUIRE(builder.create_sexpr(mk_op('/'), Value(0), x) == zero);
+      REQUIRE(builder.create_sexpr(mk_op('%'), Value(0), x) == zero);
+      // Division by zero evaluates to 0
+      REQUIRE(builder.create_sexpr(mk_op('/'), x, Value(0)) == zero);
+      REQUIRE(builder.create_sexpr(mk_op('%'), x, Value(0)) == zero);
+      REQUIRE(builder.create_sexpr(mk_op('-'), x, x) == zero);
+      REQUIRE(builder.create_sexpr(mk_op('%'), x, x) == zero);
+    }
+
+    REQUIRE(builder.rewrite_count() == 18);
+    REQUIRE(builder.dag().node_count() == 1);
+  }
+
+  SECTION("no rule applies")
+  {
+    REQUIRE(is_sexpr(builder.create_sexpr(mk_op('/'), s, s)));
+    REQUIRE(is_sexpr(builder.create_sexpr(mk_op('-'), Value(0), s)));
+    REQUIRE(is_sexpr(builder.create_sexpr(mk_op('*'), s, Value(-1))));
+    REQUIRE(is_sexpr(builder.create_sexpr(mk_op('-'), ux, uy)));
+
+    REQUIRE(builder.rewrite_count() == 0);
+  }
+
+  SECTION("constant chains are reassociated")
+  {
+    auto add = [&](auto l, auto r) { return builder.create_sexpr(mk_op('+'), l, r); };
+    auto sub = [&](auto l, auto r) { return builder.create_sexpr(mk_op('-'), l, r); };
+    auto mul = [&](auto l, auto r) { return builder.create_sexpr(mk_op('*'), l, r); };
+
+    REQUIRE(add(add(s, Value(1)), Value(2)) == add(s, Value(3)));
+    REQUIRE(add(Value(2), add(Value(1), s)) == add(s, Value(3)));
+    REQUIRE(add(sub(s, Value(5)), Value(2)) == add(s, Value(-3)));
+    REQUIRE(add(sub(Value(5), s), Value(2)) == sub(Value(7), s));
+
+    REQUIRE(sub(add(s, Value(1)), Value(2)) == add(s, Value(-1)));
+    REQUIRE(sub(sub(s, Value(1)), Value(2)) == sub(s, Value(3)));
+    REQUIRE(sub(sub(Value(1), s), Value(2)) == sub(Value(-1), s));
+
+    REQUIRE(sub(Value(5), add(s, Value(2))) == sub(Value(3), s));
+    REQUIRE(sub(Value(5), sub(s, Value(2))) == sub(Value(7), s));
+    REQUIRE(sub(Value(5), sub(Value(2), s)) == add(s, Value(3)));
+
+    REQUIRE(mul(mul(ux, Value(2)), Value(3)) == mul(ux, Value(6)));
+
+    THEN("chain cancelling out reduces to its operand")
+    {
+      REQUIRE(sub(add(s, Value(4)), Value(4)) == s);
+      REQUIRE(add(sub(uy, Value(4)), Value(4)) == Operand(uy));
+      REQUIRE(sub(Value(4), sub(Value(4), s)) == s);
+    }
+
+    THEN("long chain collapses into single node")
+    {
+      Operand acc = ux;
+
+      for (int i=1; i<=100; ++i)
+        acc = (i % 2)? add(acc, Value(i)) : sub(acc, Value(1));
+
+      REQUIRE(acc == add(ux, Value(2500 - 50)));
+
+      const std::size_t rewrites = builder.rewrite_count();
+
+      acc = uy;
+
+      for (int i=1; i<=10; ++i)
+        acc = add(acc, Value(i));
+
+      // Each but first addition is folded into previous one
+      REQUIRE(builder.rewrite_count() - rewrites == 9);
+      REQUIRE(acc == add(uy, Value(55)));
+    }
+  }
+
+  SECTION("chain with overflowing constant is kept")
+  {
+    auto mul = [&](auto l, auto r) { return builder.create_sexpr(mk_op('*'), l, r); };
+    auto add = [&](auto l, auto r) { return builder.create_sexpr(mk_op('+'), l, r); };
+    auto sub = [&](auto l, auto r) { return builder.create_sexpr(mk_op('-'), l, r); };
+
+    constexpr int max = std::numeric_limits<int>::max();
+    constexpr int min = std::numeric_limits<int>::min();
+
+    const Operand x_65536 = mul(ux, Value(65536));
+    REQUIRE(std::get<SExprRef>(mul(x_65536, Value(65536))) != std::get<SExprRef>(x_65536));
+    REQUIRE(is_sexpr(add(add(ux, Value(max)), Value(1))));
+    REQUIRE(is_sexpr(sub(sub(ux, Value(min)), Value(-1))));
+    REQUIRE(is_sexpr(sub(Value(min), add(ux, Value(1)))));
+
+    REQUIRE(builder.rewrite_count() == 0);
+  }
+
+  SECTION("disabled simplification keeps all nodes")
+  {
+    builder.set_simplify(false);
+
+    REQUIRE(is_sexpr(builder.create_sexpr(mk_op('+'), ux, Value(0))));
+    REQUIRE(is_sexpr(builder.create_sexpr(mk_op('-'), s, s)));
+    REQUIRE(builder.rewrite_count() == 0);
+  }
+
+  SECTION("rewrite doesn't have to save node")
+  {
+    const std::size_t nodes = builder.dag().node_count();
+
+    // (x+1)+2 is x+3, x+1 stays in DAG
+    builder.create_sexpr(mk_op('+'), builder.create_sexpr(mk_op('+'), ux, Value(1)), Value(2));
+
+    REQUIRE(builder.rewrite_count() == 1);
+    REQUIRE(builder.dag().node_count() == nodes + 2);
+  }
+
+  SECTION("reset clears counter")
+  {
+    builder.create_sexpr(mk_op('*'), ux, Value(1));
+    REQUIRE(builder.rewrite_count() == 1);
+
+    builder.reset();
+    REQUIRE(builder.rewrite_count() == 0);
+  }
+}
+
+TEST_CASE("Simplification preserves value", "[simplify]")
+{
+  auto seed = GENERATE(1u, 2u, 3u, 4u, 5u, 6u, 7u, 8u);
+  auto test_unkwns = alpahabetic_unknowns();
+
+  ExpressionBuilder simplified, plain;
+  plain.set_simplify(false);
+
+  // Same random expression built by both builders, constants on either side are folded
+  RandomDagParams params;
+  params.nbindings = 4;
+  params.nnodes = 200;
+  params.lhs_window = 1;
+  params.const_lhs_every = 5;
+  params.const_lo = -3;
+  params.const_hi = 3;
+  // Values of binding_fn below
+  params.binding_lo = -9;
+  params.binding_hi = 12;
+
+  const std::vector<Operand> s_pool = random_dag(simplified, test_unkwns, seed, params);
+  const std::vector<Operand> p_pool = random_dag(plain, test_unkwns, seed, params);
+
+  auto binding_fn = [&test_unkwns](uintptr_t p) -> int {
+    return int(test_unkwns.index(p)) * 7 - 9;
+  };
+
+  auto value_of = [&](ExpressionBuilder& builder, Operand op) -> int {
+    if (is_value(op))
+    {
+      const Value v = std::get<Value>(op);
+      return is_unbound_value(op)? binding_fn(builder.dag().get_binding(std::get<UnboundValue>(v)))
+                                 : std::get<scalar_type>(v);
+    }
+
+    auto mapping = ReusedExprMapping::create_eager_mapping();
+    EvalState es(mapping);
+
+    const Expr e = builder.create_expr(op).value();
+    return ExprEvaluator(e).evaluate(es, binding_fn);
+  };
+
+  for (std::size_t i=0; i<s_pool.size(); i+=7)
+    REQUIRE(value_of(simplified, s_pool[i]) == value_of(plain, p_pool[i]));
+
+  REQUIRE(simplified.dag().node_count() <= plain.dag().node_count());
+}
+
+TEST_CASE("Simplification preserves value in wider scalar", "[simplify]")
+{
+  auto simplify = GENERATE(false, true);
+
+  ExpressionBuilder builder;
+  builder.set_simplify(simplify);
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto ux = builder.get_binding(test_unkwns.get_by_name("x"));
+
+  // (x*65536)*65536 - chain constant doesn't fit 32b scalar
+  auto s_1 = builder.create_sexpr(mk_op('*'), ux, Value(65536));
+  auto s_2 = builder.create_sexpr(mk_op('*'), s_1, Value(65536));
+  // (x + max) + max
+  auto s_3 = builder.create_sexpr(mk_op('+'), ux, Value(std::numeric_limits<int>::max()));
+  auto s_4 = builder.create_sexpr(mk_op('+'), s_3, Value(std::numeric_limits<int>::max()));
+
+  auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+  BasicEvalState<std::int64_t> es(eager_mapping);
+  auto binding_fn = [](uintptr_t) -> std::int64_t { return 1; };
+
+  DYNAMIC_SECTION("Simplification " << (simplify? "on" : "off"))
+  {
+    const BasicExprEvaluator<std::int64_t> mul_eval(builder.create_expr(s_2).value());
+    REQUIRE(mul_eval.evaluate(es, binding_fn) == std::int64_t(1) << 32);
+
+    const BasicExprEvaluator<std::int64_t> add_eval(builder.create_expr(s_4).value());
+    REQUIRE(add_eval.evaluate(es, binding_fn) == 2 * std::int64_t(std::numeric_limits<int>::max()) + 1);
+  }
+}
+
+TEST_CASE("Simplified root is still expression", "[simplify]")
+{
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto ux = builder.get_binding(test_unkwns.get_by_name("x"));
+
+  // Each root reduces to binding or scalar
+  const Operand roots[] = {
+    builder.create_sexpr(mk_op('+'), ux, Value(0)),
+    builder.create_sexpr(mk_op('*'), ux, Value(1)),
+    builder.create_sexpr(mk_op('*'), ux, Value(0)),
+    builder.create_sexpr(mk_op('-'), ux, ux),
+    Value(5),
+  };
+  const int expected[] = {7, 7, 0, 0, 5};
+
+  auto binding_fn = [](uintptr_t) { return 7; };
+  auto eager_mapping = ReusedExprMapping::create_eager_mapping();
+  EvalState es(eager_mapping);
+
+  REQUIRE(is_value(roots[0]));
+  REQUIRE(is_value(roots[2]));
+
+  for (std::size_t i=0; i<std::size(roots); ++i)
+  {
+    const auto e = builder.create_expr(roots[i]);
+    REQUIRE(e.has_value());
+
+    const ExprEvaluator eval(*e);
+    REQUIRE(eval.evaluate(es, binding_fn) == expected[i]);
+    REQUIRE(eval.evaluate_reference(es, binding_fn) == expected[i]);
+  }
+
+  // Root node of the same operand is created once
+  const std::size_t nodes = builder.dag().node_count();
+  builder.create_expr(roots[0]);
+  builder.create_expr(roots[4]);
+
+  REQUIRE(builder.dag().node_count() == nodes);
+
+  SECTION("builder without simplification keeps DAG unchanged")
+  {
+    ExpressionBuilder plain;
+    plain.set_simplify(false);
+
+    auto px = plain.get_binding(test_unkwns.get_by_name("x"));
+    const std::size_t plain_nodes = plain.dag().node_count();
+
+    REQUIRE(!plain.create_expr(Value(5)).has_value());
+    REQUIRE(!plain.create_expr(px).has_value());
+    REQUIRE(plain.dag().node_count() == plain_nodes);
+    REQUIRE(plain.reuses().first.size() + plain.reuses().second.size() == plain_nodes);
+
+    ConcurrentExpressionBuilder concurrent;
+    auto cx = concurrent.get_binding(test_unkwns.get_by_name("x"));
+    concurrent.finish();
+
+    REQUIRE(!concurrent.create_expr(Value(5)).has_value());
+    REQUIRE(!concurrent.create_expr(cx).has_value());
+  }
+}
@@ -0,0 +1,140 @@
+#include "../eval.hh"
+#include "../expr_builder.hh"
+#include "../static_expr.hh"
+
+#include "unknowns.hh"
+
+#include "catch2/catch.hpp"
+
+#include <random>
+
+using namespace glfdc;
+
+static auto mk_op = [](char c) -> OperatorKind { return OperatorKind(c); };
+
+namespace se = glfdc::static_expr;
+
+namespace {
+
+using se::arg;
+using se::operator""_c;
+
+// Constant subexpressions are folded into single Constant
+static_assert(std::is_same_v<decltype(2_c * 3_c + 1_c), se::Constant<7>>, "");
+static_assert(std::is_same_v<decltype(arg<0> / 0_c), se::Node<OperatorKind::div, se::Placeholder<0>, se::Constant<0>>>, "");
+static_assert(decltype(7_c / 0_c)::value == 0, "Division by zero folds to 0");
+static_assert(decltype(7_c % 0_c)::value == 0, "");
+static_assert(decltype(-7_c / 2_c)::value == -3, "");
+static_assert(decltype(-7_c % 2_c)::value == -1, "");
+
+// Evaluation is constexpr
+static_assert((arg<0> + 3_c)(4) == 7, "");
+static_assert(((arg<0> - arg<1>) * arg<2>)(10, 4, 3) == 18, "");
+static_assert((arg<1> % arg<0>)(0, 5) == 0, "");
+
+static_assert(se::arity_v<decltype(1_c + 2_c)> == 0, "");
+static_assert(se::arity_v<decltype(arg<2> * arg<0>)> == 3, "");
+
+} // namespace anonymous
+
+TEST_CASE("Static expressions", "[static_expr]")
+{
+  using se::arg;
+  using se::operator""_c;
+
+  ExpressionBuilder builder;
+  auto test_unkwns = alpahabetic_unknowns();
+
+  auto binding_fn = [&test_unkwns](uintptr_t p) -> int {
+    return int(test_unkwns.index(p)) * 5 - 12;
+  };
+
+  auto evaluate = [&](Operand op) -> int {
+    if (is_scalar(op))
+      return std::get<scalar_type>(std::get<Value>(op));
+
+    if (is_unbound_value(op))
+      return binding_fn(builder.dag().get_binding(std::get<UnboundValue>(std::get<Value>(op))));
+
+    auto mapping = ReusedExprMapping::create_eager_mapping();
+    EvalState es(mapping);
+
+    const Expr e = builder.create_expr(op).value();
+    return ExprEvaluator(e).evaluate(es, binding_fn);
+  };
+
+  const uintptr_t bindings[] = {
+    test_unkwns.get_by_name("x"), test_unkwns.get_by_name("y"), test_unkwns.get_by_name("z")
+  };
+
+  SECTION("lowered expression matches inline evaluation")
+  {
+    constexpr auto e = ((arg<0> + 3_c) * arg<1> - arg<2> / 4_c) % (arg<0> - 7_c);
+    static_assert(se::arity_v<decltype(e)> == 3, "");
+
+    const Operand op = se::lower(e, builder, bindings);
+    REQUIRE(is_sexpr(op));
+
+    REQUIRE(evaluate(op) == e(binding_fn(bindings[0]), binding_fn(bindings[1]), binding_fn(bindings[2])));
+  }
+
+  SECTION("constant expression lowers to scalar")
+  {
+    constexpr auto e = (10_c - 4_c) * 7_c;
+    REQUIRE(se::lower(e, builder, bindings) == Operand(Value(42)));
+    REQUIRE(builder.dag().node_count() == 0);
+  }
+
+  SECTION("lowering shares nodes with runtime built expressions")
+  {
+    const Value ux = builder.get_binding(bindings[0]);
+    const Value uy = builder.get_binding(bindings[1]);
+
+    const Operand runtime = builder.create_sexpr(mk_op('*'), ux, uy);
+    const std::size_t nodes = builder.dag().node_count();
+
+    REQUIRE(se::lower(arg<0> * arg<1>, builder, bindings) == runtime);
+    REQUIRE(builder.dag().node_count() == nodes);
+
+    THEN("runtime operand can be bound to placeholder")
+    {
+      constexpr auto e = arg<0> + arg<0> / 3_c;
+
+      const Operand args[] = {runtime};
+      const Operand op = se::lower(e, builder, args);
+
+      const int xy = binding_fn(bindings[0]) * binding_fn(bindings[1]);
+      REQUIRE(evaluate(op) == e(xy));
+    }
+  }
+}
+
+TEST_CASE("Static expressions match evaluator", "[static_expr]")
+{
+  using se::arg;
+  using se::operator""_c;
+
+  auto seed = GENERATE(1u, 2u, 3u, 4u);
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> dist(-50, 50);
+
+  auto test_unkwns = alpahabetic_unknowns();
+  const uintptr_t bindings[] = {test_unkwns.get_by_name("a"), test_unkwns.get_by_name("b")};
+
+  constexpr auto e = (arg<0> * 13_c + arg<1>) / (arg<1> % 5_c - 2_c) - -arg<0> % 8_c;
+
+  for (int i=0; i<16; ++i)
+  {
+    const int a = dist(rng), b = dist(rng);
+
+    auto binding_fn = [&](uintptr_t p) -> int { return (p == bindings[0])? a : b; };
+
+    ExpressionBuilder builder;
+    const Expr expr = builder.create_expr(se::lower(e, builder, bindings)).value();
+
+    auto mapping = ReusedExprMapping::create_eager_mapping();
+    EvalState es(mapping);
+
+    REQUIRE(ExprEvaluator(expr).evaluate(es, binding_fn) == e(a, b));
+  }
+}
@@ -24,11 +24,15 @@ public:
     return unknowns.size();
   }
 
+  std::size_t index(uintptr_t unk) const noexcept
+  {
+    const int* ptr = reinterpret_cast<const int*>(unk);
+    return std::size_t(ptr - unknowns.data());
+  }
+
   std::string name(uintptr_t unk) const
   {
-    int* ptr = reinterpret_cast<int*>(unk);
-    size_t index = ptr - unknowns.data();
-    return glfdc::to_base26(index);
+    return glfdc::to_base26(index(unk));
   }
 
 private: